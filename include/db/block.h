@@ -35,6 +35,8 @@
 
 namespace db {
 
+struct KeySearch;
+
 // Block
 const short BLOCK_TYPE_DATA = 0;  // 数据
 const short BLOCK_TYPE_INDEX = 1; // 索引
@@ -46,6 +48,13 @@ const short NODE_TYPE_ROOT = 0;          // 根节点
 const short NODE_TYPE_INTERNAL = 1;      // 普通的中间节点
 const short NODE_TYPE_POINT_TO_LEAF = 3; // 指向叶子节点的中间节点
 
+// IndexBlock的布局，定长布局的值就是键值宽度
+const unsigned short INDEX_LAYOUT_RECORD = 0; // key-pointer编码成记录，slots[]有序
+const unsigned short INDEX_LAYOUT_INT32 = 4;  // 4B整数键值数组+指针数组
+const unsigned short INDEX_LAYOUT_INT64 = 8;  // 8B整数键值数组+指针数组
+// 索引文件格式版本，IndexBlock头部变了就加1
+const unsigned short INDEX_FORMAT_VERSION = 1;
+
 ////
 // @brief
 // 根block
@@ -87,6 +96,11 @@ class Root
     static const int ROOT_TRAILER_OFFSET =  // checksum偏移量
         ROOT_SIZE - ROOT_TRAILER_SIZE;
 
+    static const int ROOT_STATS_OFFSET =
+        ROOT_BLOCKCNT_OFFSET + ROOT_BLOCKCNT_SIZE; // 统计信息偏移量
+    static const int ROOT_STATS_SIZE =             // 统计信息区大小
+        ROOT_TRAILER_OFFSET - ROOT_STATS_OFFSET;
+
   protected:
     unsigned char *buffer_; // block对应的buffer
 
@@ -117,16 +131,17 @@ class Root
     // 获取时戳
     inline TimeStamp getTimeStamp()
     {
+        long long micros;
+        ::memcpy(&micros, buffer_ + ROOT_TIMESTAMP_OFFSET, ROOT_TIMESTAMP_SIZE);
         TimeStamp ts;
-        ::memcpy(&ts, buffer_ + ROOT_TIMESTAMP_OFFSET, ROOT_TIMESTAMP_SIZE);
-        *((long long *) &ts) = be64toh(*((long long *) &ts));
+        ts.setMicros((long long) be64toh(micros));
         return ts;
     }
     // 设定时戳
     inline void setTimeStamp(TimeStamp ts)
     {
-        *((long long *) &ts) = htobe64(*((long long *) &ts));
-        ::memcpy(buffer_ + ROOT_TIMESTAMP_OFFSET, &ts, ROOT_TIMESTAMP_SIZE);
+        long long micros = (long long) htobe64(ts.micros());
+        ::memcpy(buffer_ + ROOT_TIMESTAMP_OFFSET, &micros, ROOT_TIMESTAMP_SIZE);
     }
 
     //设定block数目
@@ -160,6 +175,9 @@ class Root
         ::memcpy(buffer_ + ROOT_HEAD_OFFSET, &head, ROOT_HEAD_SIZE);
     }
 
+    // 统计信息区，由使用者编码
+    inline unsigned char *getStats() { return buffer_ + ROOT_STATS_OFFSET; }
+
     // 获取空闲链头
     inline int getGarbage()
     {
@@ -430,14 +448,56 @@ class Block
 
     // 分配记录及slots，返回false表示失败
     virtual bool allocate(const unsigned char *header, struct iovec *iov, int iovcnt);
+    // 按字节复制一条已编码的记录，不解码成iovec，返回false表示失败
+    bool copyRecord(unsigned char *record);
 
     // 删除record
     virtual int recDelete(struct iovec *keyField, RelationInfo *relationInfo);
+    // 删除slots[begin, end)对应的记录，返回删除的记录数
+    int recDeleteRange(unsigned short begin, unsigned short end);
+
+    // 在有序的slots[]中查找第一个键值不小于keyField的位置
+    // search非NULL时用特化版本，否则逐次调用type->compare
+    unsigned short lowerBound(
+        struct iovec *keyField,
+        DataType *type,
+        unsigned int key,
+        const KeySearch *search = NULL);
+    // 在有序的slots[]中查找第一个键值大于keyField的位置
+    unsigned short upperBound(
+        struct iovec *keyField,
+        DataType *type,
+        unsigned int key,
+        const KeySearch *search = NULL);
 
     // 重写
     virtual int rewrite();
+
+    // 获得block的buffer
+    inline unsigned char *getBuffer() { return buffer_; }
+
+  protected:
+    // 原地整理记录区：记录依次前移到start，dropTombstone时丢弃tombstone
+    int compactRecords(unsigned short start, bool dropTombstone);
+};
+
+// 按键值类型特化的查找和排序，比较在循环里内联，不再逐次经函数指针
+// Table/BPlusTree在open时按键值类型选定一次
+struct KeySearch
+{
+    using Bound =
+        unsigned short (*)(Block &, struct iovec *, DataType *, unsigned int);
+    using Sort = void (*)(Block &, DataType *, unsigned int);
+
+    const char *name; // 数据类型名，NULL表示通用版本
+    Bound lowerBound; // 第一个键值不小于keyField的slot
+    Bound upperBound; // 第一个键值大于keyField的slot
+    Sort sort;        // slots[]按键值排序
 };
 
+// 返回type对应的特化版本，没有特化的类型返回按type->compare的通用版本
+const KeySearch *findKeySearch(DataType *type);
+
 class MetaBlock : public Block
 {
   public:
@@ -495,8 +555,25 @@ class DataBlock : public Block
   public:
     void clear(unsigned int blockid);
     bool allocate(const unsigned char *header, struct iovec *iov, int iovcnt);
+    // 二分找到键值相等的第一条有效记录，没有返回-1
+    int findLive(struct iovec *keyField, RelationInfo *relationInfo);
     int recDelete(struct iovec *keyField, RelationInfo *relationInfo);
+    // 只设置tombstone，记录在rewrite时才真正删除
+    int recTombstone(struct iovec *keyField, RelationInfo *relationInfo);
+    // 用新记录替换第index条记录，slot位置不变：旧空间放得下时原地覆盖，
+    // 否则在本block内重新分配；放不下返回false，旧记录保留
+    bool recReplace(
+        unsigned short index,
+        const unsigned char *header,
+        struct iovec *iov,
+        int iovcnt);
     int rewrite();
+    // 获得碎片大小：已删除和tombstone记录占用、rewrite才能回收的空间
+    inline int getFragment()
+    {
+        return getFreespace() - DATA_DEFAULT_FREESPACE + getSlotsNum() * 2 -
+               getUsedspace();
+    }
     // 获得记录个数
     inline unsigned int getRowCount()
     {
@@ -528,19 +605,106 @@ class IndexBlock : public Block
         INDEX_ROWS_OFFSET + INDEX_ROWS_SIZE; // node类型偏移量
     static const int NODE_TYPE_SIZE = 2;     // node类型大小2B
 
+    static const int INDEX_PREFIX_OFFSET =
+        NODE_TYPE_OFFSET + NODE_TYPE_SIZE; // 键值公共前缀长度偏移量
+    static const int INDEX_PREFIX_SIZE = 2; // 键值公共前缀长度大小2B
+
+    // 布局字段占了原来记录开始的位置，INDEX_INDEX_START由36移到38，
+    // 索引root记下INDEX_FORMAT_VERSION，之前建的索引文件打开时返回EINVAL
+    static const int INDEX_LAYOUT_OFFSET =
+        INDEX_PREFIX_OFFSET + INDEX_PREFIX_SIZE; // 布局偏移量
+    static const int INDEX_LAYOUT_SIZE = 2;      // 布局大小2B
+
     static const short INDEX_DEFAULT_FREESPACE =
-        NODE_TYPE_OFFSET + NODE_TYPE_SIZE + 2; // 空闲空间缺省偏移量
+        INDEX_LAYOUT_OFFSET + INDEX_LAYOUT_SIZE; // 空闲空间缺省偏移量
     static const int INDEX_INDEX_START =
-        NODE_TYPE_OFFSET + NODE_TYPE_SIZE + 2; // 记录开始位置
+        INDEX_LAYOUT_OFFSET + INDEX_LAYOUT_SIZE; // 记录开始位置，有前缀时先放前缀
+    // 定长布局：键值数组从8B对齐处开始，之后是同样个数的4B指针数组，不用slots[]
+    static const int INDEX_KEY_START = (INDEX_INDEX_START + 7) / 8 * 8;
+    static const int INDEX_POINTER_SIZE = 4;
 
     static const int INITIAL_FREE_SPACE_SIZE =
         BLOCK_CHECKSUM_OFFSET - INDEX_DEFAULT_FREESPACE; //初始空闲空间大小
 
   public:
     void clear(unsigned int blockid);
+    // 键值以完整形式传入，有公共前缀时只保存后缀，只用于记录布局
     bool allocate(const unsigned char *header, struct iovec *iov, int iovcnt);
+    // 二分找到键值相等的第一条有效记录，没有返回-1
+    int findLive(struct iovec *keyField, RelationInfo *relationInfo);
     int recDelete(struct iovec *keyField, RelationInfo *relationInfo);
     int rewrite();
+
+    // 以下按条目(key---right pointer)访问，两种布局都适用，键值是完整形式
+    // 设定布局，只能在clear之后、插入条目之前调用
+    void setLayout(unsigned short layout);
+    // 获得布局
+    inline unsigned short getLayout()
+    {
+        unsigned short layout;
+        ::memcpy(&layout, buffer_ + INDEX_LAYOUT_OFFSET, INDEX_LAYOUT_SIZE);
+        return be16toh(layout);
+    }
+    // 定长布局最多能放的条目数
+    inline unsigned short getCapacity()
+    {
+        return (unsigned short) ((BLOCK_CHECKSUM_OFFSET - INDEX_KEY_START) /
+                                 (getLayout() + INDEX_POINTER_SIZE));
+    }
+    // 第index个条目的右指针
+    int getPointer(unsigned short index);
+    // 右指针为pointer的条目，没有返回-1
+    int findPointer(int pointer);
+    // 按键值有序插入一个条目，放不下返回false
+    bool insertEntry(
+        struct iovec *keyField,
+        int pointer,
+        DataType *type,
+        const KeySearch *search = NULL);
+    // 在末尾追加一个条目，调用者保证键值有序，放不下返回false
+    bool appendEntry(struct iovec *keyField, int pointer);
+    // 删除条目[begin, end)，返回删除的条目数
+    int removeEntries(unsigned short begin, unsigned short end);
+    // 只保留前count个条目
+    void truncate(unsigned short count);
+    // 把条目[begin, end)按序追加到to，to的布局和前缀必须相同
+    bool copyEntries(IndexBlock &to, unsigned short begin, unsigned short end);
+
+    // 以下按字节处理公共前缀，只适用于CHAR/VARCHAR这类按字节比较的键值
+    // 定长布局没有前缀
+    // 用首尾键值的公共前缀压缩，返回false表示前缀没有变长
+    bool compress();
+    // 换成新的前缀并重写所有记录，放不下返回false且block不变
+    bool setPrefix(const unsigned char *prefix, unsigned short length);
+    // 键值和前缀比较，返回<0、0、>0
+    int comparePrefix(struct iovec *keyField);
+    // 键值和第index条记录的完整键值比较，返回<0、0、>0
+    int compareKey(struct iovec *keyField, unsigned short index, DataType *type);
+    // 取第index条记录的完整键值，field->iov_base由调用者释放
+    void getKey(unsigned short index, struct iovec *field);
+    // 在有序的slots[]中查找，keyField是完整键值
+    unsigned short lowerBound(
+        struct iovec *keyField,
+        DataType *type,
+        unsigned int key,
+        const KeySearch *search = NULL);
+    unsigned short upperBound(
+        struct iovec *keyField,
+        DataType *type,
+        unsigned int key,
+        const KeySearch *search = NULL);
+
+    // 获得公共前缀长度
+    inline unsigned short getPrefixLength()
+    {
+        unsigned short length;
+        ::memcpy(&length, buffer_ + INDEX_PREFIX_OFFSET, INDEX_PREFIX_SIZE);
+        return be16toh(length);
+    }
+    // 获得公共前缀
+    inline unsigned char *getPrefix() { return buffer_ + INDEX_INDEX_START; }
+    // 获得记录区的开始位置，前缀按8B对齐
+    unsigned short getRecordStart();
     // 获得记录个数
     inline unsigned int getRowCount()
     {
@@ -568,6 +732,27 @@ class IndexBlock : public Block
         type = htobe16(type);
         ::memcpy(buffer_ + NODE_TYPE_OFFSET, &type, NODE_TYPE_SIZE);
     }
+
+  private:
+    // 设定公共前缀长度
+    inline void setPrefixLength(unsigned short length)
+    {
+        length = htobe16(length);
+        ::memcpy(buffer_ + INDEX_PREFIX_OFFSET, &length, INDEX_PREFIX_SIZE);
+    }
+    // 定长布局的键值和指针
+    inline unsigned char *getKeyAt(unsigned short index)
+    {
+        return buffer_ + INDEX_KEY_START + index * getLayout();
+    }
+    inline unsigned char *getPointerAt(unsigned short index)
+    {
+        return buffer_ + INDEX_KEY_START + getCapacity() * getLayout() +
+               index * INDEX_POINTER_SIZE;
+    }
+    // 定长布局的lowerBound(upper为false)和upperBound
+    unsigned short
+    searchFixed(struct iovec *keyField, unsigned short layout, bool upper);
 };
 } // namespace db
 
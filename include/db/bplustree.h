@@ -11,6 +11,7 @@
 
 #include <db/schema.h>
 #include <db/block.h>
+#include <db/indexmirror.h>
 #include <db/record.h>
 #include <string>
 #include <utility>
@@ -21,14 +22,8 @@
 
 namespace db {
 
-//比较
-struct treeCompare;
 class BPlusTree
 {
-  public:
-    //友元类声明
-    friend struct treeCompare;
-
   public:
     BPlusTree();
     ~BPlusTree();
@@ -46,7 +41,7 @@ class BPlusTree
     int initial();
     //分裂indexblock
     int splitIndexBlock(int blockid, int &newid, struct iovec &field);
-    //合并indexblock
+    //合并indexblock，放不下返回S_FALSE，blockid不变
     int combineIndexBlock(
         int blockid,
         int comblockid,
@@ -58,57 +53,65 @@ class BPlusTree
     int writeIndexBlock(int blockid);
     //更新root
     int writeRoot(int treeRoot);
+    //分配indexblock，优先复用空闲链中的block
+    int allocIndexBlock();
+    //回收indexblock到空闲链
+    int freeIndexBlock(int blockid);
     //!返回当前block的num,测试需要
     unsigned int blockNum();
     //!返回当前block的slotsNum,测试需要
     unsigned short slotsNum();
     //查找，返回dataBlock的id
     int sraech(struct iovec &field, std::stack<int> &path);
+    //按键值找指向叶子leafid的节点，path同sraech；重复键值时叶子可能在
+    //若干个相等分隔键之间的任一个儿子下，逐个尝试，找不到返回S_FALSE
+    int locate(struct iovec &field, int leafid, std::stack<int> &path);
     //插入
     int insert(struct iovec &field, int rightid, std::stack<int> &path);
     //删除
     int remove(struct iovec &field, std::stack<int> &path);
+    //删除指向blockid的索引条目，不做合并
+    int unlink(int blockid, std::stack<int> &path);
 
-    //更新父节点的key
-    int updata(
-        int blockid,
-        struct iovec &oldField,
-        struct iovec &newField,
-        int pointer);
+    //更新父节点中右指针为pointer的条目的key
+    int updata(int blockid, struct iovec &newField, int pointer);
+    //取父节点中指向blockid的条目的key
+    int getKey(int fatherid, int blockid, struct iovec *field);
+    //取节点的所有儿子，按键值顺序，返回节点类型
+    int getChildren(int blockid, std::vector<int> &children);
+    //收集所有指向叶子的节点
+    int getLeafParents(std::vector<int> &parents);
+    //树高，含叶子层
+    int height();
+    //最右边的叶子
+    int lastLeaf();
     //找节点的兄弟节点
     int getBrother(int fatherid, int blockid, int &brotherid, int &isRight);
 
   private:
-    unsigned char *buffer_;     // block，TODO: 缓冲模块
-    RelationInfo *relationInfo; //表信息
-    int root_;                  //根节点id
-    unsigned int IndexBlockCnt; // indexblock数目
-};
-struct treeCompare
-{
-  private:
-    FieldInfo &fin;
-    unsigned int key;
-    BPlusTree &bplustree;
+    // 以下键值参数都是索引格式
+    int insertKey(struct iovec &field, int rightid, std::stack<int> &path);
+    int removeKey(struct iovec &field, std::stack<int> &path);
+    int locateKey(
+        struct iovec &key,
+        int leafid,
+        int blockid,
+        std::stack<int> &path);
+    // 字段转成索引格式，KEY_FORMAT_NORMALIZED时分配内存，用freeKey释放
+    void encodeKey(struct iovec &field, struct iovec &key);
+    void freeKey(struct iovec &key);
+    // 索引格式原地还原成字段，key必须是malloc得到的
+    void decodeKey(struct iovec &key, struct iovec *field);
 
-  public:
-    treeCompare(FieldInfo &f, unsigned int k, BPlusTree &ibplustree)
-        : fin(f)
-        , key(k)
-        , bplustree(ibplustree)
-    {}
-    bool operator()(const unsigned short &x, const unsigned short &y) const
-    {
-        //根据x, y偏移量，引用两条记录；
-        Record rx, ry;
-        rx.attach(bplustree.buffer_ + x, Block::BLOCK_SIZE);
-        ry.attach(bplustree.buffer_ + y, Block::BLOCK_SIZE);
-        iovec keyx, keyy;
-        rx.specialRef(keyx, key);
-        ry.specialRef(keyy, key);
-        return fin.type->compare(
-            keyx.iov_base, keyy.iov_base, keyx.iov_len, keyy.iov_len);
-    }
+  private:
+    unsigned char *buffer_;      // block，TODO: 缓冲模块
+    RelationInfo *relationInfo;  //表信息
+    DataType *keyType_;          //索引中键值的比较类型
+    const KeySearch *keySearch_; //按keyType_特化的查找
+    unsigned short layout_;      //新建indexblock的布局
+    IndexMirror mirror_;         //上层节点的内存镜像
+    int root_;                   //根节点id
+    unsigned int IndexBlockCnt;  // indexblock数目
 };
 } // namespace db
 
@@ -16,16 +16,30 @@ namespace db {
 struct DataType
 {
     using Compare = bool (*)(const void *, const void *, size_t, size_t);
+    // 三路比较，返回<0、0、>0
+    using Compare3 = int (*)(const void *, const void *, size_t, size_t);
     using Copy = bool (*)(void *, const void *, size_t, size_t);
+    // 求x<s<=y的最短分隔键s，写入第一个参数，返回长度
+    using Separate =
+        size_t (*)(void *, const void *, const void *, size_t, size_t);
+    // 转换到第一个参数，返回长度，输出最多比输入长1B
+    using Normalize = size_t (*)(void *, const void *, size_t);
 
-    const char *name; // 名字
-    ptrdiff_t size;   // >0表示固定，<0表示最大大小
-    Compare compare;  // 比较函数
-    Copy copy;        // 拷贝函数
+    const char *name;      // 名字
+    ptrdiff_t size;        // >0表示固定，<0表示最大大小
+    Compare compare;       // 比较函数，x<y
+    Compare3 compare3;     // 三路比较函数，判断相等只需比较一次
+    Copy copy;             // 拷贝函数
+    Separate separate;     // 分隔键函数，NULL表示不能截短
+    Normalize normalize;   // 转成可以按字节比较(BYTES)的格式
+    Normalize denormalize; // 从按字节比较的格式还原
 };
 
 // 根据数据类型名称数据类型，返回NULL表示失败
-// CHAR VARCHAR TINYINT SMALLINT INT BIGINT
+// CHAR VARCHAR TINYINT SMALLINT INT BIGINT BYTES TIMESTAMP DATE DOUBLE
+// BYTES按memcmp比较，短的是长的前缀时较小，是normalize的结果类型
+// TIMESTAMP、DATE都是8B的TimeStamp::stamp_，DATE取UTC当天0点
+// DOUBLE按IEEE 754全序比较，-0.0小于0.0
 DataType *findDataType(const char *name);
 
 } // namespace db
@@ -0,0 +1,69 @@
+////
+// @file indexmirror.h
+// @brief
+// 上层索引节点的内存镜像
+// 每次查找都要经过根附近的几层，镜像把这些IndexBlock解码成按Eytzinger顺序
+// (下标k的左右儿子是2k、2k+1)排列、64B对齐的键值数组和儿子数组，查找时只做
+// 比较，不再解析记录，前几层访问的键值挤在少数几个cache line里
+//
+#ifndef __DB_INDEXMIRROR_H__
+#define __DB_INDEXMIRROR_H__
+
+#include <map>
+#include "./block.h"
+#include "./datatype.h"
+
+namespace db {
+
+class IndexMirror
+{
+  public:
+    static const int LEVELS = 2;      // 镜像根以下几层，根是第0层
+    static const int LINE_SIZE = 64;  // cache line大小
+
+    // 一个IndexBlock的镜像
+    struct Node
+    {
+        int blockid;             // 对应的blockid
+        unsigned short nodeType; // 节点类型
+        unsigned short count;    // 键值个数
+        unsigned short width;    // 定长整数键值宽度，0表示变长
+        int last;                // 键值比所有条目都大时进入的儿子
+        // 以下数组按Eytzinger顺序，从下标1开始，都按64B对齐
+        unsigned char *keys;   // 定长时直接存键值，变长时存(偏移量, 长度)
+        int *children;         // 第一个大于键值的条目左边的儿子
+        unsigned char *arena;  // 变长键值的字节
+        unsigned char *memory; // malloc得到的内存
+    };
+
+  public:
+    IndexMirror();
+    ~IndexMirror();
+
+    // 设定键值的比较类型，丢弃所有节点
+    void reset(DataType *type);
+    // 丢弃所有节点，根变化后各节点的层数都变了
+    void clear();
+    // 查找blockid的镜像，没有返回NULL
+    Node *find(int blockid);
+    // 解码block加入镜像，已有时替换
+    Node *load(IndexBlock &block);
+    // block改写后，已经镜像的节点就地重建
+    void refresh(IndexBlock &block);
+    // block被回收
+    void drop(int blockid);
+    // 查找应当进入的儿子，等价于IndexBlock::upperBound后取指针
+    int search(Node *node, struct iovec *keyField);
+    // 镜像的节点数
+    inline size_t size() { return nodes_.size(); }
+
+  private:
+    typedef std::map<int, Node *> NodeMap;
+
+    NodeMap nodes_;  // blockid到镜像
+    DataType *type_; // 键值比较类型
+};
+
+} // namespace db
+
+#endif // __DB_INDEXMIRROR_H__
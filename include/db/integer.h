@@ -51,6 +51,24 @@ class Integer
     bool encode(char *buf, size_t len) const;
     // 解码
     bool decode(char *buf, size_t len);
+
+    // 以下批量编解码，长度由首字节高2位直接算出，整块读写8B再移位，
+    // 减少分支和逐字节拷贝；离buffer末尾不足8B时退回逐个编解码
+    // 编码values[0, count)，返回写入的字节数，空间不够或值太大返回0
+    static size_t encodeArray(
+        const unsigned long long *values,
+        size_t count,
+        char *buf,
+        size_t len);
+    // 最多解码count个，解出值为stop的整数(含)后停止，返回解码个数，
+    // bytes返回消耗的字节数，失败返回0
+    static size_t decodeArray(
+        const char *buf,
+        size_t len,
+        unsigned long long *values,
+        size_t count,
+        unsigned long long stop,
+        size_t &bytes);
 };
 
 } // namespace db
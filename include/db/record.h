@@ -17,6 +17,12 @@
 //
 // 记录的分配按照4B对齐，同时要求block头部至少按照4B对齐
 //
+// 定长格式(FORMAT_FIXED)把字段数和记录总长度放在开头的4B里，字段偏移量是
+// 2B的定长数组，第k个字段不用逐个解码变长整数就能定位：
+// 字段数(14b)+总长度(16b) | 偏移量数组，正序 | Header | 各字段
+// 开头4B按Integer的4B格式编码，变长格式的记录不超过一个block，总长度只会
+// 用1B或2B编码，据此区分两种格式
+//
 //
 #ifndef __DB_RECORD_H__
 #define __DB_RECORD_H__
@@ -40,6 +46,11 @@ class Record
     static const int BYTE_MIMIMUM = 1; // 最小记录标记在header的第1字节
     static const unsigned char MASK_MINIMUM = 0x40; // 最小记录掩码
 
+    static const int FORMAT_VARINT = 0; // 变长偏移量数组
+    static const int FORMAT_FIXED = 1;  // 定长偏移量数组，O(1)访问字段
+    static const int FIXED_LENGTH_SIZE = 4; // 定长格式字段数+总长度4B
+    static const int FIXED_OFFSET_SIZE = 2; // 定长格式每个偏移量2B
+
   private:
     unsigned char *buffer_; // 记录buffer
     unsigned short length_; // buffer长度
@@ -56,17 +67,26 @@ class Record
         buffer_ = buffer;
         length_ = length;
     }
+    // 记录buffer
+    inline unsigned char *getBuffer() { return buffer_; }
     // 整个记录长度+header偏移量
-    static std::pair<size_t, size_t> size(const iovec *iov, int iovcnt);
+    static std::pair<size_t, size_t>
+    size(const iovec *iov, int iovcnt, int format = FORMAT_VARINT);
 
     // 向buffer里写各个域，返回按照对齐后的长度
-    size_t set(const iovec *iov, int iovcnt, const unsigned char *header);
+    size_t set(
+        const iovec *iov,
+        int iovcnt,
+        const unsigned char *header,
+        int format = FORMAT_VARINT);
     // 从buffer获取各字段
     bool get(iovec *iov, int iovcnt, unsigned char *header);
     // 从buffer引用各字段
     bool ref(iovec *iov, int iovcnt, unsigned char *header);
-    // 从buffer引用特定字段
-    bool specialRef(iovec &iov,unsigned int id);
+    // 从buffer引用特定字段，定长格式是O(1)
+    bool specialRef(iovec &iov, unsigned int id);
+    // 按columns的顺序引用count个字段，只解码需要的偏移量
+    bool project(iovec *iov, const unsigned int *columns, int count);
     // TODO:
     void dump(char *buf, size_t len);
 
@@ -74,6 +94,17 @@ class Record
     size_t length();
     // 获取记录字段个数
     size_t fields();
+
+    // 获取header在记录中的偏移量，失败返回0
+    size_t headerOffset();
+    // 是否定长格式
+    inline bool isFixed() { return (buffer_[0] >> 6) == 2; }
+    // 读写header
+    unsigned char getHeader();
+    void setHeader(unsigned char header);
+    // tombstone标记
+    inline bool isTombstone() { return (getHeader() & MASK_TOMBSTONE) != 0; }
+    inline void setTombstone() { setHeader(getHeader() | MASK_TOMBSTONE); }
 };
 
 } // namespace db
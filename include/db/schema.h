@@ -8,6 +8,9 @@
 // 3. 域的个数，键的位置；
 // 4. 各域的描述；（变长）
 // 5. 各种统计信息，表的大小，行数等；
+// 6. 叶子的填充因子、分裂点、借和合并的阈值；
+// 7. 索引键值的存放格式；
+// 8. 组合键的各列，二级索引所在的表及各列来源；
 // meta.db的所有信息被读入一个map，以加快对元信息的访问。
 //
 //
@@ -22,6 +25,9 @@
 
 namespace db {
 
+struct KeySearch;
+class MetaBlock;
+
 // 描述域
 struct FieldInfo
 {
@@ -30,14 +36,34 @@ struct FieldInfo
     unsigned long long index; // 位置
     long long length;         // 长度，高位表示是否固定大小
     DataType *type;           // 指向数据类型
+    const KeySearch *search;  // 作为键值时特化的查找排序，open时设定
 
     FieldInfo()
         : index(0)
         , length(0)
         , type(NULL)
+        , search(NULL)
     {}
     FieldInfo(const FieldInfo &o) = default;
 };
+// 叶子空间策略的缺省值，均为占INITIAL_FREE_SPACE_SIZE的百分比
+const unsigned short DEFAULT_FILL_FACTOR = 100; // 填充到该比例即分裂
+const unsigned short DEFAULT_SPLIT_RATIO = 50;  // 分裂时留在原block的比例
+const unsigned short DEFAULT_MERGE_RATIO = 33;  // 删除后低于该比例则借或合并
+const unsigned short DEFAULT_BORROW_RATIO = 66; // 兄弟高于该比例则借，否则合并
+
+// 索引键值的存放格式，可以组合
+const unsigned short KEY_FORMAT_PLAIN = 0;  // 原样存放
+const unsigned short KEY_FORMAT_PREFIX = 1; // IndexBlock内压缩公共前缀，须按字节比较
+const unsigned short KEY_FORMAT_NORMALIZED = 2; // 转成BYTES，按memcmp比较
+
+// 组合键隐藏列的名字，放在所有列之后
+const char *const COMPOSITE_KEY_NAME = "__key";
+
+// 键值是否唯一
+const unsigned short KEY_MODE_UNIQUE = 0;    // 重复插入返回EEXIST
+const unsigned short KEY_MODE_DUPLICATE = 1; // 允许重复，相同键值相邻存放
+
 // 内存中描述关系
 struct RelationInfo
 {
@@ -48,9 +74,29 @@ struct RelationInfo
     unsigned int key;              // 键的位置
     File dataFile;                 // 数据文件
     File indexFile;                // 索引文件
-    unsigned long long size;       // 大小
+    unsigned long long size;       // 叶子中有效记录及slot的字节数
     unsigned long long rows;       // 行数
+    unsigned short fillFactor;     // 填充因子
+    unsigned short splitRatio;     // 分裂点
+    unsigned short mergeRatio;     // 借或合并的下限
+    unsigned short borrowRatio;    // 借兄弟的下限
+    unsigned short keyFormat;      // 索引键值格式
+    unsigned short keyMode;        // 键值是否唯一
+    // 组合键的各列，非空时create在最后补一个BYTES隐藏列，
+    // 存放各列normalize后拼接的值，key指向它
+    std::vector<unsigned int> keys;
+    // 二级索引也是一张表，base是所在表的名字，sources是各列在所在表中的位置，
+    // 最后一列是所在表的主键；普通表base为空
+    std::string base;
+    std::vector<unsigned int> sources;
     std::vector<FieldInfo> fields; // 各域的描述
+    // 以下统计信息增量维护，checkpoint时写入数据文件的root，不在meta.db中
+    unsigned int leafBlocks; // 叶子数
+    unsigned short height;   // b+tree高度，含叶子层，0表示尚未加载
+    std::string minKey;      // 最小键值
+    std::string maxKey;      // 最大键值
+    bool boundsStale;        // 删除过最小或最大键值，读取时重新定位
+    bool statsDirty;         // 有尚未写入的变化
 
     RelationInfo()
         : count(0)
@@ -58,6 +104,16 @@ struct RelationInfo
         , key(0)
         , size(0)
         , rows(0)
+        , fillFactor(DEFAULT_FILL_FACTOR)
+        , splitRatio(DEFAULT_SPLIT_RATIO)
+        , mergeRatio(DEFAULT_MERGE_RATIO)
+        , borrowRatio(DEFAULT_BORROW_RATIO)
+        , keyFormat(KEY_FORMAT_PLAIN)
+        , keyMode(KEY_MODE_UNIQUE)
+        , leafBlocks(0)
+        , height(0)
+        , boundsStale(false)
+        , statsDirty(false)
     {}
 };
 
@@ -72,12 +128,15 @@ class Schema
 
   public:
     static const char *META_FILE; // "meta.db";
+    static const int FIXED_FIELDS = 17; // 域描述之前的固定字段个数
 
   private:
     std::string name_;      // 源文件名
     File metafile_;         // 元文件
     TableSpace tablespace_; // 表空间
-    unsigned char *buffer_; // block，TODO: 缓冲模块
+    unsigned char *buffer_; // 链尾的meta block，TODO: 缓冲模块
+    unsigned int tail_;     // 链尾的blockid
+    unsigned int blocks_;   // meta block数目
 
   public:
     Schema(const char *name = META_FILE);
@@ -88,6 +147,8 @@ class Schema
     std::pair<TableSpace::iterator, bool> lookup(const char *table); // 查找表
     int loadData(TableSpace::iterator it); // 加载表
     int loadIndex(TableSpace::iterator it); // 加载表的索引
+    // 列出base为table的所有二级索引
+    void indexesOf(const char *table, std::vector<std::string> &names);
 
     // 删除元文件
     inline int destroy()
@@ -97,6 +158,10 @@ class Schema
     }
 
   private:
+    // 把一个meta block中的表加入tablespace_
+    void load(MetaBlock &block);
+    // 更新root中的block数目
+    int writeRoot();
     void initIov(const char *table, RelationInfo &rel, struct iovec *iov);
     void retrieveInfo(
         std::string &table,
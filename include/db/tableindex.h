@@ -16,16 +16,68 @@
 #include <db/config.h>
 #include <algorithm>
 #include <db/bplustree.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
 
 namespace db {
 
+// 删除模式
+const int DELETE_MODE_EAGER = 0;     // 立即删除，必要时借或合并兄弟节点
+const int DELETE_MODE_TOMBSTONE = 1; // 只设置tombstone，推迟到rewrite回收
+
 ////
 // @brief
 // 表操作接口
 //
 
-//比较
-struct Compare;
+// 表的空间使用情况
+struct SpaceInfo
+{
+    unsigned int leafBlocks;      // 叶子链上的block数
+    unsigned int dataBlocks;      // 数据文件的block数，含空闲链
+    unsigned int indexBlocks;     // 索引文件的block数
+    unsigned long long liveBytes; // 有效记录及slot占用的字节数
+    double fill;                  // 叶子的平均填充度
+    double amplification;         // 空间放大：两个文件的block总字节数/有效字节数
+
+    SpaceInfo()
+        : leafBlocks(0)
+        , dataBlocks(0)
+        , indexBlocks(0)
+        , liveBytes(0)
+        , fill(0)
+        , amplification(0)
+    {}
+};
+
+// 增量维护的统计信息，不扫描表，键值是键值字段的原样
+// 空间部分和spaceInfo的扫描结果一致
+struct TableStats : public SpaceInfo
+{
+    unsigned long long rows; // 行数
+    unsigned short height;   // b+tree高度，含叶子层
+    std::string minKey;      // 最小键值，空表为空
+    std::string maxKey;      // 最大键值，空表为空
+
+    TableStats()
+        : rows(0)
+        , height(0)
+    {}
+};
+
+// 投影：扫描时只取部分字段，fields按columns的顺序引用字段，每条记录复用
+struct Projection
+{
+    std::vector<unsigned int> columns; // 要取的字段下标
+    std::vector<struct iovec> fields;  // 字段引用，指向当前block
+
+    Projection(const unsigned int *cols, int count)
+        : columns(cols, cols + count)
+        , fields(count)
+    {}
+};
 
 //表
 class Table
@@ -35,6 +87,24 @@ class Table
     RelationInfo *relationInfo; //表信息
     unsigned char *buffer_;     // block，TODO: 缓冲模块
     BPlusTree index_;           // b+tree
+    int deleteMode;             // 删除模式
+    std::string name_;          // 表名
+    std::map<std::string, Table *> secondaries_; // 二级索引，open时打开
+
+    std::recursive_mutex latch_;       // 表latch，保护buffer_和b+tree
+    std::thread compactor_;            // 后台整理线程
+    std::mutex stopMutex_;             // 保护stopping_
+    std::condition_variable stopCond_; // 唤醒整理线程
+    bool stopping_;                    // 整理线程是否要退出
+
+  public:
+    // 碎片超过该值的block在后台rewrite
+    static const int COMPACT_FRAGMENT_SIZE =
+        DataBlock::INITIAL_FREE_SPACE_SIZE / 8;
+    // 相邻的两个叶子合并后不超过该值才在后台合并，留出插入的余量
+    static const int COMPACT_MERGE_SIZE =
+        DataBlock::INITIAL_FREE_SPACE_SIZE * 2 / 3;
+
   public:
     //迭代器
     struct iterator;
@@ -43,7 +113,6 @@ class Table
 
   public:
     //友元类声明
-    friend struct Compare;
     friend struct iterator;
     friend struct blockIter;
 
@@ -71,8 +140,7 @@ class Table
         unsigned int getBlockid() { return blockid; }
         blockIter &operator=(const blockIter &o)
         {
-            blockid = o.blockid;
-            table = o.table;
+            blockid = o.blockid; // 引用不能重新绑定，只能是同一张表
             return *this;
         }
         blockIter &operator++() // 前缀
@@ -122,6 +190,7 @@ class Table
             , blockit(iblockit)
         {
             slotmax = (*blockit).getSlotsNum() - 1;
+            skip();
         }
         iterator(const iterator &o)
             : sloti(o.sloti)
@@ -138,6 +207,7 @@ class Table
         iterator &operator++() // 前缀
         {
             if (sloti <= slotmax) sloti++;
+            skip();
             return *this;
         }
         iterator operator++(int) // 后缀
@@ -155,6 +225,18 @@ class Table
             return sloti != rhs.sloti || blockit.blockid != rhs.blockit.blockid;
         }
         unsigned short getSlotid() { return sloti; }
+        // 投影扫描：只解码要取的字段，返回projection.fields，失败返回NULL
+        struct iovec *project(Projection &projection)
+        {
+            if (projection.columns.empty()) return NULL;
+            Record &rec = operator*();
+            if (!rec.project(
+                    &projection.fields[0],
+                    &projection.columns[0],
+                    (int) projection.columns.size()))
+                return NULL;
+            return &projection.fields[0];
+        }
         Record &operator*()
         {
             DataBlock block = *blockit;
@@ -167,6 +249,22 @@ class Table
             record.attach(blockit.table.buffer_ + reoff, Block::BLOCK_SIZE);
             return record;
         }
+
+      private:
+        // 跳过tombstone记录
+        void skip()
+        {
+            DataBlock block = *blockit;
+            unsigned short slotsnum = block.getSlotsNum();
+            while (sloti < slotsnum) {
+                Record rec;
+                rec.attach(
+                    blockit.table.buffer_ + block.getSlot(sloti),
+                    Block::BLOCK_SIZE);
+                if (!rec.isTombstone()) break;
+                sloti++;
+            }
+        }
     };
 
   public:
@@ -192,6 +290,12 @@ class Table
         int comblockid,
         struct iovec *field,
         int isRight);
+    //分配datablock，优先复用空闲链中的block
+    int allocDataBlock();
+    //回收datablock到空闲链
+    int freeDataBlock(int blockid);
+    //修改指定block的nextid
+    int linkDataBlock(int blockid, int nextid);
     //!返回当前block的id,测试需要
     int blockid();
     //!返回当前block的num,测试需要
@@ -210,12 +314,63 @@ class Table
     int writeDataBlock(int blockid);
     //更新root
     int writeRoot();
-    // 插入一条记录
+    // 组合键：columns依次是relationInfo->keys各列的值，只给前几列时得到前缀，
+    // 各列normalize后拼接写入key，返回长度，size不够返回0
+    size_t
+    makeKey(struct iovec *columns, int count, unsigned char *key, size_t size);
+    // 在打开的表上建二级索引：按columns各列查找，映射到主键，
+    // info给出文件路径和叶子策略，已有的记录补进索引；
+    // included各列随条目存放，只用到这些列的查询不必回表
+    int createIndex(
+        const char *index,
+        const unsigned int *columns,
+        int count,
+        RelationInfo &info,
+        const unsigned int *included = NULL,
+        int includedCount = 0);
+    // 所在表的第column列在索引条目中的位置，索引不含该列返回-1
+    int indexColumn(const char *index, unsigned int column);
+    // 只读索引：columns同lookup，entries依次是匹配条目的拷贝，
+    // 字段依次是索引列、主键、included列，用Record::attach读取
+    int lookupIndex(
+        const char *index,
+        struct iovec *columns,
+        int count,
+        std::vector<std::string> &entries);
+    // 按主键查找一条记录，拷贝到row，用Record::attach读取，不存在返回S_FALSE
+    int get(struct iovec keyField, std::string &row);
+    // 按二级索引查找，columns是索引前count列的值，rows依次是匹配记录的拷贝
+    int lookup(
+        const char *index,
+        struct iovec *columns,
+        int count,
+        std::vector<std::string> &rows);
+    // 插入一条记录，键值已存在返回EEXIST，KEY_MODE_DUPLICATE时放在相同键值之后
     int insert(const unsigned char *header, struct iovec *record, int iovcnt);
+    // 插入一条记录，键值已存在时替换第一条，只下降一次
+    int upsert(const unsigned char *header, struct iovec *record, int iovcnt);
+    //设置删除模式
+    inline void setDeleteMode(int mode) { deleteMode = mode; }
+    inline int getDeleteMode() { return deleteMode; }
     //删除一条记录
     int remove(struct iovec keyField);
     int removeAlone(int index);
-    //更新一条记录
+    //删除键值在[lo, hi]内的所有记录，整块覆盖的block直接摘除
+    int removeRange(struct iovec lo, struct iovec hi);
+    //整理一遍：rewrite碎片多的叶子，合并填充度低的相邻叶子
+    int compact();
+    //启动后台整理线程，每隔interval毫秒整理一遍
+    //整理期间只有insert/remove等加latch的操作可以并发，扫描需先停止
+    int startCompactor(unsigned int interval);
+    //停止后台整理线程
+    void stopCompactor();
+    //统计空间使用情况
+    int spaceInfo(SpaceInfo &info);
+    //读取增量维护的统计信息，删除过最小或最大键值时重新定位一次
+    int statistics(TableStats &stats);
+    //统计信息有变化时写入数据文件的root，close和后台整理时调用
+    int checkpoint();
+    //更新一条记录，键值必须不变，记录不存在返回S_FALSE
     int update(
         struct iovec keyField,
         const unsigned char *header,
@@ -230,6 +385,11 @@ class Table
         return blockIter(root.getHead(), *this);
     }
     blockIter blockEnd() { return blockIter(-1, *this); }
+    // 走b+tree定位第一条键值不小于keyField的记录所在的block
+    blockIter seekBlock(struct iovec keyField);
+    // blockIt中第一条键值不小于keyField的记录，没有时等于end(blockIt)，
+    // 范围扫描从这里开始，之后顺着block链表读
+    iterator seek(blockIter &blockIt, struct iovec keyField);
     // begin, end
     iterator begin(blockIter &blockIt) { return iterator(0, blockIt); }
     iterator end(blockIter &blockIt)
@@ -244,6 +404,73 @@ class Table
     Record &back(blockIter &blockIt) { return *last(blockIt); }
 
   private:
+    //把表设置的百分比换算成叶子的字节数
+    inline int leafBytes(unsigned short ratio)
+    {
+        return DataBlock::INITIAL_FREE_SPACE_SIZE * ratio / 100;
+    }
+    //组合键的表在record之后补上键值列，iovcnt加1；普通表原样返回record，
+    //列数不对返回NULL
+    struct iovec *withKey(
+        struct iovec *record,
+        int &iovcnt,
+        std::vector<struct iovec> &full,
+        std::vector<unsigned char> &key);
+    //row是一条完整记录，取出它在各二级索引中的键值
+    void indexKeys(struct iovec *row, std::vector<std::string> &keys);
+    //叶子data中第index条记录在各二级索引中的键值
+    void recordKeys(DataBlock &data, int index, std::vector<std::string> &keys);
+    //主键为keyField的记录在各二级索引中的键值，记录不存在时keys为空
+    int currentKeys(struct iovec keyField, std::vector<std::string> &keys);
+    //把各二级索引中的旧键值old换成row的，old为空只插入，row为NULL只删除
+    int updateIndexes(std::vector<std::string> &old, struct iovec *row);
+    //删除一条记录，不同步二级索引
+    int removeRecord(struct iovec keyField);
+    //统计：插入一条键值为keyField、占bytes字节的记录
+    void countInsert(struct iovec &keyField, unsigned long long bytes);
+    //统计：删除一条键值为keyField、占bytes字节的记录
+    void countRemove(struct iovec &keyField, unsigned long long bytes);
+    //统计信息编码到root的统计信息区
+    void saveStats(Root &root);
+    //从root加载统计信息，没有时返回false
+    bool loadStats(Root &root);
+    //扫描全表重建统计信息
+    int rebuildStats();
+    //重新定位最小、最大键值
+    int locateBounds();
+    //插入或替换，replace为false时唯一键值已存在返回EEXIST
+    int put(
+        const unsigned char *header,
+        struct iovec *record,
+        int iovcnt,
+        bool replace);
+    //替换叶子data中第index条记录，block放不下时分裂
+    int replaceRecord(
+        DataBlock &data,
+        int index,
+        const unsigned char *header,
+        struct iovec *record,
+        int iovcnt,
+        std::stack<int> &path);
+    //blockid只有一条记录分不开时，两条记录各占一个叶子，并更新索引
+    int spillInsert(
+        int blockid,
+        const unsigned char *header,
+        struct iovec *record,
+        int iovcnt,
+        std::stack<int> &path);
+    //分裂blockid后把记录插入对应的一半，并更新索引
+    int splitInsert(
+        int blockid,
+        const unsigned char *header,
+        struct iovec *record,
+        int iovcnt,
+        std::stack<int> &path);
+    //整理一个指向叶子的节点的所有儿子
+    int compactNode(int fatherid);
+    //后台整理线程
+    void compactLoop(unsigned int interval);
+
     iterator last(blockIter &blockIt)
     {
         DataBlock block = *blockIt;
@@ -251,32 +478,6 @@ class Table
         return iterator(slotsnum - 1, blockIt);
     }
 };
-struct Compare
-{
-  private:
-    FieldInfo &fin;
-    unsigned int key;
-    Table &table;
-
-  public:
-    Compare(FieldInfo &f, unsigned int k, Table &itable)
-        : fin(f)
-        , key(k)
-        , table(itable)
-    {}
-    bool operator()(const unsigned short &x, const unsigned short &y) const
-    {
-        //根据x, y偏移量，引用两条记录；
-        Record rx, ry;
-        rx.attach(table.buffer_ + x, Block::BLOCK_SIZE);
-        ry.attach(table.buffer_ + y, Block::BLOCK_SIZE);
-        iovec keyx, keyy;
-        rx.specialRef(keyx, key);
-        ry.specialRef(keyy, key);
-        return fin.type->compare(
-            keyx.iov_base, keyy.iov_base, keyx.iov_len, keyy.iov_len);
-    }
-};
 } // namespace db
 
 #endif // __DB_TABLE_INDEX_H__
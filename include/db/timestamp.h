@@ -12,21 +12,63 @@
 
 namespace db {
 
-// 时辍
+// 时辍，UTC纪元以来的微秒数，比较只是整数比较
 struct TimeStamp
 {
-    std::chrono::system_clock::time_point stamp_;
-    void now() { stamp_ = std::chrono::system_clock::now(); }
+    static const size_t STRING_SIZE = 27; // "YYYY_MM_DD-HH:MM:SS.uuuuuu"加'\0'
+    static const long long MICROS_PER_DAY = 86400000000LL;
+
+    long long stamp_; // 微秒
+
+    TimeStamp()
+        : stamp_(0)
+    {}
+    void now()
+    {
+        stamp_ = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count();
+    }
+    inline long long micros() const { return stamp_; }
+    inline void setMicros(long long micros) { stamp_ = micros; }
+    // 截到UTC当天0点，DATE类型的值
+    inline TimeStamp date() const
+    {
+        TimeStamp ts;
+        long long rem = stamp_ % MICROS_PER_DAY;
+        ts.stamp_ = stamp_ - rem - (rem < 0 ? MICROS_PER_DAY : 0);
+        return ts;
+    }
+    // 按UTC格式化，不分配内存，size不足STRING_SIZE返回false
     bool toString(char *buffer, size_t size) const;
-    void fromString(const char *time);
+    // 解析toString的格式，格式不对返回false
+    bool fromString(const char *time);
 };
 
-bool operator<(const TimeStamp &lhs, const TimeStamp &rhs);
-bool operator>(const TimeStamp &lhs, const TimeStamp &rhs);
-bool operator<=(const TimeStamp &lhs, const TimeStamp &rhs);
-bool operator>=(const TimeStamp &lhs, const TimeStamp &rhs);
-bool operator==(const TimeStamp &lhs, const TimeStamp &rhs);
-bool operator!=(const TimeStamp &lhs, const TimeStamp &rhs);
+inline bool operator<(const TimeStamp &lhs, const TimeStamp &rhs)
+{
+    return lhs.stamp_ < rhs.stamp_;
+}
+inline bool operator>(const TimeStamp &lhs, const TimeStamp &rhs)
+{
+    return lhs.stamp_ > rhs.stamp_;
+}
+inline bool operator<=(const TimeStamp &lhs, const TimeStamp &rhs)
+{
+    return lhs.stamp_ <= rhs.stamp_;
+}
+inline bool operator>=(const TimeStamp &lhs, const TimeStamp &rhs)
+{
+    return lhs.stamp_ >= rhs.stamp_;
+}
+inline bool operator==(const TimeStamp &lhs, const TimeStamp &rhs)
+{
+    return lhs.stamp_ == rhs.stamp_;
+}
+inline bool operator!=(const TimeStamp &lhs, const TimeStamp &rhs)
+{
+    return lhs.stamp_ != rhs.stamp_;
+}
 
 } // namespace db
 
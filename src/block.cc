@@ -5,12 +5,136 @@
 //
 //
 
+#include <stdlib.h>
 #include <db/block.h>
 #include <db/record.h>
 #include <db/block.h>
+#include <algorithm>
+// MSVC不定义__SSE2__，x64及/arch:SSE2以上都有SSE2
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DB_BLOCK_SSE2
+#include <immintrin.h>
+#endif
+// MSVC的/arch:AVX、/arch:AVX2不定义__SSE4_2__
+#if defined(__SSE4_2__) || defined(__AVX__)
+#define DB_BLOCK_SSE42
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 namespace db {
 
+// 按记录偏移量比较slot下标
+struct offsetCompare
+{
+    Block &block;
+
+    offsetCompare(Block &b)
+        : block(b)
+    {}
+    bool operator()(const unsigned short &x, const unsigned short &y) const
+    {
+        return block.getSlot(x) < block.getSlot(y);
+    }
+};
+
+// movemask得到的位数，MSVC没有__builtin_popcount
+static inline int maskBits(int mask)
+{
+#if defined(_MSC_VER) && defined(__AVX2__)
+    return (int) __popcnt((unsigned int) mask);
+#elif defined(_MSC_VER)
+    // 不保证有POPCNT指令，mask至多4位
+    int bits = 0;
+    for (; mask; mask &= mask - 1)
+        bits++;
+    return bits;
+#else
+    return __builtin_popcount((unsigned int) mask);
+#endif
+}
+
+// 数出定长键值数组keys[0, n)中小于k(upper时不大于k)的个数
+// 编译时打开AVX2/SSE时一次比较多个键值，否则逐个比较
+static unsigned short
+countLess(const unsigned char *keys, unsigned short n, int k, bool upper)
+{
+    unsigned short index = 0, count = 0;
+#if defined(__AVX2__)
+    __m256i kv = _mm256_set1_epi32(k);
+    for (; index + 8 <= n; index += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (keys + index * 4));
+        __m256i m = upper ? _mm256_cmpgt_epi32(v, kv)
+                          : _mm256_cmpgt_epi32(kv, v);
+        int bits = maskBits(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+        count += upper ? 8 - bits : bits;
+    }
+#elif defined(DB_BLOCK_SSE2)
+    __m128i kv = _mm_set1_epi32(k);
+    for (; index + 4 <= n; index += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (keys + index * 4));
+        __m128i m = upper ? _mm_cmpgt_epi32(v, kv) : _mm_cmpgt_epi32(kv, v);
+        int bits = maskBits(_mm_movemask_ps(_mm_castsi128_ps(m)));
+        count += upper ? 4 - bits : bits;
+    }
+#endif
+    for (; index < n; index++) {
+        int v;
+        ::memcpy(&v, keys + index * 4, sizeof(int));
+        if (upper ? v <= k : v < k) count++;
+    }
+    return count;
+}
+static unsigned short
+countLess(const unsigned char *keys, unsigned short n, long long k, bool upper)
+{
+    unsigned short index = 0, count = 0;
+#if defined(__AVX2__)
+    __m256i kv = _mm256_set1_epi64x(k);
+    for (; index + 4 <= n; index += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (keys + index * 8));
+        __m256i m = upper ? _mm256_cmpgt_epi64(v, kv)
+                          : _mm256_cmpgt_epi64(kv, v);
+        int bits = maskBits(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+        count += upper ? 4 - bits : bits;
+    }
+#elif defined(DB_BLOCK_SSE42)
+    __m128i kv = _mm_set1_epi64x(k);
+    for (; index + 2 <= n; index += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (keys + index * 8));
+        __m128i m = upper ? _mm_cmpgt_epi64(v, kv) : _mm_cmpgt_epi64(kv, v);
+        int bits = maskBits(_mm_movemask_pd(_mm_castsi128_pd(m)));
+        count += upper ? 2 - bits : bits;
+    }
+#endif
+    for (; index < n; index++) {
+        long long v;
+        ::memcpy(&v, keys + index * 8, sizeof(long long));
+        if (upper ? v <= k : v < k) count++;
+    }
+    return count;
+}
+// 定长键值的lowerBound/upperBound：先二分缩小到一个窗口，窗口内顺序数
+template <typename T>
+static unsigned short
+searchKeys(const unsigned char *keys, unsigned short n, T k, bool upper)
+{
+    const unsigned short window = 32;
+    unsigned short low = 0, high = n;
+    while (high - low > window) {
+        unsigned short mid = (low + high) / 2;
+        T v;
+        ::memcpy(&v, keys + mid * sizeof(T), sizeof(T));
+        if (upper ? v <= k : v < k)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low + countLess(keys + low * sizeof(T), high - low, k, upper);
+}
+
 void Block::clear(int spaceid, int blockid)
 {
     spaceid = htobe32(spaceid);
@@ -130,21 +254,22 @@ void IndexBlock::clear(unsigned int blockid)
 }
 bool Block::allocate(const unsigned char *header, struct iovec *iov, int iovcnt)
 {
-    // 判断是否有空间
+    // 判断是否有空间，连续空间不够时rewrite回收碎片
     unsigned short length = getFreeLength();
-    if (length == 0) return false;
+    length = length < 2 ? 0 : length - 2; // 一个slot占2字节
 
-    // 判断能否分配
+    // 判断能否分配，记录按8B对齐占用空间
     std::pair<size_t, size_t> ret = Record::size(iov, iovcnt);
-    length -= 2; // 一个slot占2字节
-    if (ret.first > length) {
+    size_t need = (ret.first + Record::ALIGN_SIZE - 1) / Record::ALIGN_SIZE *
+                  Record::ALIGN_SIZE;
+    if (need > length) {
         int usedspace = getUsedspace();
-        if (ret.first < INITIAL_FREE_SPACE_SIZE - usedspace - 2) {
+        if (need <= (size_t) (INITIAL_FREE_SPACE_SIZE - usedspace - 2)) {
             rewrite();
             length = getFreeLength();
             if (length < 2) return false;
             length -= 2;
-            if (ret.first > length) return false;
+            if (need > length) return false;
         } else
             return false;
     }
@@ -176,21 +301,22 @@ bool MetaBlock::allocate(
     struct iovec *iov,
     int iovcnt)
 {
-    // 判断是否有空间
+    // 判断是否有空间，连续空间不够时rewrite回收碎片
     unsigned short length = getFreeLength();
-    if (length == 0) return false;
+    length = length < 2 ? 0 : length - 2; // 一个slot占2字节
 
-    // 判断能否分配
+    // 判断能否分配，记录按8B对齐占用空间
     std::pair<size_t, size_t> ret = Record::size(iov, iovcnt);
-    length -= 2; // 一个slot占2字节
-    if (ret.first > length) {
+    size_t need = (ret.first + Record::ALIGN_SIZE - 1) / Record::ALIGN_SIZE *
+                  Record::ALIGN_SIZE;
+    if (need > length) {
         int usedspace = getUsedspace();
-        if (ret.first < INITIAL_FREE_SPACE_SIZE - usedspace - 2) {
+        if (need <= (size_t) (INITIAL_FREE_SPACE_SIZE - usedspace - 2)) {
             rewrite();
             length = getFreeLength();
             if (length < 2) return false;
             length -= 2;
-            if (ret.first > length) return false;
+            if (need > length) return false;
         } else
             return false;
     }
@@ -222,30 +348,33 @@ bool DataBlock::allocate(
     struct iovec *iov,
     int iovcnt)
 {
-    // 判断是否有空间
+    // 判断是否有空间，连续空间不够时rewrite回收碎片
     unsigned short length = getFreeLength();
-    if (length == 0) return false;
+    length = length < 2 ? 0 : length - 2; // 一个slot占2字节
 
-    // 判断能否分配
-    std::pair<size_t, size_t> ret = Record::size(iov, iovcnt);
-    length -= 2; // 一个slot占2字节
-    if (ret.first > length) {
+    // 判断能否分配，记录按8B对齐占用空间
+    std::pair<size_t, size_t> ret =
+        Record::size(iov, iovcnt, Record::FORMAT_FIXED);
+    size_t need = (ret.first + Record::ALIGN_SIZE - 1) / Record::ALIGN_SIZE *
+                  Record::ALIGN_SIZE;
+    if (need > length) {
         int usedspace = getUsedspace();
-        if (ret.first < INITIAL_FREE_SPACE_SIZE - usedspace - 2) {
+        if (need <= (size_t) (INITIAL_FREE_SPACE_SIZE - usedspace - 2)) {
             rewrite();
             length = getFreeLength();
             if (length < 2) return false;
             length -= 2;
-            if (ret.first > length) return false;
+            if (need > length) return false;
         } else
             return false;
     }
 
-    // 写入记录
+    // 写入记录，数据行用定长格式，取字段O(1)
     Record record;
     unsigned short oldf = getFreespace();
     record.attach(buffer_ + oldf, length);
-    unsigned short pos = (unsigned short) record.set(iov, iovcnt, header);
+    unsigned short pos = (unsigned short) record.set(
+        iov, iovcnt, header, Record::FORMAT_FIXED);
 
     // 调整usedspace
     int usedspace = getUsedspace();
@@ -268,21 +397,41 @@ bool IndexBlock::allocate(
     struct iovec *iov,
     int iovcnt)
 {
-    // 判断是否有空间
+    // 有公共前缀时只保存后缀，键值不以前缀开头就先缩短前缀
+    struct iovec stored[2];
+    unsigned short prefix = getPrefixLength();
+    if (prefix > 0 && iovcnt == 2) {
+        const unsigned char *key = (const unsigned char *) iov[0].iov_base;
+        unsigned short common = 0;
+        while (common < prefix && (size_t) common + 1 < iov[0].iov_len &&
+               key[common] == getPrefix()[common])
+            common++;
+        if (common < prefix) {
+            if (!setPrefix(key, common)) return false;
+            prefix = common;
+        }
+        stored[0].iov_base = (void *) (key + prefix);
+        stored[0].iov_len = iov[0].iov_len - prefix;
+        stored[1] = iov[1];
+        iov = stored;
+    }
+
+    // 判断是否有空间，连续空间不够时rewrite回收碎片
     unsigned short length = getFreeLength();
-    if (length == 0) return false;
+    length = length < 2 ? 0 : length - 2; // 一个slot占2字节
 
-    // 判断能否分配
+    // 判断能否分配，记录按8B对齐占用空间
     std::pair<size_t, size_t> ret = Record::size(iov, iovcnt);
-    length -= 2; // 一个slot占2字节
-    if (ret.first > length) {
+    size_t need = (ret.first + Record::ALIGN_SIZE - 1) / Record::ALIGN_SIZE *
+                  Record::ALIGN_SIZE;
+    if (need > length) {
         int usedspace = getUsedspace();
-        if (ret.first < INITIAL_FREE_SPACE_SIZE - usedspace - 2) {
+        if (need <= (size_t) (INITIAL_FREE_SPACE_SIZE - usedspace - 2)) {
             rewrite();
             length = getFreeLength();
             if (length < 2) return false;
             length -= 2;
-            if (ret.first > length) return false;
+            if (need > length) return false;
         } else
             return false;
     }
@@ -309,6 +458,41 @@ bool IndexBlock::allocate(
     // slots未排序，同时需要setChecksum
     return true;
 }
+bool Block::copyRecord(unsigned char *record)
+{
+    Record rec;
+    rec.attach(record, BLOCK_SIZE);
+    unsigned short size =
+        (unsigned short) ((rec.length() + Record::ALIGN_SIZE - 1) /
+                          Record::ALIGN_SIZE * Record::ALIGN_SIZE);
+
+    // 判断是否有空间，连续空间不够时rewrite回收碎片
+    unsigned short length = getFreeLength();
+    length = length < 2 ? 0 : length - 2; // 一个slot占2字节
+    if (size > length) {
+        rewrite();
+        length = getFreeLength();
+        length = length < 2 ? 0 : length - 2;
+        if (size > length) return false;
+    }
+
+    // 整条记录连同padding一起复制
+    unsigned short oldf = getFreespace();
+    ::memcpy(buffer_ + oldf, record, size);
+
+    // 调整usedspace，tombstone不计入
+    if (!rec.isTombstone()) setUsedspace(getUsedspace() + size + 2);
+
+    // 调整freespace
+    setFreespace(oldf + size);
+    // 写slot
+    unsigned short slots = getSlotsNum();
+    setSlotsNum(slots + 1); // 增加slots数目
+    setSlot(slots, oldf);   // 第slots个
+
+    // slots未排序，同时需要setChecksum
+    return true;
+}
 int Block::recDelete(struct iovec *keyField, RelationInfo *relationInfo)
 {
     unsigned int key = relationInfo->key;
@@ -321,16 +505,11 @@ int Block::recDelete(struct iovec *keyField, RelationInfo *relationInfo)
         record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
         struct iovec field;
         record.specialRef(field, key);
-        if (!(relationInfo->fields[key].type->compare(
+        if (relationInfo->fields[key].type->compare3(
                 field.iov_base,
                 keyField->iov_base,
                 field.iov_len,
-                keyField->iov_len)) &&
-            !(relationInfo->fields[key].type->compare(
-                keyField->iov_base,
-                field.iov_base,
-                keyField->iov_len,
-                field.iov_len))) {
+                keyField->iov_len) == 0) {
             deleteindex = index;
             // 调整usedspace
             int usedspace = getUsedspace();
@@ -351,164 +530,759 @@ int Block::recDelete(struct iovec *keyField, RelationInfo *relationInfo)
     }
     return deleteindex;
 }
-int DataBlock::recDelete(struct iovec *keyField, RelationInfo *relationInfo)
+int DataBlock::findLive(struct iovec *keyField, RelationInfo *relationInfo)
 {
+    // slots[]有序，二分找到第一条键值相等的有效记录
     unsigned int key = relationInfo->key;
+    DataType *type = relationInfo->fields[key].type;
+    const KeySearch *search = relationInfo->fields[key].search;
     unsigned short slotsNum = getSlotsNum();
-    int deleteindex = -1;
-    std::vector<unsigned short> slotsv;
-    for (unsigned short index = 0; index < slotsNum; index++) {
-        unsigned short recOffset = getSlot(index);
+    for (unsigned short index = lowerBound(keyField, type, key, search);
+         index < slotsNum;
+         index++) {
         Record record;
-        record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
+        record.attach(buffer_ + getSlot(index), Block::BLOCK_SIZE);
         struct iovec field;
         record.specialRef(field, key);
-        if (!(relationInfo->fields[key].type->compare(
-                field.iov_base,
-                keyField->iov_base,
-                field.iov_len,
-                keyField->iov_len)) &&
-            !(relationInfo->fields[key].type->compare(
+        if (type->compare3(
                 keyField->iov_base,
                 field.iov_base,
                 keyField->iov_len,
-                field.iov_len))) {
-            deleteindex = index;
-            // 调整usedspace
-            int usedspace = getUsedspace();
-            int recSize = ((int) record.length() + Record::ALIGN_SIZE - 1) /
-                          Record::ALIGN_SIZE * Record::ALIGN_SIZE;
-            usedspace -= recSize;
-            usedspace -= 2;
-            setUsedspace(usedspace);
-            continue;
-        }
-        slotsv.push_back(recOffset);
+                field.iov_len) != 0)
+            break;
+        if (!record.isTombstone()) return index;
     }
-    if (deleteindex != -1) {
-        // 调整slots
-        setSlotsNum(--slotsNum);
-        for (unsigned short index = 0; index < slotsNum; index++)
-            setSlot(index, slotsv[index]);
+    return -1;
+}
+int DataBlock::recDelete(struct iovec *keyField, RelationInfo *relationInfo)
+{
+    int index = findLive(keyField, relationInfo);
+    if (index != -1) recDeleteRange(index, index + 1);
+    return index;
+}
+int DataBlock::recTombstone(struct iovec *keyField, RelationInfo *relationInfo)
+{
+    int index = findLive(keyField, relationInfo);
+    if (index == -1) return -1;
+
+    Record record;
+    record.attach(buffer_ + getSlot(index), Block::BLOCK_SIZE);
+    record.setTombstone();
+    // 调整usedspace，记录和slot在rewrite时回收
+    int usedspace = getUsedspace();
+    int recSize = ((int) record.length() + Record::ALIGN_SIZE - 1) /
+                  Record::ALIGN_SIZE * Record::ALIGN_SIZE;
+    usedspace -= recSize;
+    usedspace -= 2;
+    setUsedspace(usedspace);
+    return index;
+}
+bool DataBlock::recReplace(
+    unsigned short index,
+    const unsigned char *header,
+    struct iovec *iov,
+    int iovcnt)
+{
+    unsigned short recOffset = getSlot(index);
+    Record record;
+    record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
+    int oldSize = ((int) record.length() + Record::ALIGN_SIZE - 1) /
+                  Record::ALIGN_SIZE * Record::ALIGN_SIZE;
+    std::pair<size_t, size_t> ret =
+        Record::size(iov, iovcnt, Record::FORMAT_FIXED);
+    int newSize = ((int) ret.first + Record::ALIGN_SIZE - 1) /
+                  Record::ALIGN_SIZE * Record::ALIGN_SIZE;
+
+    // 旧记录的空间放得下，原地覆盖，剩下的部分成为碎片
+    if (newSize <= oldSize) {
+        record.attach(buffer_ + recOffset, (unsigned short) oldSize);
+        record.set(iov, iovcnt, header, Record::FORMAT_FIXED);
+        setUsedspace(getUsedspace() - oldSize + newSize);
+        return true;
     }
-    return deleteindex;
+
+    // 删掉旧记录再分配，失败时放回旧记录
+    unsigned char old[Block::BLOCK_SIZE];
+    ::memcpy(old, buffer_ + recOffset, oldSize);
+    // rewrite会丢弃tombstone，新位置要减去index之前的tombstone个数
+    unsigned short tombstones = 0;
+    for (unsigned short i = 0; i < index; i++) {
+        Record prev;
+        prev.attach(buffer_ + getSlot(i), Block::BLOCK_SIZE);
+        if (prev.isTombstone()) tombstones++;
+    }
+    recDeleteRange(index, index + 1);
+    unsigned short slotsNum = getSlotsNum();
+    bool done = allocate(header, iov, iovcnt);
+    if (!done) copyRecord(old);
+    if (getSlotsNum() != slotsNum + 1) index -= tombstones;
+
+    // 新记录在最后一个slot，挪回原来的位置，键值不变不用重新排序
+    unsigned short last = getSlotsNum() - 1;
+    unsigned short offset = getSlot(last);
+    for (unsigned short i = last; i > index; i--)
+        setSlot(i, getSlot(i - 1));
+    setSlot(index, offset);
+    return done;
 }
 int IndexBlock::recDelete(struct iovec *keyField, RelationInfo *relationInfo)
 {
-    unsigned int key = 0;
+    // 条目有序，两种布局都用lowerBound定位
+    DataType *type = relationInfo->fields[relationInfo->key].type;
+    unsigned short index = lowerBound(keyField, type, 0);
+    if (index == getSlotsNum() || compareKey(keyField, index, type) != 0)
+        return -1;
+    removeEntries(index, index + 1);
+    return index;
+}
+int Block::recDeleteRange(unsigned short begin, unsigned short end)
+{
     unsigned short slotsNum = getSlotsNum();
-    int deleteindex = -1;
-    std::vector<unsigned short> slotsv;
-    for (unsigned short index = 0; index < slotsNum; index++) {
-        unsigned short recOffset = getSlot(index);
+    if (end > slotsNum) end = slotsNum;
+    if (begin >= end) return 0;
+
+    // 调整usedspace，tombstone在recTombstone时已经扣除
+    int usedspace = getUsedspace();
+    for (unsigned short index = begin; index < end; index++) {
         Record record;
-        record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
+        record.attach(buffer_ + getSlot(index), Block::BLOCK_SIZE);
+        if (record.isTombstone()) continue;
+        int recSize = ((int) record.length() + Record::ALIGN_SIZE - 1) /
+                      Record::ALIGN_SIZE * Record::ALIGN_SIZE;
+        usedspace -= recSize;
+        usedspace -= 2;
+    }
+    setUsedspace(usedspace);
+
+    // 调整slots，后面的slot前移
+    unsigned short count = end - begin;
+    for (unsigned short index = end; index < slotsNum; index++)
+        setSlot(index - count, getSlot(index));
+    setSlotsNum(slotsNum - count);
+    return count;
+}
+unsigned short Block::lowerBound(
+    struct iovec *keyField,
+    DataType *type,
+    unsigned int key,
+    const KeySearch *search)
+{
+    if (search) return search->lowerBound(*this, keyField, type, key);
+    unsigned short low = 0, high = getSlotsNum();
+    while (low < high) {
+        unsigned short mid = (low + high) / 2;
+        Record record;
+        record.attach(buffer_ + getSlot(mid), Block::BLOCK_SIZE);
         struct iovec field;
         record.specialRef(field, key);
-        if (!(relationInfo->fields[key].type->compare(
+        if (type->compare(
                 field.iov_base,
                 keyField->iov_base,
                 field.iov_len,
-                keyField->iov_len)) &&
-            !(relationInfo->fields[key].type->compare(
+                keyField->iov_len))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+unsigned short Block::upperBound(
+    struct iovec *keyField,
+    DataType *type,
+    unsigned int key,
+    const KeySearch *search)
+{
+    if (search) return search->upperBound(*this, keyField, type, key);
+    unsigned short low = 0, high = getSlotsNum();
+    while (low < high) {
+        unsigned short mid = (low + high) / 2;
+        Record record;
+        record.attach(buffer_ + getSlot(mid), Block::BLOCK_SIZE);
+        struct iovec field;
+        record.specialRef(field, key);
+        if (type->compare(
                 keyField->iov_base,
                 field.iov_base,
                 keyField->iov_len,
-                field.iov_len))) {
-            deleteindex = index;
-            // 调整usedspace
-            int usedspace = getUsedspace();
-            int recSize = ((int) record.length() + Record::ALIGN_SIZE - 1) /
-                          Record::ALIGN_SIZE * Record::ALIGN_SIZE;
-            usedspace -= recSize;
-            usedspace -= 2;
-            setUsedspace(usedspace);
-            continue;
-        }
-        slotsv.push_back(recOffset);
-    }
-    if (deleteindex != -1) {
-        // 调整slots
-        setSlotsNum(--slotsNum);
-        for (unsigned short index = 0; index < slotsNum; index++)
-            setSlot(index, slotsv[index]);
+                field.iov_len))
+            high = mid;
+        else
+            low = mid + 1;
     }
-    return deleteindex;
+    return low;
 }
-int Block::rewrite()
+int Block::compactRecords(unsigned short start, bool dropTombstone)
 {
-    Block upblock;
-    unsigned char db[Block::BLOCK_SIZE];
-    upblock.attach(db);
-    upblock.clear(spaceid(), blockid());
-    upblock.setNextid(getNextid());
-
+    // 丢弃tombstone的slot，其余slot保持原顺序
     unsigned short slotsNum = getSlotsNum();
+    unsigned short live = 0;
     for (unsigned short index = 0; index < slotsNum; index++) {
         unsigned short recOffset = getSlot(index);
+        if (dropTombstone) {
+            Record record;
+            record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
+            if (record.isTombstone()) continue;
+        }
+        setSlot(live++, recOffset);
+    }
+    setSlotsNum(live);
+
+    // 按记录偏移量排序slot下标，记录只会前移，依次memmove不会覆盖
+    unsigned short order[Block::BLOCK_SIZE / Record::ALIGN_SIZE];
+    for (unsigned short index = 0; index < live; index++)
+        order[index] = index;
+    std::sort(order, order + live, offsetCompare(*this));
+
+    unsigned short cursor = start;
+    int usedspace = 0;
+    for (unsigned short i = 0; i < live; i++) {
+        unsigned short recOffset = getSlot(order[i]);
         Record record;
         record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-        // 先分配iovec
-        size_t fields = record.fields();
-        struct iovec *iov = (struct iovec *) malloc(sizeof(iovec) * fields);
-        unsigned char header;
-        // 从记录得到iovec
-        record.ref(iov, (int)fields, &header);
-        upblock.allocate(&header, iov, (int) fields);
-        free(iov);
+        unsigned short size =
+            (unsigned short) ((record.length() + Record::ALIGN_SIZE - 1) /
+                              Record::ALIGN_SIZE * Record::ALIGN_SIZE);
+        if (recOffset != cursor)
+            ::memmove(buffer_ + cursor, buffer_ + recOffset, size);
+        setSlot(order[i], cursor);
+        cursor += size;
+        usedspace += size + 2;
     }
-    ::memcpy(buffer_, db, Block::BLOCK_SIZE);
+
+    // 清零回收的空间
+    unsigned short freespace = getFreespace();
+    if (freespace > cursor) ::memset(buffer_ + cursor, 0, freespace - cursor);
+    setFreespace(cursor);
+    setUsedspace(usedspace);
     return S_OK;
 }
+int Block::rewrite() { return compactRecords(BLOCK_DEFAULT_FREESPACE, true); }
 int DataBlock::rewrite()
 {
-    DataBlock upblock;
+    return compactRecords(DATA_DEFAULT_FREESPACE, true);
+}
+int IndexBlock::rewrite()
+{
+    // 定长布局没有碎片
+    if (getLayout() != INDEX_LAYOUT_RECORD) return S_OK;
+    return compactRecords(getRecordStart(), false);
+}
+unsigned short IndexBlock::getRecordStart()
+{
+    return INDEX_INDEX_START + (getPrefixLength() + Record::ALIGN_SIZE - 1) /
+                                   Record::ALIGN_SIZE * Record::ALIGN_SIZE;
+}
+bool IndexBlock::setPrefix(const unsigned char *prefix, unsigned short length)
+{
+    if (getLayout() != INDEX_LAYOUT_RECORD) return length == 0;
+    // 在另一个buffer中重建，prefix可能引用本block
+    IndexBlock block;
     unsigned char db[Block::BLOCK_SIZE];
-    upblock.attach(db);
-    upblock.clear(blockid());
-    upblock.setNextid(getNextid());
+    block.attach(db);
+    block.clear(blockid());
+    block.setNextid(getNextid());
+    block.setNodeType(getNodeType());
+    block.setRowCount(getRowCount());
+    ::memcpy(db + INDEX_INDEX_START, prefix, length);
+    block.setPrefixLength(length);
+    block.setFreespace(block.getRecordStart());
 
+    // 完整键值 = 旧前缀 + 后缀，按新前缀截出后缀
+    unsigned short old = getPrefixLength();
+    unsigned char key[Block::BLOCK_SIZE];
+    ::memcpy(key, getPrefix(), old);
     unsigned short slotsNum = getSlotsNum();
     for (unsigned short index = 0; index < slotsNum; index++) {
-        unsigned short recOffset = getSlot(index);
         Record record;
-        record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-        // 先分配iovec
-        size_t fields = record.fields();
-        struct iovec *iov = (struct iovec *) malloc(sizeof(iovec) * fields);
+        record.attach(buffer_ + getSlot(index), Block::BLOCK_SIZE);
+        struct iovec iov[2];
         unsigned char header;
-        // 从记录得到iovec
-        record.ref(iov, (int)fields, &header);
-        upblock.allocate(&header, iov, (int) fields);
-        free(iov);
+        record.ref(iov, 2, &header);
+        ::memcpy(key + old, iov[0].iov_base, iov[0].iov_len);
+        iov[0].iov_base = key + length;
+        iov[0].iov_len = old + iov[0].iov_len - length;
+        // 绕过IndexBlock::allocate，后缀已经按新前缀截好
+        if (!block.Block::allocate(&header, iov, 2)) return false;
     }
     ::memcpy(buffer_, db, Block::BLOCK_SIZE);
-    return S_OK;
+    return true;
 }
-int IndexBlock::rewrite()
+bool IndexBlock::compress()
 {
-    IndexBlock upblock;
-    unsigned char db[Block::BLOCK_SIZE];
-    upblock.attach(db);
-    upblock.clear(blockid());
-    upblock.setNextid(getNextid());
-    upblock.setNodeType(getNodeType());
-    
     unsigned short slotsNum = getSlotsNum();
-    for (unsigned short index = 0; index < slotsNum; index++) {
-        unsigned short recOffset = getSlot(index);
+    if (slotsNum < 2 || getLayout() != INDEX_LAYOUT_RECORD) return false;
+
+    // 有序时首尾键值的公共前缀就是所有键值的公共前缀
+    Record first, last;
+    first.attach(buffer_ + getSlot(0), Block::BLOCK_SIZE);
+    last.attach(buffer_ + getSlot(slotsNum - 1), Block::BLOCK_SIZE);
+    struct iovec x, y;
+    first.specialRef(x, 0);
+    last.specialRef(y, 0);
+    // 至少保留一个字节的后缀，CHAR以'\0'结尾
+    size_t limit = std::min(x.iov_len, y.iov_len);
+    limit = limit == 0 ? 0 : limit - 1;
+    size_t common = 0;
+    while (common < limit && ((unsigned char *) x.iov_base)[common] ==
+                                 ((unsigned char *) y.iov_base)[common])
+        common++;
+    if (common == 0) return false;
+
+    unsigned short old = getPrefixLength();
+    unsigned char *prefix = (unsigned char *) malloc(old + common);
+    ::memcpy(prefix, getPrefix(), old);
+    ::memcpy(prefix + old, x.iov_base, common);
+    bool ret = setPrefix(prefix, (unsigned short) (old + common));
+    free(prefix);
+    return ret;
+}
+int IndexBlock::comparePrefix(struct iovec *keyField)
+{
+    const unsigned char *key = (const unsigned char *) keyField->iov_base;
+    const unsigned char *prefix = getPrefix();
+    unsigned short length = getPrefixLength();
+    for (unsigned short i = 0; i < length; i++) {
+        if (i >= keyField->iov_len) return -1;
+        if (key[i] != prefix[i]) return key[i] < prefix[i] ? -1 : 1;
+    }
+    return 0;
+}
+int IndexBlock::compareKey(
+    struct iovec *keyField,
+    unsigned short index,
+    DataType *type)
+{
+    if (getLayout() != INDEX_LAYOUT_RECORD)
+        return type->compare3(
+            keyField->iov_base, getKeyAt(index), keyField->iov_len, getLayout());
+    int ret = comparePrefix(keyField);
+    if (ret) return ret;
+    struct iovec suffix, field;
+    suffix.iov_base = (unsigned char *) keyField->iov_base + getPrefixLength();
+    suffix.iov_len = keyField->iov_len - getPrefixLength();
+    Record record;
+    record.attach(buffer_ + getSlot(index), Block::BLOCK_SIZE);
+    record.specialRef(field, 0);
+    return type->compare3(
+        suffix.iov_base, field.iov_base, suffix.iov_len, field.iov_len);
+}
+void IndexBlock::getKey(unsigned short index, struct iovec *field)
+{
+    if (getLayout() != INDEX_LAYOUT_RECORD) {
+        field->iov_len = getLayout();
+        field->iov_base = malloc(field->iov_len);
+        ::memcpy(field->iov_base, getKeyAt(index), field->iov_len);
+        return;
+    }
+    Record record;
+    record.attach(buffer_ + getSlot(index), Block::BLOCK_SIZE);
+    struct iovec suffix;
+    record.specialRef(suffix, 0);
+    unsigned short length = getPrefixLength();
+    field->iov_len = length + suffix.iov_len;
+    field->iov_base = malloc(field->iov_len);
+    ::memcpy(field->iov_base, getPrefix(), length);
+    ::memcpy(
+        (unsigned char *) field->iov_base + length,
+        suffix.iov_base,
+        suffix.iov_len);
+}
+unsigned short IndexBlock::lowerBound(
+    struct iovec *keyField,
+    DataType *type,
+    unsigned int key,
+    const KeySearch *search)
+{
+    if (getLayout() != INDEX_LAYOUT_RECORD)
+        return searchFixed(keyField, getLayout(), false);
+    int ret = comparePrefix(keyField);
+    if (ret < 0) return 0;
+    if (ret > 0) return getSlotsNum();
+    struct iovec suffix;
+    suffix.iov_base = (unsigned char *) keyField->iov_base + getPrefixLength();
+    suffix.iov_len = keyField->iov_len - getPrefixLength();
+    return Block::lowerBound(&suffix, type, key, search);
+}
+unsigned short IndexBlock::upperBound(
+    struct iovec *keyField,
+    DataType *type,
+    unsigned int key,
+    const KeySearch *search)
+{
+    if (getLayout() != INDEX_LAYOUT_RECORD)
+        return searchFixed(keyField, getLayout(), true);
+    int ret = comparePrefix(keyField);
+    if (ret < 0) return 0;
+    if (ret > 0) return getSlotsNum();
+    struct iovec suffix;
+    suffix.iov_base = (unsigned char *) keyField->iov_base + getPrefixLength();
+    suffix.iov_len = keyField->iov_len - getPrefixLength();
+    return Block::upperBound(&suffix, type, key, search);
+}
+unsigned short IndexBlock::searchFixed(
+    struct iovec *keyField,
+    unsigned short layout,
+    bool upper)
+{
+    if (layout == INDEX_LAYOUT_INT32) {
+        int k;
+        ::memcpy(&k, keyField->iov_base, sizeof(int));
+        return searchKeys<int>(getKeyAt(0), getSlotsNum(), k, upper);
+    } else {
+        long long k;
+        ::memcpy(&k, keyField->iov_base, sizeof(long long));
+        return searchKeys<long long>(getKeyAt(0), getSlotsNum(), k, upper);
+    }
+}
+void IndexBlock::setLayout(unsigned short layout)
+{
+    layout = htobe16(layout);
+    ::memcpy(buffer_ + INDEX_LAYOUT_OFFSET, &layout, INDEX_LAYOUT_SIZE);
+}
+int IndexBlock::getPointer(unsigned short index)
+{
+    int pointer;
+    if (getLayout() != INDEX_LAYOUT_RECORD) {
+        ::memcpy(&pointer, getPointerAt(index), INDEX_POINTER_SIZE);
+        return pointer;
+    }
+    Record record;
+    record.attach(buffer_ + getSlot(index), Block::BLOCK_SIZE);
+    struct iovec bidField;
+    record.specialRef(bidField, 1);
+    ::memcpy(&pointer, bidField.iov_base, sizeof(int));
+    return pointer;
+}
+int IndexBlock::findPointer(int pointer)
+{
+    unsigned short slotsNum = getSlotsNum();
+    for (unsigned short index = 0; index < slotsNum; index++)
+        if (getPointer(index) == pointer) return index;
+    return -1;
+}
+bool IndexBlock::insertEntry(
+    struct iovec *keyField,
+    int pointer,
+    DataType *type,
+    const KeySearch *search)
+{
+    // 键值等于已有条目时插在其后
+    unsigned short pos = upperBound(keyField, type, 0, search);
+    unsigned short slotsNum = getSlotsNum();
+    unsigned short layout = getLayout();
+    if (layout != INDEX_LAYOUT_RECORD) {
+        if (slotsNum >= getCapacity()) return false;
+        ::memmove(
+            getKeyAt(pos + 1), getKeyAt(pos), (slotsNum - pos) * layout);
+        ::memmove(
+            getPointerAt(pos + 1),
+            getPointerAt(pos),
+            (slotsNum - pos) * INDEX_POINTER_SIZE);
+        ::memcpy(getKeyAt(pos), keyField->iov_base, layout);
+        ::memcpy(getPointerAt(pos), &pointer, INDEX_POINTER_SIZE);
+        setSlotsNum(slotsNum + 1);
+        setUsedspace(getUsedspace() + layout + INDEX_POINTER_SIZE);
+        return true;
+    }
+
+    // allocate把slot追加在末尾，再移到pos处
+    if (!appendEntry(keyField, pointer)) return false;
+    unsigned short recOffset = getSlot(slotsNum);
+    for (unsigned short index = slotsNum; index > pos; index--)
+        setSlot(index, getSlot(index - 1));
+    setSlot(pos, recOffset);
+    return true;
+}
+bool IndexBlock::appendEntry(struct iovec *keyField, int pointer)
+{
+    unsigned short slotsNum = getSlotsNum();
+    unsigned short layout = getLayout();
+    if (layout != INDEX_LAYOUT_RECORD) {
+        if (slotsNum >= getCapacity()) return false;
+        ::memcpy(getKeyAt(slotsNum), keyField->iov_base, layout);
+        ::memcpy(getPointerAt(slotsNum), &pointer, INDEX_POINTER_SIZE);
+        setSlotsNum(slotsNum + 1);
+        setUsedspace(getUsedspace() + layout + INDEX_POINTER_SIZE);
+        return true;
+    }
+
+    // 记录字段：key---right pointer
+    unsigned char header = 0x00;
+    struct iovec iov[2];
+    iov[0] = *keyField;
+    iov[1].iov_base = &pointer;
+    iov[1].iov_len = sizeof(int);
+    return allocate(&header, iov, 2);
+}
+int IndexBlock::removeEntries(unsigned short begin, unsigned short end)
+{
+    unsigned short layout = getLayout();
+    if (layout == INDEX_LAYOUT_RECORD) return recDeleteRange(begin, end);
+
+    unsigned short slotsNum = getSlotsNum();
+    if (end > slotsNum) end = slotsNum;
+    if (begin >= end) return 0;
+    ::memmove(getKeyAt(begin), getKeyAt(end), (slotsNum - end) * layout);
+    ::memmove(
+        getPointerAt(begin),
+        getPointerAt(end),
+        (slotsNum - end) * INDEX_POINTER_SIZE);
+    unsigned short count = end - begin;
+    setSlotsNum(slotsNum - count);
+    setUsedspace(getUsedspace() - count * (layout + INDEX_POINTER_SIZE));
+    return count;
+}
+void IndexBlock::truncate(unsigned short count)
+{
+    unsigned short layout = getLayout();
+    if (layout == INDEX_LAYOUT_RECORD) {
+        setSlotsNum(count);
+        rewrite();
+        return;
+    }
+    removeEntries(count, getSlotsNum());
+}
+bool IndexBlock::copyEntries(
+    IndexBlock &to,
+    unsigned short begin,
+    unsigned short end)
+{
+    unsigned short layout = getLayout();
+    if (layout == INDEX_LAYOUT_RECORD) {
+        // 前缀相同，按字节复制后缀
+        for (unsigned short index = begin; index < end; index++)
+            if (!to.copyRecord(buffer_ + getSlot(index))) return false;
+        return true;
+    }
+
+    unsigned short slotsNum = to.getSlotsNum();
+    unsigned short count = end - begin;
+    if (slotsNum + count > to.getCapacity()) return false;
+    ::memcpy(to.getKeyAt(slotsNum), getKeyAt(begin), count * layout);
+    ::memcpy(
+        to.getPointerAt(slotsNum),
+        getPointerAt(begin),
+        count * INDEX_POINTER_SIZE);
+    to.setSlotsNum(slotsNum + count);
+    to.setUsedspace(
+        to.getUsedspace() + count * (layout + INDEX_POINTER_SIZE));
+    return true;
+}
+
+// 以下是特化的查找和排序，Less在模板展开时内联
+template <typename T>
+struct IntLess
+{
+    IntLess(DataType *) {}
+    inline bool
+    operator()(const void *x, const void *y, size_t sx, size_t sy) const
+    {
+        T a, b;
+        ::memcpy(&a, x, sizeof(T));
+        ::memcpy(&b, y, sizeof(T));
+        return a < b;
+    }
+};
+struct CharLess
+{
+    CharLess(DataType *) {}
+    inline bool
+    operator()(const void *x, const void *y, size_t sx, size_t sy) const
+    {
+        return strncmp(
+                   (const char *) x,
+                   (const char *) y,
+                   std::max<size_t>(sx, sy)) < 0;
+    }
+};
+struct BytesLess
+{
+    BytesLess(DataType *) {}
+    inline bool
+    operator()(const void *x, const void *y, size_t sx, size_t sy) const
+    {
+        int ret = ::memcmp(x, y, std::min<size_t>(sx, sy));
+        return ret < 0 || (ret == 0 && sx < sy);
+    }
+};
+// 和DataType的DOUBLE一致，按位映射成IEEE 754全序
+struct DoubleLess
+{
+    DoubleLess(DataType *) {}
+    static inline unsigned long long order(const void *x)
+    {
+        unsigned long long bits;
+        ::memcpy(&bits, x, sizeof(double));
+        return (bits >> 63) ? ~bits : bits ^ (1ULL << 63);
+    }
+    inline bool
+    operator()(const void *x, const void *y, size_t sx, size_t sy) const
+    {
+        return order(x) < order(y);
+    }
+};
+// 通用版本，逐次经函数指针
+struct TypeLess
+{
+    DataType *type;
+
+    TypeLess(DataType *t)
+        : type(t)
+    {}
+    inline bool
+    operator()(const void *x, const void *y, size_t sx, size_t sy) const
+    {
+        return type->compare(x, y, sx, sy);
+    }
+};
+
+template <typename Less>
+static unsigned short lowerBoundOf(
+    Block &block,
+    struct iovec *keyField,
+    DataType *type,
+    unsigned int key)
+{
+    Less less(type);
+    unsigned char *buffer = block.getBuffer();
+    unsigned short low = 0, high = block.getSlotsNum();
+    while (low < high) {
+        unsigned short mid = (low + high) / 2;
         Record record;
-        record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-        // 先分配iovec
-        size_t fields = record.fields();
-        struct iovec *iov = (struct iovec *) malloc(sizeof(iovec) * fields);
-        unsigned char header;
-        // 从记录得到iovec
-        record.ref(iov, (int)fields, &header);
-        upblock.allocate(&header, iov, (int) fields);
-        free(iov);
+        record.attach(buffer + block.getSlot(mid), Block::BLOCK_SIZE);
+        struct iovec field;
+        record.specialRef(field, key);
+        if (less(
+                field.iov_base,
+                keyField->iov_base,
+                field.iov_len,
+                keyField->iov_len))
+            low = mid + 1;
+        else
+            high = mid;
     }
-    ::memcpy(buffer_, db, Block::BLOCK_SIZE);
-    return S_OK;
+    return low;
 }
+template <typename Less>
+static unsigned short upperBoundOf(
+    Block &block,
+    struct iovec *keyField,
+    DataType *type,
+    unsigned int key)
+{
+    Less less(type);
+    unsigned char *buffer = block.getBuffer();
+    unsigned short low = 0, high = block.getSlotsNum();
+    while (low < high) {
+        unsigned short mid = (low + high) / 2;
+        Record record;
+        record.attach(buffer + block.getSlot(mid), Block::BLOCK_SIZE);
+        struct iovec field;
+        record.specialRef(field, key);
+        if (less(
+                keyField->iov_base,
+                field.iov_base,
+                keyField->iov_len,
+                field.iov_len))
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    return low;
+}
+// 按记录的键值比较slot
+template <typename Less>
+struct SlotLess
+{
+    unsigned char *buffer;
+    unsigned int key;
+    Less less;
+
+    SlotLess(unsigned char *b, unsigned int k, DataType *type)
+        : buffer(b)
+        , key(k)
+        , less(type)
+    {}
+    inline bool
+    operator()(const unsigned short &x, const unsigned short &y) const
+    {
+        Record rx, ry;
+        rx.attach(buffer + x, Block::BLOCK_SIZE);
+        ry.attach(buffer + y, Block::BLOCK_SIZE);
+        struct iovec keyx, keyy;
+        rx.specialRef(keyx, key);
+        ry.specialRef(keyy, key);
+        return less(keyx.iov_base, keyy.iov_base, keyx.iov_len, keyy.iov_len);
+    }
+};
+template <typename Less>
+static void sortOf(Block &block, DataType *type, unsigned int key)
+{
+    unsigned short slotsNum = block.getSlotsNum();
+    std::vector<unsigned short> slotsv(slotsNum);
+    for (unsigned short index = 0; index < slotsNum; index++)
+        slotsv[index] = block.getSlot(index);
+    SlotLess<Less> cmp(block.getBuffer(), key, type);
+    // 稳定排序，相同键值保持插入顺序
+    std::stable_sort(slotsv.begin(), slotsv.end(), cmp);
+    for (unsigned short index = 0; index < slotsNum; index++)
+        block.setSlot(index, slotsv[index]);
+}
+
+const KeySearch *findKeySearch(DataType *type)
+{
+    static KeySearch gsearch[] = {
+        {"CHAR",
+         lowerBoundOf<CharLess>,
+         upperBoundOf<CharLess>,
+         sortOf<CharLess>}, // 0
+        {"VARCHAR",
+         lowerBoundOf<CharLess>,
+         upperBoundOf<CharLess>,
+         sortOf<CharLess>}, // 1
+        {"TINYINT",
+         lowerBoundOf<IntLess<char>>,
+         upperBoundOf<IntLess<char>>,
+         sortOf<IntLess<char>>}, // 2
+        {"SMALLINT",
+         lowerBoundOf<IntLess<short>>,
+         upperBoundOf<IntLess<short>>,
+         sortOf<IntLess<short>>}, // 3
+        {"INT",
+         lowerBoundOf<IntLess<int>>,
+         upperBoundOf<IntLess<int>>,
+         sortOf<IntLess<int>>}, // 4
+        {"BIGINT",
+         lowerBoundOf<IntLess<long long>>,
+         upperBoundOf<IntLess<long long>>,
+         sortOf<IntLess<long long>>}, // 5
+        {"BYTES",
+         lowerBoundOf<BytesLess>,
+         upperBoundOf<BytesLess>,
+         sortOf<BytesLess>}, // 6
+        {"TIMESTAMP",
+         lowerBoundOf<IntLess<long long>>,
+         upperBoundOf<IntLess<long long>>,
+         sortOf<IntLess<long long>>}, // 7
+        {"DATE",
+         lowerBoundOf<IntLess<long long>>,
+         upperBoundOf<IntLess<long long>>,
+         sortOf<IntLess<long long>>}, // 8
+        {"DOUBLE",
+         lowerBoundOf<DoubleLess>,
+         upperBoundOf<DoubleLess>,
+         sortOf<DoubleLess>}, // 9
+        {NULL,
+         lowerBoundOf<TypeLess>,
+         upperBoundOf<TypeLess>,
+         sortOf<TypeLess>}, // 通用
+    };
+
+    int index = 0;
+    while (gsearch[index].name != NULL &&
+           strcmp(gsearch[index].name, type->name) != 0)
+        ++index;
+    return &gsearch[index];
+}
+
 } // namespace db
@@ -8,8 +8,25 @@
 #include <db/bplustree.h>
 
 namespace db {
+
+// 索引root的统计信息区不用，开头2B记格式版本
+static unsigned short getVersion(Root &root)
+{
+    unsigned short version;
+    ::memcpy(&version, root.getStats(), sizeof(version));
+    return be16toh(version);
+}
+static void setVersion(Root &root, unsigned short version)
+{
+    version = htobe16(version);
+    ::memcpy(root.getStats(), &version, sizeof(version));
+}
+
 BPlusTree::BPlusTree()
-    : root_(0)
+    : keyType_(NULL)
+    , keySearch_(NULL)
+    , layout_(INDEX_LAYOUT_RECORD)
+    , root_(0)
     , IndexBlockCnt(0)
 {
     buffer_ = (unsigned char *) malloc(Block::BLOCK_SIZE);
@@ -28,15 +45,70 @@ int BPlusTree::open(const char *name)
     gschema.loadIndex(bret.first);
 
     relationInfo = &bret.first->second;
+    // 已有的索引文件格式版本不对，节点头部读不出来
+    unsigned long long length;
+    if (relationInfo->indexFile.length(length) == S_OK && length) {
+        unsigned char rb[Root::ROOT_SIZE];
+        relationInfo->indexFile.read(0, (char *) rb, Root::ROOT_SIZE);
+        Root root;
+        root.attach(rb);
+        if (getVersion(root) != INDEX_FORMAT_VERSION) return EINVAL;
+    }
     if (relationInfo->fields[relationInfo->key].type == NULL)
         relationInfo->fields[relationInfo->key].type = findDataType(
             relationInfo->fields[relationInfo->key].fieldType.c_str());
+    // normalize后索引中的键值都按字节比较
+    if (relationInfo->keyFormat & KEY_FORMAT_NORMALIZED)
+        keyType_ = findDataType("BYTES");
+    else
+        keyType_ = relationInfo->fields[relationInfo->key].type;
+    keySearch_ = findKeySearch(keyType_);
+    mirror_.reset(keyType_);
+    // 不normalize、不压缩前缀的INT/BIGINT键值用定长布局，
+    // TIMESTAMP、DATE就是64位整数
+    layout_ = INDEX_LAYOUT_RECORD;
+    if (relationInfo->keyFormat == KEY_FORMAT_PLAIN) {
+        if (::strcmp(keyType_->name, "INT") == 0)
+            layout_ = INDEX_LAYOUT_INT32;
+        else if (
+            ::strcmp(keyType_->name, "BIGINT") == 0 ||
+            ::strcmp(keyType_->name, "TIMESTAMP") == 0 ||
+            ::strcmp(keyType_->name, "DATE") == 0)
+            layout_ = INDEX_LAYOUT_INT64;
+    }
 
     return S_OK;
 }
-void BPlusTree::close(const char *name) { relationInfo->indexFile.close(); }
+void BPlusTree::encodeKey(struct iovec &field, struct iovec &key)
+{
+    if (!(relationInfo->keyFormat & KEY_FORMAT_NORMALIZED)) {
+        key = field;
+        return;
+    }
+    key.iov_base = malloc(field.iov_len + 1);
+    key.iov_len = relationInfo->fields[relationInfo->key].type->normalize(
+        key.iov_base, field.iov_base, field.iov_len);
+}
+void BPlusTree::freeKey(struct iovec &key)
+{
+    if (relationInfo->keyFormat & KEY_FORMAT_NORMALIZED) free(key.iov_base);
+}
+void BPlusTree::decodeKey(struct iovec &key, struct iovec *field)
+{
+    // key是malloc得到的，原地还原
+    if (relationInfo->keyFormat & KEY_FORMAT_NORMALIZED)
+        key.iov_len = relationInfo->fields[relationInfo->key].type->denormalize(
+            key.iov_base, key.iov_base, key.iov_len);
+    *field = key;
+}
+void BPlusTree::close(const char *name)
+{
+    mirror_.clear();
+    relationInfo->indexFile.close();
+}
 int BPlusTree::destroy(const char *name)
 {
+    mirror_.clear();
     return relationInfo->indexFile.remove(name);
 }
 int BPlusTree::initial()
@@ -55,15 +127,18 @@ int BPlusTree::initial()
         relationInfo->indexFile.read(
             offset, (char *) buffer_, Block::BLOCK_SIZE);
     } else {
+        mirror_.clear();
         Root root;
         unsigned char rb[Root::ROOT_SIZE];
         root.attach(rb);
         root.clear(BLOCK_TYPE_INDEX);
+        setVersion(root, INDEX_FORMAT_VERSION);
         root.setHead(1);
         // 创建第1个block
         IndexBlock block;
         block.attach(buffer_);
         block.clear(1);
+        block.setLayout(layout_);
         block.setNextid(1);
         block.setNodeType(NODE_TYPE_POINT_TO_LEAF);
         root_ = 1;
@@ -87,6 +162,10 @@ int BPlusTree::writeIndexBlock(int blockid)
     size_t offset = (blockid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
     relationInfo->indexFile.write(
         offset, (const char *) buffer_, Block::BLOCK_SIZE);
+    // 镜像随block一起更新
+    IndexBlock block;
+    block.attach(buffer_);
+    mirror_.refresh(block);
     return S_OK;
 }
 int BPlusTree::writeRoot(int treeRoot)
@@ -99,6 +178,45 @@ int BPlusTree::writeRoot(int treeRoot)
     relationInfo->indexFile.write(0, (const char *) buffer_, Root::ROOT_SIZE);
     return S_OK;
 }
+int BPlusTree::allocIndexBlock()
+{
+    unsigned char rb[Root::ROOT_SIZE];
+    relationInfo->indexFile.read(0, (char *) rb, Root::ROOT_SIZE);
+    Root root;
+    root.attach(rb);
+    int garbage = root.getGarbage();
+    if (garbage <= 0) return ++IndexBlockCnt;
+
+    //从空闲链头取一个block
+    unsigned char db[Block::BLOCK_SIZE];
+    size_t offset = (garbage - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+    relationInfo->indexFile.read(offset, (char *) db, Block::BLOCK_SIZE);
+    IndexBlock block;
+    block.attach(db);
+    root.setGarbage(block.getNextid());
+    relationInfo->indexFile.write(0, (const char *) rb, Root::ROOT_SIZE);
+    return garbage;
+}
+int BPlusTree::freeIndexBlock(int blockid)
+{
+    unsigned char rb[Root::ROOT_SIZE];
+    relationInfo->indexFile.read(0, (char *) rb, Root::ROOT_SIZE);
+    Root root;
+    root.attach(rb);
+
+    //清空后挂到空闲链头
+    unsigned char db[Block::BLOCK_SIZE];
+    IndexBlock block;
+    block.attach(db);
+    block.clear(blockid);
+    block.setNextid(root.getGarbage());
+    size_t offset = (blockid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+    relationInfo->indexFile.write(offset, (const char *) db, Block::BLOCK_SIZE);
+    mirror_.drop(blockid);
+    root.setGarbage(blockid);
+    relationInfo->indexFile.write(0, (const char *) rb, Root::ROOT_SIZE);
+    return S_OK;
+}
 unsigned int BPlusTree::blockNum() { return IndexBlockCnt; }
 unsigned short BPlusTree::slotsNum()
 {
@@ -110,48 +228,48 @@ int BPlusTree::sraech(struct iovec &field, std::stack<int> &path)
 {
     bool ret = initial();
     if (ret) return ret;
-    IndexBlock index;
     path.push(root_);
-    index.attach(buffer_);
-    int pointer =
-        index.getNextid(); //返回的指针，也就是定位的DataBlock的blockid
-
-    // 索引条目：key---right pointer
-    struct iovec rec[2];
-    unsigned char header;
-
-    //从上往下进行查找
-    while (1) {
-        int rows = index.getSlotsNum();
-
-        //枚举key字段,寻找第一个键值大于等于key的位置
-        for (int i = 0; i < rows; i++) {
-            Record record;
-            unsigned short reoff = index.getSlot(i);
-            record.attach(buffer_ + reoff, Block::BLOCK_SIZE);
-            record.ref(rec, 2, &header);
-
-            //找到第一个键值大于等于key的位置
-            if (!relationInfo->fields[relationInfo->key].type->compare(
-                    rec[0].iov_base,
-                    field.iov_base,
-                    rec[0].iov_len,
-                    field.iov_len)) {
-                break;
+    int pointer; //返回的指针，也就是定位的DataBlock的blockid
+    struct iovec key;
+    encodeKey(field, key);
+
+    //从上往下进行查找，上面几层走内存镜像
+    int blockid = root_;
+    bool loaded = true; // initial()已经把根节点读入buffer_
+    for (int level = 0;; level++) {
+        IndexMirror::Node *node = NULL;
+        unsigned short nodeType;
+        if (level < IndexMirror::LEVELS) node = mirror_.find(blockid);
+        if (node == NULL) {
+            if (!loaded) readIndexBlock(blockid);
+            IndexBlock index;
+            index.attach(buffer_);
+            if (level < IndexMirror::LEVELS)
+                node = mirror_.load(index);
+            else {
+                //找到第一个键值大于key的位置，键值等于分隔键时进入右子树
+                unsigned short pos =
+                    index.upperBound(&key, keyType_, 0, keySearch_);
+                if (pos == 0)
+                    pointer = index.getNextid(); //当前节点的最左边指针
+                else
+                    pointer = index.getPointer(pos - 1);
+                nodeType = index.getNodeType();
             }
-            //更新pointer
-            pointer = *((int *) rec[1].iov_base);
+        }
+        if (node) {
+            pointer = mirror_.search(node, &key);
+            nodeType = node->nodeType;
         }
         //如果查询进行到了指向叶子节点的内部节点，则退出
-        if (index.getNodeType() == NODE_TYPE_POINT_TO_LEAF) break;
+        if (nodeType == NODE_TYPE_POINT_TO_LEAF) break;
         //把blockid加入栈，保存查询路径
         path.push(pointer);
-        //读下一个indexblock
-        size_t offset = (pointer - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-        relationInfo->indexFile.read(
-            offset, (char *) buffer_, Block::BLOCK_SIZE);
+        blockid = pointer;
+        loaded = false;
     }
 
+    freeKey(key);
     //返回所得到的DataBlock的blockid
     return pointer;
 }
@@ -161,89 +279,111 @@ int BPlusTree::combineIndexBlock(
     int fatherid,
     struct iovec *field)
 {
+    // comblock的父亲节点
+    IndexBlock faBlock;
+    unsigned char db[Block::BLOCK_SIZE];
+    faBlock.attach(db);
+    size_t offset = (fatherid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+    relationInfo->indexFile.read(offset, (char *) db, Block::BLOCK_SIZE);
+
+    //从父节点得到comblock的最左边指针对应的键值
+    struct iovec separator;
+    int sepIndex = faBlock.findPointer(comblockid);
+    if (sepIndex < 0) return EINVAL;
+    faBlock.getKey((unsigned short) sepIndex, &separator);
+
+    // 在副本上追加，全部放得下才覆盖buffer_
     IndexBlock block;
+    unsigned char merged[Block::BLOCK_SIZE];
     readIndexBlock(blockid);
-    block.attach(buffer_);
+    ::memcpy(merged, buffer_, Block::BLOCK_SIZE);
+    block.attach(merged);
 
     //被合并的block
     IndexBlock comBlock;
-    unsigned char db[Block::BLOCK_SIZE];
     comBlock.attach(db);
-    size_t offset = (comblockid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+    offset = (comblockid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
     relationInfo->indexFile.read(offset, (char *) db, Block::BLOCK_SIZE);
 
-    // comblock的key-pointer记录
-    unsigned short slotsNum = comBlock.getSlotsNum();
-    for (unsigned short index = 0; index < slotsNum; index++) {
-        unsigned short recOffset = comBlock.getSlot(index);
-        Record record;
-        record.attach(db + recOffset, Block::BLOCK_SIZE);
-        // 先分配iovec
-        struct iovec iov[2];
-        unsigned char header;
-        // 从记录得到iovec
-        record.ref(iov, 2, &header);
-
-        int ret = block.allocate(&header, iov, 2);
-        if (!ret) return S_FALSE;
+    // 分隔键和comblock的最左边指针，之后是comblock的key-pointer记录
+    // 都比block中的键值大，按序追加，键值按完整形式插入
+    // 两边前缀不同，合并后可能放不下，此时返回S_FALSE，field置空
+    field->iov_base = NULL;
+    if (!block.appendEntry(&separator, comBlock.getNextid())) {
+        free(separator.iov_base);
+        return S_FALSE;
     }
-
-    // comblock的最左边指针
-    int leftPointer = comBlock.getNextid();
-
-    //要插入的key-pointer
-    unsigned char insertHeader = 0x00;
-    struct iovec insertRecord[2];
-    insertRecord[0].iov_base = NULL;
-    insertRecord[0].iov_len = 0;
-    insertRecord[1].iov_base = &leftPointer;
-    insertRecord[1].iov_len = sizeof(int);
-
-    // comblock的父亲节点
-    IndexBlock faBlock;
-    faBlock.attach(db);
-    offset = (fatherid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-    relationInfo->indexFile.read(offset, (char *) db, Block::BLOCK_SIZE);
-
-    //从父节点得到comblock的最左边指针对应的键值
-    slotsNum = faBlock.getSlotsNum();
+    unsigned short slotsNum = comBlock.getSlotsNum();
     for (unsigned short index = 0; index < slotsNum; index++) {
-        unsigned short recOffset = faBlock.getSlot(index);
-        Record record;
-        record.attach(db + recOffset, Block::BLOCK_SIZE);
-        struct iovec iov[2];
-        unsigned char header;
-        record.ref(iov, 2, &header);
-        int bid = *((int *) iov[1].iov_base);
-        if (bid == comblockid) {
-            insertRecord[0].iov_base = iov[0].iov_base;
-            insertRecord[0].iov_len = iov[0].iov_len;
-            break;
+        struct iovec key;
+        comBlock.getKey(index, &key);
+        bool ret = block.appendEntry(&key, comBlock.getPointer(index));
+        free(key.iov_base);
+        if (!ret) {
+            free(separator.iov_base);
+            return S_FALSE;
         }
     }
-    if (insertRecord[0].iov_base == NULL) return S_FALSE;
-    //返回字段
-    field->iov_base = malloc(insertRecord[0].iov_len);
-    ::memcpy(
-        field->iov_base, insertRecord[0].iov_base, insertRecord[0].iov_len);
-    field->iov_len = insertRecord[0].iov_len;
-    //插入
-    int ret = block.allocate(&insertHeader, insertRecord, 2);
-    if (!ret) return S_FALSE;
 
-    // 排序
-    std::vector<unsigned short> slotsv;
-    for (int i = 0; i < block.getSlotsNum(); i++)
-        slotsv.push_back(block.getSlot(i));
-    treeCompare cmp(relationInfo->fields[relationInfo->key], 0, *this);
-    std::sort(slotsv.begin(), slotsv.end(), cmp);
-    for (int i = 0; i < block.getSlotsNum(); i++)
-        block.setSlot(i, slotsv[i]);
+    //返回字段
+    ::memcpy(buffer_, merged, Block::BLOCK_SIZE);
+    *field = separator;
+    return writeIndexBlock(blockid);
+}
+int BPlusTree::locate(struct iovec &field, int leafid, std::stack<int> &path)
+{
+    int ret = initial();
+    if (ret) return ret;
+    struct iovec key;
+    encodeKey(field, key);
+    ret = locateKey(key, leafid, root_, path);
+    freeKey(key);
+    return ret;
+}
+int BPlusTree::locateKey(
+    struct iovec &key,
+    int leafid,
+    int blockid,
+    std::stack<int> &path)
+{
+    IndexBlock index;
+    readIndexBlock(blockid);
+    index.attach(buffer_);
 
-    writeIndexBlock(blockid);
-    return S_OK;
+    //儿子i的键值范围是[键值i-1, 键值i]，可能含key的是lowerBound到upperBound
+    unsigned short lo = index.lowerBound(&key, keyType_, 0, keySearch_);
+    unsigned short hi = index.upperBound(&key, keyType_, 0, keySearch_);
+    std::vector<int> children;
+    for (unsigned short i = lo; i <= hi; i++)
+        children.push_back(
+            i == 0 ? index.getNextid() : index.getPointer(i - 1));
+    unsigned short nodeType = index.getNodeType();
+
+    path.push(blockid);
+    if (nodeType == NODE_TYPE_POINT_TO_LEAF) {
+        if (std::find(children.begin(), children.end(), leafid) !=
+            children.end())
+            return S_OK;
+    } else {
+        //递归会改写buffer_，儿子已经取出
+        for (size_t i = 0; i < children.size(); i++)
+            if (locateKey(key, leafid, children[i], path) == S_OK) return S_OK;
+    }
+    path.pop();
+    return S_FALSE;
 }
 int BPlusTree::insert(struct iovec &field, int rightid, std::stack<int> &path)
+{
+    struct iovec key;
+    encodeKey(field, key);
+    int ret = insertKey(key, rightid, path);
+    freeKey(key);
+    return ret;
+}
+int BPlusTree::insertKey(
+    struct iovec &field,
+    int rightid,
+    std::stack<int> &path)
 {
     int insertid = path.top();
     path.pop();
@@ -253,27 +393,17 @@ int BPlusTree::insert(struct iovec &field, int rightid, std::stack<int> &path)
     readIndexBlock(insertid);
     block.attach(buffer_);
 
-    // 插入record字段：key---right pointer
-    unsigned char insertHeader = 0x00;
-    struct iovec insertRecord[2];
-    insertRecord[0].iov_base = field.iov_base;
-    insertRecord[0].iov_len = field.iov_len;
-    insertRecord[1].iov_base = &rightid;
-    insertRecord[1].iov_len = sizeof(int);
+    // 插入条目：key---right pointer
+    DataType *type = keyType_;
+    int ret = block.insertEntry(&field, rightid, type, keySearch_);
 
-    int ret = block.allocate(&insertHeader, insertRecord, 2);
+    // 放不下时先尝试压缩公共前缀
+    bool prefix = (relationInfo->keyFormat & KEY_FORMAT_PREFIX) != 0;
+    if (!ret && prefix && block.compress())
+        ret = block.insertEntry(&field, rightid, type, keySearch_);
 
     //插入成功
     if (ret) {
-        // 排序
-        std::vector<unsigned short> slotsv;
-        for (int i = 0; i < block.getSlotsNum(); i++)
-            slotsv.push_back(block.getSlot(i));
-        treeCompare cmp(relationInfo->fields[relationInfo->key], 0, *this);
-        std::sort(slotsv.begin(), slotsv.end(), cmp);
-        for (int i = 0; i < block.getSlotsNum(); i++)
-            block.setSlot(i, slotsv[i]);
-
         //写block
         ret = writeIndexBlock(insertid);
         if (ret) return ret;
@@ -282,199 +412,93 @@ int BPlusTree::insert(struct iovec &field, int rightid, std::stack<int> &path)
         return S_OK;
     }
 
-    // IndexBlock几个特殊record的key字段
+    // IndexBlock分裂成block1和block2，block1原地保留在buffer_中
+    // block2沿用block的布局，先沿用block的前缀，才能按字节复制后缀
     unsigned short slotsNum = block.getSlotsNum();
-    Record record;
-    struct iovec halfField, halfPlusField;
-    unsigned short recOffset = block.getSlot(slotsNum / 2 - 1);
-    record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-    record.specialRef(halfField, 0);
-    recOffset = block.getSlot(slotsNum / 2);
-    record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-    record.specialRef(halfPlusField, 0);
-
-    // IndexBlock分裂成block1和block2
-    IndexBlock block1, block2;
-    unsigned char db1[Block::BLOCK_SIZE];
+    IndexBlock block2;
     unsigned char db2[Block::BLOCK_SIZE];
-    block1.attach(db1);
-    block1.clear(insertid);
-    block1.setNextid(block.getNextid()); //设置block1最左边指针
-    block1.setNodeType(block.getNodeType());
-    int newid = ++IndexBlockCnt;
+    int newid = allocIndexBlock();
     block2.attach(db2);
     block2.clear(newid);
+    block2.setLayout(block.getLayout());
     block2.setNodeType(block.getNodeType());
+    if (block.getPrefixLength() > 0)
+        block2.setPrefix(block.getPrefix(), block.getPrefixLength());
 
     //情况1:field在中间位置
-    if (relationInfo->fields[relationInfo->key].type->compare(
-            field.iov_base,
-            halfPlusField.iov_base,
-            field.iov_len,
-            halfPlusField.iov_len) &&
-        relationInfo->fields[relationInfo->key].type->compare(
-            halfField.iov_base,
-            field.iov_base,
-            halfField.iov_len,
-            field.iov_len)) {
-        //分裂IndexBlock，得到block1
-        for (unsigned short index = 0; index < slotsNum / 2; index++) {
-            unsigned short recOffset = block.getSlot(index);
-            Record record;
-            record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-            // 先分配iovec
-            size_t fields = record.fields();
-            struct iovec *iov = (struct iovec *) malloc(sizeof(iovec) * fields);
-            unsigned char header;
-            // 从记录得到iovec
-            record.ref(iov, (int) fields, &header);
-            // 插入block1
-            block1.allocate(&header, iov, (int) fields);
-            free(iov);
-        }
-        //分裂IndexBlock，得到block2
-        for (unsigned short index = slotsNum / 2; index < slotsNum; index++) {
-            unsigned short recOffset = block.getSlot(index);
-            Record record;
-            record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-            // 先分配iovec
-            size_t fields = record.fields();
-            struct iovec *iov = (struct iovec *) malloc(sizeof(iovec) * fields);
-            unsigned char header;
-            // 从记录得到iovec
-            record.ref(iov, (int) fields, &header);
-            // 插入block2
-            block2.allocate(&header, iov, (int) fields);
-            free(iov);
-        }
+    if (block.compareKey(&field, slotsNum / 2, type) < 0 &&
+        block.compareKey(&field, slotsNum / 2 - 1, type) > 0) {
+        //分裂IndexBlock，后半部分按字节复制到block2
+        block.copyEntries(block2, slotsNum / 2, slotsNum);
         block2.setNextid(rightid); //设置block2最左边指针
         //设置返回字段
         retField.iov_base = malloc(field.iov_len);
         ::memcpy(retField.iov_base, field.iov_base, field.iov_len);
         retField.iov_len = field.iov_len;
+        //截掉后半部分
+        block.truncate(slotsNum / 2);
     }
     //情况2:field不在中间位置
     else {
         int pos = 0;
-        if (relationInfo->fields[relationInfo->key].type->compare(
-                field.iov_base,
-                halfField.iov_base,
-                field.iov_len,
-                halfField.iov_len))
+        if (block.compareKey(&field, slotsNum / 2 - 1, type) < 0)
             pos = slotsNum / 2 - 1;
         else
             pos = slotsNum / 2;
 
-        //分裂IndexBlock，得到block1
-        for (unsigned short index = 0; index < pos; index++) {
-            unsigned short recOffset = block.getSlot(index);
-            Record record;
-            record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-            // 先分配iovec
-            size_t fields = record.fields();
-            struct iovec *iov = (struct iovec *) malloc(sizeof(iovec) * fields);
-            unsigned char header;
-            // 从记录得到iovec
-            record.ref(iov, (int) fields, &header);
-
-            // //测试
-            // long long id = *((long long *) iov[0].iov_base);
-            // int bid = *((int *) iov[1].iov_base);
-
-            // 插入block1
-            block1.allocate(&header, iov, (int) fields);
-            free(iov);
-        }
-        //分裂IndexBlock，得到block2
-        for (unsigned short index = pos + 1; index < slotsNum; index++) {
-            unsigned short recOffset = block.getSlot(index);
-            Record record;
-            record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-            // 先分配iovec
-            size_t fields = record.fields();
-            struct iovec *iov = (struct iovec *) malloc(sizeof(iovec) * fields);
-            unsigned char header;
-            // 从记录得到iovec
-            record.ref(iov, (int) fields, &header);
-
-            // //测试
-            // long long id = *((long long *) iov[0].iov_base);
-            // int bid = *((int *) iov[1].iov_base);
-
-            // 插入block2
-            block2.allocate(&header, iov, (int) fields);
-            free(iov);
-        }
+        //分裂IndexBlock，pos之后按字节复制到block2
+        block.copyEntries(block2, pos + 1, slotsNum);
 
-        // pos位置的record
-        unsigned short recOffset = block.getSlot(pos);
-        Record record;
-        record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-        // 先分配iovec
-        size_t fields = record.fields();
-        struct iovec *iov = (struct iovec *) malloc(sizeof(iovec) * fields);
-        unsigned char header;
-        // 从记录得到iovec
-        record.ref(iov, (int) fields, &header);
-        //设置block2最左边指针
-        block2.setNextid(*((int *) iov[1].iov_base));
+        // pos位置的条目上移，右指针成为block2最左边指针
+        block2.setNextid(block.getPointer(pos));
         //设置返回字段
-        retField.iov_base = malloc(iov[0].iov_len);
-        ::memcpy(retField.iov_base, iov[0].iov_base, iov[0].iov_len);
-        retField.iov_len = iov[0].iov_len;
-
-        //插入record
-        if (pos == slotsNum / 2 - 1) {
-            ret = block1.allocate(&insertHeader, insertRecord, 2);
-            if (!ret) return ret;
-            // 排序
-            std::vector<unsigned short> slotsv;
-            for (int i = 0; i < block1.getSlotsNum(); i++)
-                slotsv.push_back(block1.getSlot(i));
-            treeCompare cmp(relationInfo->fields[relationInfo->key], 0, *this);
-            std::sort(slotsv.begin(), slotsv.end(), cmp);
-            for (int i = 0; i < block1.getSlotsNum(); i++)
-                block1.setSlot(i, slotsv[i]);
-        } else {
-            ret = block2.allocate(&insertHeader, insertRecord, 2);
-            if (!ret) return ret;
-            // 排序
-            std::vector<unsigned short> slotsv;
-            for (int i = 0; i < block2.getSlotsNum(); i++)
-                slotsv.push_back(block2.getSlot(i));
-            treeCompare cmp(relationInfo->fields[relationInfo->key], 0, *this);
-            std::sort(slotsv.begin(), slotsv.end(), cmp);
-            for (int i = 0; i < block2.getSlotsNum(); i++)
-                block2.setSlot(i, slotsv[i]);
-        }
+        block.getKey(pos, &retField);
+
+        //截掉pos及之后的部分
+        block.truncate(pos);
+
+        //插入条目
+        if (pos == slotsNum / 2 - 1)
+            ret = block.insertEntry(&field, rightid, type, keySearch_);
+        else
+            ret = block2.insertEntry(&field, rightid, type, keySearch_);
+        if (!ret) return S_FALSE;
     }
-    //写block
-    size_t offset;
-    offset = (block1.blockid() - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-    relationInfo->indexFile.write(
-        offset, (const char *) db1, Block::BLOCK_SIZE);
+    // 分裂后两半的键值范围变窄，重新压缩
+    if (prefix) {
+        block.compress();
+        block2.compress();
+    }
+    block.setChecksum();
+    block2.setChecksum();
 
-    offset = (block2.blockid() - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+    //写block
+    ret = writeIndexBlock(insertid);
+    if (ret) return ret;
+    size_t offset = (newid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
     relationInfo->indexFile.write(
         offset, (const char *) db2, Block::BLOCK_SIZE);
+    mirror_.refresh(block2);
 
     // 直到根结点都满了，新生成根结点
     if (path.empty()) {
         IndexBlock newroot;
         newroot.attach(buffer_);
-        newroot.clear(++IndexBlockCnt);
+        newroot.clear(allocIndexBlock());
+        newroot.setLayout(layout_);
         newroot.setNextid(insertid); //设置newroot最左边指针
         newroot.setNodeType(NODE_TYPE_INTERNAL);
 
-        //插入的记录
-        insertRecord[0].iov_base = retField.iov_base;
-        insertRecord[0].iov_len = retField.iov_len;
-        insertRecord[1].iov_base = &newid;
-        insertRecord[1].iov_len = sizeof(int);
-        //插入记录
-        ret = newroot.allocate(&insertHeader, insertRecord, 2);
-        //更新b+tree root
+        //插入条目
+        ret = newroot.appendEntry(&retField, newid);
+        free(retField.iov_base);
+        //更新b+tree root，各节点下移一层，镜像重新建立
         root_ = newroot.blockid();
+        mirror_.clear();
+        if (relationInfo->height) {
+            relationInfo->height++;
+            relationInfo->statsDirty = true;
+        }
         // 写newroot
         relationInfo->indexFile.write(
             (root_ - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE,
@@ -489,35 +513,111 @@ int BPlusTree::insert(struct iovec &field, int rightid, std::stack<int> &path)
     ret = writeRoot(0);
     if (ret) return ret;
     //递归插入
-    ret = insert(retField, newid, path);
+    ret = insertKey(retField, newid, path);
     if (ret) return ret;
     free(retField.iov_base);
     return S_OK;
 }
-int BPlusTree::updata(
-    int blockid,
-    struct iovec &oldField,
-    struct iovec &newField,
-    int pointer)
+int BPlusTree::updata(int blockid, struct iovec &newField, int pointer)
 {
+    // newField可能引用buffer_，读block之前先拷贝
+    struct iovec keyField;
+    keyField.iov_base = malloc(newField.iov_len + 1);
+    keyField.iov_len = newField.iov_len;
+    if (relationInfo->keyFormat & KEY_FORMAT_NORMALIZED)
+        keyField.iov_len = relationInfo->fields[relationInfo->key]
+                               .type->normalize(
+                                   keyField.iov_base,
+                                   newField.iov_base,
+                                   newField.iov_len);
+    else
+        ::memcpy(keyField.iov_base, newField.iov_base, newField.iov_len);
+
     IndexBlock block;
     readIndexBlock(blockid);
     block.attach(buffer_);
 
-    // 新的record字段：key---right pointer
-    unsigned char insertHeader = 0x00;
-    struct iovec insertRecord[2];
-    insertRecord[0].iov_base = newField.iov_base;
-    insertRecord[0].iov_len = newField.iov_len;
-    insertRecord[1].iov_base = &pointer;
-    insertRecord[1].iov_len = sizeof(int);
-
-    int ret = block.recDelete(&oldField, relationInfo);
-    if (ret == -1) return S_OK;
-    ret = block.allocate(&insertHeader, insertRecord, 2);
+    // 按右指针找条目，键值可能已经和儿子的最小键值不一致
+    int index = block.findPointer(pointer);
+    //最左边指针没有键值
+    if (index < 0) {
+        free(keyField.iov_base);
+        return S_OK;
+    }
+    block.removeEntries(index, index + 1);
+
+    // 新的条目：key---right pointer
+    bool ret = block.insertEntry(&keyField, pointer, keyType_, keySearch_);
+    free(keyField.iov_base);
+    if (!ret) return S_FALSE;
+
     writeIndexBlock(blockid);
     return S_OK;
 }
+int BPlusTree::getKey(int fatherid, int blockid, struct iovec *field)
+{
+    IndexBlock block;
+    readIndexBlock(fatherid);
+    block.attach(buffer_);
+
+    int index = block.findPointer(blockid);
+    if (index < 0) return S_FALSE;
+    //返回完整键值，还原成字段原来的格式
+    struct iovec key;
+    block.getKey(index, &key);
+    decodeKey(key, field);
+    return S_OK;
+}
+int BPlusTree::getChildren(int blockid, std::vector<int> &children)
+{
+    IndexBlock block;
+    readIndexBlock(blockid);
+    block.attach(buffer_);
+
+    children.clear();
+    children.push_back(block.getNextid());
+    unsigned short slotsNum = block.getSlotsNum();
+    for (unsigned short index = 0; index < slotsNum; index++)
+        children.push_back(block.getPointer(index));
+    return block.getNodeType();
+}
+int BPlusTree::height()
+{
+    int levels = 1; //叶子层
+    int blockid = root_;
+    std::vector<int> children;
+    while (true) {
+        levels++;
+        if (getChildren(blockid, children) == NODE_TYPE_POINT_TO_LEAF) break;
+        blockid = children.front();
+    }
+    return levels;
+}
+int BPlusTree::lastLeaf()
+{
+    int blockid = root_;
+    std::vector<int> children;
+    while (getChildren(blockid, children) != NODE_TYPE_POINT_TO_LEAF)
+        blockid = children.back();
+    return children.back();
+}
+int BPlusTree::getLeafParents(std::vector<int> &parents)
+{
+    //从根节点逐层向下
+    std::vector<int> level(1, root_);
+    while (!level.empty()) {
+        std::vector<int> next;
+        for (size_t i = 0; i < level.size(); i++) {
+            std::vector<int> children;
+            if (getChildren(level[i], children) == NODE_TYPE_POINT_TO_LEAF)
+                parents.push_back(level[i]);
+            else
+                next.insert(next.end(), children.begin(), children.end());
+        }
+        level.swap(next);
+    }
+    return S_OK;
+}
 int BPlusTree::getBrother(
     int fatherid,
     int blockid,
@@ -533,44 +633,34 @@ int BPlusTree::getBrother(
         broIndex = 0;
         isRight = 1;
     } else {
-        unsigned short slotsNum = block.getSlotsNum();
         //确定兄弟节点的broIndex
-        for (unsigned short index = 0; index < slotsNum; index++) {
-            unsigned short recOffset = block.getSlot(index);
-            Record record;
-            record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-            struct iovec bidField;
-            record.specialRef(bidField, 1);
-            int bid = *((int *) bidField.iov_base);
-            if (bid == blockid) {
-                if (index == slotsNum - 1) {
-                    broIndex = index - 1;
-                    isRight = 0;
-                } else {
-                    broIndex = index + 1;
-                    isRight = 1;
-                }
-                break;
+        int index = block.findPointer(blockid);
+        if (index >= 0) {
+            if (index == block.getSlotsNum() - 1) {
+                broIndex = index - 1;
+                isRight = 0;
+            } else {
+                broIndex = index + 1;
+                isRight = 1;
             }
         }
     }
     if (broIndex == -1)
         brotherid = -1;
-    else {
-        //得到兄弟节点的blockid
-        unsigned short recOffset = block.getSlot(broIndex);
-        Record record;
-        record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-        struct iovec bidField;
-        record.specialRef(bidField, 1);
-        brotherid = *((int *) bidField.iov_base);
-    }
+    else //得到兄弟节点的blockid
+        brotherid = block.getPointer(broIndex);
     return S_OK;
 }
 int BPlusTree::remove(struct iovec &field, std::stack<int> &path)
 {
-    unsigned int key = relationInfo->key;
-
+    struct iovec key;
+    encodeKey(field, key);
+    int ret = removeKey(key, path);
+    freeKey(key);
+    return ret;
+}
+int BPlusTree::removeKey(struct iovec &field, std::stack<int> &path)
+{
     //删除的索引条目所在的block
     int deleteid = path.top();
     path.pop();
@@ -580,9 +670,12 @@ int BPlusTree::remove(struct iovec &field, std::stack<int> &path)
     block.attach(buffer_);
 
     //删除
-    int deleteIndex;
-    deleteIndex = block.recDelete(&field, relationInfo);
-    if (deleteIndex == -1) return S_FALSE;
+    unsigned short deleteIndex =
+        block.lowerBound(&field, keyType_, 0, keySearch_);
+    if (deleteIndex == block.getSlotsNum() ||
+        block.compareKey(&field, deleteIndex, keyType_) != 0)
+        return S_FALSE;
+    block.removeEntries(deleteIndex, deleteIndex + 1);
     writeIndexBlock(deleteid);
 
     if (path.empty()) //到根节点
@@ -590,38 +683,16 @@ int BPlusTree::remove(struct iovec &field, std::stack<int> &path)
         return S_OK;
     }
     // 删除后结点填充度仍>=50%
-    if (block.getUsedspace() >= block.INITIAL_FREE_SPACE_SIZE / 4) {
-        //更新index
-        if (deleteIndex == 0) {
-            struct iovec updateField;
-            unsigned short recOffset = block.getSlot(0);
-            Record record;
-            record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-            record.specialRef(updateField, key);
-            int ret = updata(path.top(), field, updateField, deleteid);
-            if (ret) return ret;
-        }
+    // 最左边指针还在，父节点中的键值仍是下界，不用更新
+    if (block.getUsedspace() >= block.INITIAL_FREE_SPACE_SIZE / 4)
         return S_OK;
-    }
     //找到一个最近的兄弟节点
     int brotherid, isRight;
     getBrother(path.top(), deleteid, brotherid, isRight);
     if (brotherid == deleteid) return S_FALSE;
 
     //如果父节点只剩下一个儿子节点
-    if (brotherid == -1) {
-        //更新index
-        if (deleteIndex == 0) {
-            struct iovec updateField;
-            unsigned short recOffset = block.getSlot(0);
-            Record record;
-            record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-            record.specialRef(updateField, key);
-            int ret = updata(path.top(), field, updateField, deleteid);
-            if (ret) return ret;
-        }
-        return S_OK;
-    }
+    if (brotherid == -1) return S_OK;
 
     //读兄弟节点到db
     unsigned char db[Block::BLOCK_SIZE];
@@ -636,16 +707,47 @@ int BPlusTree::remove(struct iovec &field, std::stack<int> &path)
     }
     //兄弟结点填充度<=50%
     struct iovec delField;
-    if (isRight) {
-        int ret = combineIndexBlock(deleteid, brotherid, path.top(), &delField);
-        if (ret) return ret;
-    } else {
-        int ret = combineIndexBlock(brotherid, deleteid, path.top(), &delField);
-        if (ret) return ret;
-    }
+    int ret;
+    if (isRight)
+        ret = combineIndexBlock(deleteid, brotherid, path.top(), &delField);
+    else
+        ret = combineIndexBlock(brotherid, deleteid, path.top(), &delField);
+    //合并后放不下，保持原样
+    if (ret == S_FALSE) return S_OK;
+    if (ret) return ret;
     //递归删除
-    int ret = remove(delField, path);
+    ret = removeKey(delField, path);
+    free(delField.iov_base);
     if (ret) return ret;
     return S_OK;
 }
-} // namespace db
\ No newline at end of file
+int BPlusTree::unlink(int blockid, std::stack<int> &path)
+{
+    //指向blockid的索引条目所在的block
+    int fatherid = path.top();
+    path.pop();
+
+    IndexBlock block;
+    readIndexBlock(fatherid);
+    block.attach(buffer_);
+
+    unsigned short slotsNum = block.getSlotsNum();
+    if (block.getNextid() == blockid) {
+        //只剩最左边指针，把整个节点从父节点摘除
+        if (slotsNum == 0) {
+            if (path.empty()) return S_FALSE;
+            int ret = freeIndexBlock(fatherid);
+            if (ret) return ret;
+            return unlink(fatherid, path);
+        }
+        //第一个条目的右指针提升为最左边指针
+        block.setNextid(block.getPointer(0));
+        block.removeEntries(0, 1);
+    } else {
+        int index = block.findPointer(blockid);
+        if (index < 0) return S_FALSE;
+        block.removeEntries(index, index + 1);
+    }
+    return writeIndexBlock(fatherid);
+}
+} // namespace db
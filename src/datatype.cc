@@ -4,6 +4,7 @@
 //
 //
 #include <algorithm>
+#include <limits.h>
 #include <db/datatype.h>
 
 namespace db {
@@ -14,12 +15,154 @@ static bool compareChar(const void *x, const void *y, size_t sx, size_t sy)
                (const char *) x, (const char *) y, std::max<size_t>(sx, sy)) <
            0;
 }
+static int compareChar3(const void *x, const void *y, size_t sx, size_t sy)
+{
+    return strncmp(
+        (const char *) x, (const char *) y, std::max<size_t>(sx, sy));
+}
 static bool copyChar(void *x, const void *y, size_t sx, size_t sy)
 {
     if (sx < sy) return false;
     ::memcpy(x, y, sy);
     return true;
 }
+static size_t
+separateChar(void *s, const void *x, const void *y, size_t sx, size_t sy)
+{
+    const char *cx = (const char *) x;
+    const char *cy = (const char *) y;
+    // 取到第一个不同的字节为止，再补'\0'
+    size_t i = 0;
+    while (i < sx && i < sy && cx[i] == cy[i] && cx[i] != '\0')
+        ++i;
+    if (i + 2 >= sy) {
+        ::memmove(s, y, sy);
+        return sy;
+    }
+    ::memmove(s, y, i + 1); // s可以就是y
+    ((char *) s)[i + 1] = '\0';
+    return i + 2;
+}
+// 字符串到'\0'为止，和strncmp一致，按字节比较时'\0'就是结束符，不用转义
+static size_t normalizeChar(void *x, const void *y, size_t sy)
+{
+    const char *cy = (const char *) y;
+    size_t length = 0;
+    while (length < sy && cy[length] != '\0')
+        ++length;
+    ::memmove(x, y, length);
+    ((char *) x)[length] = '\0';
+    return length + 1;
+}
+static size_t denormalizeChar(void *x, const void *y, size_t sy)
+{
+    ::memmove(x, y, sy);
+    return sy;
+}
+static bool compareBytes(const void *x, const void *y, size_t sx, size_t sy)
+{
+    int ret = ::memcmp(x, y, std::min<size_t>(sx, sy));
+    return ret < 0 || (ret == 0 && sx < sy);
+}
+static int compareBytes3(const void *x, const void *y, size_t sx, size_t sy)
+{
+    int ret = ::memcmp(x, y, std::min<size_t>(sx, sy));
+    if (ret) return ret;
+    return sx < sy ? -1 : (sx > sy ? 1 : 0);
+}
+static size_t
+separateBytes(void *s, const void *x, const void *y, size_t sx, size_t sy)
+{
+    const unsigned char *bx = (const unsigned char *) x;
+    const unsigned char *by = (const unsigned char *) y;
+    // y到第一个不同的字节为止的前缀
+    size_t i = 0;
+    while (i < sx && i < sy && bx[i] == by[i])
+        ++i;
+    size_t length = std::min<size_t>(i + 1, sy);
+    ::memmove(s, y, length);
+    return length;
+}
+static size_t normalizeBytes(void *x, const void *y, size_t sy)
+{
+    ::memmove(x, y, sy);
+    return sy;
+}
+
+// 整数转big endian并翻转符号位，负数排在正数前面
+static size_t normalizeSigned(void *x, long long value, size_t size)
+{
+    unsigned long long bits = (unsigned long long) value;
+    bits ^= 1ULL << (size * 8 - 1);
+    unsigned char *bx = (unsigned char *) x;
+    for (size_t i = 0; i < size; ++i)
+        bx[i] = (unsigned char) (bits >> ((size - 1 - i) * 8));
+    return size;
+}
+static long long denormalizeSigned(const void *y, size_t size)
+{
+    const unsigned char *by = (const unsigned char *) y;
+    unsigned long long bits = 0;
+    for (size_t i = 0; i < size; ++i)
+        bits = (bits << 8) | by[i];
+    bits ^= 1ULL << (size * 8 - 1);
+    // 符号扩展
+    if (size < sizeof(long long) && (bits >> (size * 8 - 1)) & 1)
+        bits |= ~0ULL << (size * 8);
+    return (long long) bits;
+}
+static size_t normalizeTinyInt(void *x, const void *y, size_t sy)
+{
+    // char的符号随平台，和compareTinyInt保持一致
+    char value = *(const char *) y;
+    if (CHAR_MIN < 0) return normalizeSigned(x, (signed char) value, 1);
+    *(unsigned char *) x = (unsigned char) value;
+    return 1;
+}
+static size_t denormalizeTinyInt(void *x, const void *y, size_t sy)
+{
+    if (CHAR_MIN < 0)
+        *(char *) x = (char) denormalizeSigned(y, 1);
+    else
+        *(unsigned char *) x = *(const unsigned char *) y;
+    return 1;
+}
+static size_t normalizeSmallInt(void *x, const void *y, size_t sy)
+{
+    short value;
+    ::memcpy(&value, y, sizeof(short));
+    return normalizeSigned(x, value, sizeof(short));
+}
+static size_t denormalizeSmallInt(void *x, const void *y, size_t sy)
+{
+    short value = (short) denormalizeSigned(y, sizeof(short));
+    ::memcpy(x, &value, sizeof(short));
+    return sizeof(short);
+}
+static size_t normalizeInt(void *x, const void *y, size_t sy)
+{
+    int value;
+    ::memcpy(&value, y, sizeof(int));
+    return normalizeSigned(x, value, sizeof(int));
+}
+static size_t denormalizeInt(void *x, const void *y, size_t sy)
+{
+    int value = (int) denormalizeSigned(y, sizeof(int));
+    ::memcpy(x, &value, sizeof(int));
+    return sizeof(int);
+}
+static size_t normalizeBigInt(void *x, const void *y, size_t sy)
+{
+    long long value;
+    ::memcpy(&value, y, sizeof(long long));
+    return normalizeSigned(x, value, sizeof(long long));
+}
+static size_t denormalizeBigInt(void *x, const void *y, size_t sy)
+{
+    long long value = denormalizeSigned(y, sizeof(long long));
+    ::memcpy(x, &value, sizeof(long long));
+    return sizeof(long long);
+}
 static bool compareInt(const void *x, const void *y, size_t sx, size_t sy)
 {
     return *(int *) x < *(int *) y;
@@ -36,6 +179,48 @@ static bool compareTinyInt(const void *x, const void *y, size_t sx, size_t sy)
 {
     return *(char *) x < *(char *) y;
 }
+// double按位转成无符号整数，整数顺序就是IEEE 754的全序：负数取反，
+// 正数翻转符号位，-0.0排在0.0前面，NaN排在两端，B+tree要求严格弱序
+static inline unsigned long long orderDouble(const void *x)
+{
+    unsigned long long bits;
+    ::memcpy(&bits, x, sizeof(double));
+    return (bits >> 63) ? ~bits : bits ^ (1ULL << 63);
+}
+static bool compareDouble(const void *x, const void *y, size_t sx, size_t sy)
+{
+    return orderDouble(x) < orderDouble(y);
+}
+static int compareDouble3(const void *x, const void *y, size_t sx, size_t sy)
+{
+    unsigned long long a = orderDouble(x), b = orderDouble(y);
+    return (a > b) - (a < b);
+}
+static size_t normalizeDouble(void *x, const void *y, size_t sy)
+{
+    unsigned long long bits = orderDouble(y);
+    unsigned char *bx = (unsigned char *) x;
+    for (size_t i = 0; i < sizeof(double); ++i)
+        bx[i] = (unsigned char) (bits >> ((sizeof(double) - 1 - i) * 8));
+    return sizeof(double);
+}
+static size_t denormalizeDouble(void *x, const void *y, size_t sy)
+{
+    const unsigned char *by = (const unsigned char *) y;
+    unsigned long long bits = 0;
+    for (size_t i = 0; i < sizeof(double); ++i)
+        bits = (bits << 8) | by[i];
+    bits = (bits >> 63) ? bits ^ (1ULL << 63) : ~bits;
+    ::memcpy(x, &bits, sizeof(double));
+    return sizeof(double);
+}
+// 整数三路比较
+template <typename T>
+static int compareInt3(const void *x, const void *y, size_t sx, size_t sy)
+{
+    T a = *(T *) x, b = *(T *) y;
+    return (a > b) - (a < b);
+}
 static bool copyInt(void *x, const void *y, size_t sx, size_t sy)
 {
     ::memcpy(x, y, sy);
@@ -45,13 +230,88 @@ static bool copyInt(void *x, const void *y, size_t sx, size_t sy)
 DataType *findDataType(const char *name)
 {
     static DataType gdatatype[] = {
-        {"CHAR", 65535, compareChar, copyChar},     // 0
-        {"VARCHAR", -65535, compareChar, copyChar}, // 1
-        {"TINYINT", 1, compareTinyInt, copyInt},    // 2
-        {"SMALLINT", 2, compareSmallInt, copyInt},  // 3
-        {"INT", 4, compareInt, copyInt},            // 4
-        {"BIGINT", 8, compareBigInt, copyInt},      // 5
-        {},                                         // x
+        {"CHAR",
+         65535,
+         compareChar,
+         compareChar3,
+         copyChar,
+         separateChar,
+         normalizeChar,
+         denormalizeChar}, // 0
+        {"VARCHAR",
+         -65535,
+         compareChar,
+         compareChar3,
+         copyChar,
+         separateChar,
+         normalizeChar,
+         denormalizeChar}, // 1
+        {"TINYINT",
+         1,
+         compareTinyInt,
+         compareInt3<char>,
+         copyInt,
+         NULL,
+         normalizeTinyInt,
+         denormalizeTinyInt}, // 2
+        {"SMALLINT",
+         2,
+         compareSmallInt,
+         compareInt3<short>,
+         copyInt,
+         NULL,
+         normalizeSmallInt,
+         denormalizeSmallInt}, // 3
+        {"INT",
+         4,
+         compareInt,
+         compareInt3<int>,
+         copyInt,
+         NULL,
+         normalizeInt,
+         denormalizeInt}, // 4
+        {"BIGINT",
+         8,
+         compareBigInt,
+         compareInt3<long long>,
+         copyInt,
+         NULL,
+         normalizeBigInt,
+         denormalizeBigInt}, // 5
+        {"BYTES",
+         -65535,
+         compareBytes,
+         compareBytes3,
+         copyChar,
+         separateBytes,
+         normalizeBytes,
+         normalizeBytes}, // 6
+        // TIMESTAMP、DATE存TimeStamp::stamp_，和BIGINT一样比较
+        {"TIMESTAMP",
+         8,
+         compareBigInt,
+         compareInt3<long long>,
+         copyInt,
+         NULL,
+         normalizeBigInt,
+         denormalizeBigInt}, // 7
+        {"DATE",
+         8,
+         compareBigInt,
+         compareInt3<long long>,
+         copyInt,
+         NULL,
+         normalizeBigInt,
+         denormalizeBigInt}, // 8
+        {"DOUBLE",
+         8,
+         compareDouble,
+         compareDouble3,
+         copyInt,
+         NULL,
+         normalizeDouble,
+         denormalizeDouble}, // 9
+        {},               // x
     };
 
     int index = 0;
@@ -0,0 +1,171 @@
+////
+// @file indexmirror.cc
+// @brief
+// 上层索引节点的内存镜像
+//
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <db/indexmirror.h>
+
+namespace db {
+
+// 按cache line向上取整
+static inline size_t roundLine(size_t size)
+{
+    return (size + IndexMirror::LINE_SIZE - 1) / IndexMirror::LINE_SIZE *
+           IndexMirror::LINE_SIZE;
+}
+
+// 中序遍历Eytzinger下标，依次填入有序下标
+static void
+eytzinger(std::vector<unsigned short> &order, unsigned short &i, size_t k)
+{
+    if (k >= order.size()) return;
+    eytzinger(order, i, 2 * k);
+    order[k] = i++;
+    eytzinger(order, i, 2 * k + 1);
+}
+
+static void freeNode(IndexMirror::Node *node)
+{
+    free(node->memory);
+    delete node;
+}
+
+IndexMirror::IndexMirror()
+    : type_(NULL)
+{}
+IndexMirror::~IndexMirror() { clear(); }
+void IndexMirror::reset(DataType *type)
+{
+    clear();
+    type_ = type;
+}
+void IndexMirror::clear()
+{
+    for (NodeMap::iterator it = nodes_.begin(); it != nodes_.end(); ++it)
+        freeNode(it->second);
+    nodes_.clear();
+}
+IndexMirror::Node *IndexMirror::find(int blockid)
+{
+    NodeMap::iterator it = nodes_.find(blockid);
+    if (it == nodes_.end()) return NULL;
+    return it->second;
+}
+IndexMirror::Node *IndexMirror::load(IndexBlock &block)
+{
+    unsigned short count = block.getSlotsNum();
+    unsigned short layout = block.getLayout();
+
+    // 取出有序的完整键值，变长键值要拼接前缀
+    std::vector<struct iovec> keys(count);
+    size_t arenaSize = 0;
+    for (unsigned short i = 0; i < count; i++) {
+        block.getKey(i, &keys[i]);
+        arenaSize += keys[i].iov_len;
+    }
+    std::vector<unsigned short> order(count + 1);
+    unsigned short next = 0;
+    eytzinger(order, next, 1);
+
+    // 三个数组放在一块内存中，各自按64B对齐
+    Node *node = new Node;
+    node->blockid = (int) block.blockid();
+    node->nodeType = block.getNodeType();
+    node->count = count;
+    node->width = layout;
+    node->last = count ? block.getPointer(count - 1) : block.getNextid();
+    size_t entry = layout ? layout : 2 * sizeof(unsigned int);
+    size_t keysSize = roundLine((count + 1) * entry);
+    size_t childrenSize = roundLine((count + 1) * sizeof(int));
+    node->memory = (unsigned char *) malloc(
+        LINE_SIZE + keysSize + childrenSize + arenaSize);
+    unsigned char *base =
+        (unsigned char *) roundLine((uintptr_t) node->memory);
+    node->keys = base;
+    node->children = (int *) (base + keysSize);
+    node->arena = base + keysSize + childrenSize;
+
+    unsigned int offset = 0;
+    for (size_t k = 1; k <= count; k++) {
+        unsigned short i = order[k];
+        node->children[k] = i ? block.getPointer(i - 1) : block.getNextid();
+        if (layout) {
+            ::memcpy(node->keys + k * layout, keys[i].iov_base, layout);
+            continue;
+        }
+        unsigned int item[2] = {offset, (unsigned int) keys[i].iov_len};
+        ::memcpy(node->keys + k * entry, item, entry);
+        ::memcpy(node->arena + offset, keys[i].iov_base, keys[i].iov_len);
+        offset += (unsigned int) keys[i].iov_len;
+    }
+    for (unsigned short i = 0; i < count; i++)
+        free(keys[i].iov_base);
+
+    NodeMap::iterator it = nodes_.find(node->blockid);
+    if (it != nodes_.end()) {
+        freeNode(it->second);
+        it->second = node;
+    } else
+        nodes_.insert(std::make_pair(node->blockid, node));
+    return node;
+}
+void IndexMirror::refresh(IndexBlock &block)
+{
+    if (find((int) block.blockid())) load(block);
+}
+void IndexMirror::drop(int blockid)
+{
+    NodeMap::iterator it = nodes_.find(blockid);
+    if (it == nodes_.end()) return;
+    freeNode(it->second);
+    nodes_.erase(it);
+}
+int IndexMirror::search(Node *node, struct iovec *keyField)
+{
+    // 键值不大于x时向右，最后停在第一个大于x的键值下面
+    size_t k = 1;
+    size_t count = node->count;
+    if (node->width == INDEX_LAYOUT_INT64) {
+        long long x;
+        ::memcpy(&x, keyField->iov_base, sizeof(long long));
+        const long long *keys = (const long long *) node->keys;
+        while (k <= count) {
+#if defined(__GNUC__)
+            // 提前取几层之后的后代所在的cache line
+            __builtin_prefetch(node->keys + k * LINE_SIZE);
+#endif
+            k = 2 * k + (keys[k] <= x);
+        }
+    } else if (node->width == INDEX_LAYOUT_INT32) {
+        int x;
+        ::memcpy(&x, keyField->iov_base, sizeof(int));
+        const int *keys = (const int *) node->keys;
+        while (k <= count) {
+#if defined(__GNUC__)
+            __builtin_prefetch(node->keys + k * LINE_SIZE);
+#endif
+            k = 2 * k + (keys[k] <= x);
+        }
+    } else {
+        const unsigned int *items = (const unsigned int *) node->keys;
+        while (k <= count) {
+            bool less = type_->compare(
+                keyField->iov_base,
+                node->arena + items[2 * k],
+                keyField->iov_len,
+                items[2 * k + 1]);
+            k = 2 * k + !less;
+        }
+    }
+    // 去掉最后连续向右的几步和一步向左，回到第一个大于x的键值
+    while (k & 1)
+        k >>= 1;
+    k >>= 1;
+    return k ? node->children[k] : node->last;
+}
+
+} // namespace db
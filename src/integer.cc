@@ -75,4 +75,76 @@ bool Integer::decode(char *buf, size_t len)
         return false;
     }
 }
+
+// 值对应的长度标记，0~3分别表示1、2、4、8字节
+static inline unsigned int tagOf(unsigned long long value)
+{
+    return (unsigned int) (value > 0x3F) + (unsigned int) (value > 0x3FFF) +
+           (unsigned int) (value > 0x3FFFFFFF);
+}
+
+size_t Integer::encodeArray(
+    const unsigned long long *values,
+    size_t count,
+    char *buf,
+    size_t len)
+{
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        unsigned long long value = values[i];
+        if (value > 0x3FFFFFFFFFFFFFFF) return 0;
+        unsigned int tag = tagOf(value);
+        size_t size = (size_t) 1 << tag;
+        if (offset + 8 <= len) {
+            // 标记放在最高2位，左移到64位的高位，一次写8B
+            unsigned long long word = (value | (unsigned long long) tag
+                                                   << (size * 8 - 2))
+                                      << (64 - size * 8);
+            word = htobe64(word);
+            ::memcpy(buf + offset, &word, 8);
+        } else {
+            Integer it;
+            it.set(value);
+            if (!it.encode(buf + offset, len - offset)) return 0;
+        }
+        offset += size;
+    }
+    return offset;
+}
+
+size_t Integer::decodeArray(
+    const char *buf,
+    size_t len,
+    unsigned long long *values,
+    size_t count,
+    unsigned long long stop,
+    size_t &bytes)
+{
+    size_t offset = 0;
+    size_t total = 0;
+    while (total < count) {
+        if (offset >= len) return 0;
+        unsigned int tag = ((unsigned char) buf[offset] >> 6) & 0x03;
+        size_t size = (size_t) 1 << tag;
+        unsigned long long value;
+        if (offset + 8 <= len) {
+            // 一次读8B，右移掉多余的字节，再去掉标记
+            unsigned long long word;
+            ::memcpy(&word, buf + offset, 8);
+            word = be64toh(word) >> (64 - size * 8);
+            value = word & (~0ULL >> (66 - size * 8));
+        } else {
+            Integer it;
+            if (offset + size > len ||
+                !it.decode((char *) buf + offset, len - offset))
+                return 0;
+            value = it.get();
+        }
+        values[total++] = value;
+        offset += size;
+        if (value == stop) break;
+    }
+    bytes = offset;
+    return total;
+}
 } // namespace db
@@ -9,9 +9,77 @@
 
 namespace db {
 
+// 定长格式开头4B：字段数和总长度
+static inline unsigned int fixedWord(const unsigned char *buffer)
+{
+    unsigned int word;
+    ::memcpy(&word, buffer, Record::FIXED_LENGTH_SIZE);
+    return be32toh(word);
+}
+// 定长格式第index个字段从header开始的偏移量
+static inline size_t fixedOffset(const unsigned char *buffer, size_t index)
+{
+    unsigned short offset;
+    ::memcpy(
+        &offset,
+        buffer + Record::FIXED_LENGTH_SIZE + index * Record::FIXED_OFFSET_SIZE,
+        Record::FIXED_OFFSET_SIZE);
+    return be16toh(offset);
+}
+// 字段数和总长度放得进定长格式的4B时才用定长格式
+static bool useFixed(const iovec *iov, int iovcnt, int format)
+{
+    if (format != Record::FORMAT_FIXED || iovcnt <= 0 || iovcnt >= 0x4000)
+        return false;
+    size_t tot = Record::FIXED_LENGTH_SIZE +
+                 iovcnt * Record::FIXED_OFFSET_SIZE + Record::HEADER_SIZE;
+    for (int i = 0; i < iovcnt; i++)
+        tot += iov[i].iov_len;
+    return tot <= 0xFFFF;
+}
+
+// 批量跳过变长格式的偏移量数组，返回个数，offset移到header，失败返回0
+// offsets不为NULL时依次追加解出的偏移量，注意是逆序
+static size_t skipOffsets(
+    const unsigned char *buffer,
+    size_t length,
+    size_t &offset,
+    std::vector<unsigned long long> *offsets = NULL)
+{
+    const size_t chunk = 32;
+    unsigned long long values[chunk];
+    size_t total = 0;
+    while (true) {
+        if (offset >= length) return 0;
+        size_t bytes;
+        size_t n = Integer::decodeArray(
+            (const char *) buffer + offset,
+            length - offset,
+            values,
+            chunk,
+            Record::HEADER_SIZE,
+            bytes);
+        if (n == 0) return 0;
+        offset += bytes;
+        total += n;
+        if (offsets) offsets->insert(offsets->end(), values, values + n);
+        if (values[n - 1] == (unsigned long long) Record::HEADER_SIZE)
+            return total;
+    }
+}
+
 // TODO: 加上log
-std::pair<size_t, size_t> Record::size(const iovec *iov, int iovcnt)
+std::pair<size_t, size_t>
+Record::size(const iovec *iov, int iovcnt, int format)
 {
+    if (useFixed(iov, iovcnt, format)) {
+        size_t head = FIXED_LENGTH_SIZE + iovcnt * FIXED_OFFSET_SIZE;
+        size_t tot = head + HEADER_SIZE;
+        for (int i = 0; i < iovcnt; i++)
+            tot += iov[i].iov_len;
+        return std::pair<size_t, size_t>(tot, head);
+    }
+
     size_t iovoff = 1; // iov偏移量
     size_t tot = 0;    //总长度
     size_t head = 0;   // head位置
@@ -28,18 +96,49 @@ std::pair<size_t, size_t> Record::size(const iovec *iov, int iovcnt)
     return std::pair<size_t, size_t>(tot, head);
 }
 
-size_t Record::set(const iovec *iov, int iovcnt, const unsigned char *header)
+size_t Record::set(
+    const iovec *iov,
+    int iovcnt,
+    const unsigned char *header,
+    int format)
 {
     // 偏移量
     unsigned int offset = 0;
 
     // 先计算所需空间大小
-    std::pair<size_t, size_t> s1 = size(iov, iovcnt);
+    std::pair<size_t, size_t> s1 = size(iov, iovcnt, format);
+    size_t room = length_; // buffer长度，批量编码会多写后面几个字节
     if ((size_t) length_ < s1.first)
         return 0;
     else
         length_ = (unsigned short) s1.second;
 
+    if (useFixed(iov, iovcnt, format)) {
+        // 字段数+总长度，按Integer的4B格式
+        unsigned int word = htobe32(
+            0x80000000 | ((unsigned int) iovcnt << 16) |
+            (unsigned int) s1.first);
+        ::memcpy(buffer_, &word, FIXED_LENGTH_SIZE);
+        offset = FIXED_LENGTH_SIZE;
+        // 正序输出定长偏移量
+        size_t len = HEADER_SIZE;
+        for (int i = 0; i < iovcnt; ++i) {
+            unsigned short off = htobe16((unsigned short) len);
+            ::memcpy(buffer_ + offset, &off, FIXED_OFFSET_SIZE);
+            offset += FIXED_OFFSET_SIZE;
+            len += iov[i].iov_len;
+        }
+        ::memcpy(buffer_ + offset, header, HEADER_SIZE);
+        offset += HEADER_SIZE;
+        for (int i = 0; i < iovcnt; ++i) {
+            ::memcpy(buffer_ + offset, iov[i].iov_base, iov[i].iov_len);
+            offset += (unsigned int) iov[i].iov_len;
+        }
+        size_t ret = (s1.first + ALIGN_SIZE - 1) / ALIGN_SIZE * ALIGN_SIZE;
+        length_ = (unsigned short) ret;
+        return ret;
+    }
+
     // 输出记录长度
     Integer it;
     it.set(s1.first);
@@ -50,16 +149,19 @@ size_t Record::set(const iovec *iov, int iovcnt, const unsigned char *header)
     size_t len = HEADER_SIZE;
     for (int i = 0; i < iovcnt; ++i)
         len += iov[i].iov_len; // 计算总长
-    // 逆序输出
+    // 逆序排好后批量输出，多写的字节随后被header和字段覆盖
+    std::vector<unsigned long long> offsets(iovcnt);
     for (int i = iovcnt; i > 0; --i) {
         len -= iov[i - 1].iov_len;
-        it.set(len);
-        it.encode((char *) buffer_ + offset, length_);
-        offset += (unsigned int) it.size();
+        offsets[iovcnt - i] = len;
     }
+    if (iovcnt > 0)
+        offset += (unsigned int) Integer::encodeArray(
+            &offsets[0], iovcnt, (char *) buffer_ + offset, room - offset);
 
     // 输出头部
     memcpy(buffer_ + offset, header, HEADER_SIZE);
+    offset += HEADER_SIZE;
 
     // 顺序输出各字段
     for (int i = 0; i < iovcnt; ++i) {
@@ -86,39 +188,40 @@ size_t Record::set(const iovec *iov, int iovcnt, const unsigned char *header)
 
 size_t Record::length()
 {
+    if (isFixed()) return fixedWord(buffer_) & 0xFFFF;
     Integer it;
     return it.decode((char *) buffer_, length_) ? it.value_ : 0;
 }
 
 size_t Record::fields()
 {
+    if (isFixed()) return (fixedWord(buffer_) >> 16) & 0x3FFF;
     // bypass总长
     Integer it;
     bool ret = it.decode((char *) buffer_, length_);
     if (!ret) return 0;
-    unsigned short offset = it.size();
+    size_t offset = it.size();
 
     // 枚举所有字段长度
-    size_t total = 0;
-    while (true) {
-        if (offset >= length_) return 0;
-        ret = it.decode((char *) buffer_ + offset, length_ - offset);
-        if (!ret)
-            return 0;
-        else
-            offset += it.size();
-
-        ++total;
-        // 找到尾部
-        if (it.value_ == (unsigned long) HEADER_SIZE) break;
-    }
-
-    return total;
+    return skipOffsets(buffer_, length_, offset);
 }
 
 bool Record::get(iovec *iov, int iovcnt, unsigned char *header)
 {
     if (header == NULL) return false;
+    if (isFixed()) {
+        // 先引用，再检查长度并拷贝
+        if (iovcnt <= 0) return false;
+        std::vector<iovec> vec(iovcnt);
+        if (!ref(&vec[0], iovcnt, header)) return false;
+        for (int i = 0; i < iovcnt; ++i)
+            if (vec[i].iov_len > iov[i].iov_len) return false;
+        for (int i = 0; i < iovcnt; ++i) {
+            iov[i].iov_len = vec[i].iov_len;
+            ::memcpy(iov[i].iov_base, vec[i].iov_base, vec[i].iov_len);
+        }
+        return true;
+    }
     size_t offset = 0;
 
     // 总长
@@ -128,28 +231,24 @@ bool Record::get(iovec *iov, int iovcnt, unsigned char *header)
     if (!ret) return false;
     length = it.get();
 
-    // 枚举所有字段长度
-    size_t total = 0;
+    // 批量解码所有字段偏移量，注意是逆序
     offset += it.size();
-    std::vector<size_t> vec(iovcnt); // 存放各字段长度
-    while (true) {
-        if (offset >= length_) return false;
-        ret = it.decode((char *) buffer_ + offset, length_ - offset);
-        if (!ret) return false;
-
-        vec[total] = it.get(); // 临时存放偏移量，注意是逆序
-        if (++total > (size_t) iovcnt) return false;
-
-        // 找到尾部
-        if (it.value_ == (unsigned long) HEADER_SIZE)
-            break;
-        else
-            offset += it.size();
-    }
+    if (iovcnt <= 0 || offset >= length_) return false;
+    std::vector<unsigned long long> vec(iovcnt);
+    size_t bytes;
+    size_t total = Integer::decodeArray(
+        (const char *) buffer_ + offset,
+        length_ - offset,
+        &vec[0],
+        iovcnt,
+        HEADER_SIZE,
+        bytes);
     if (total != (size_t) iovcnt) return false; // 字段数目不对
+    if (vec[total - 1] != (unsigned long long) HEADER_SIZE) return false;
+    offset += bytes;
     // 逆序，先交换
     for (int i = 0; i < iovcnt / 2; ++i) {
-        size_t tmp = vec[i];
+        unsigned long long tmp = vec[i];
         vec[i] = vec[iovcnt - i - 1];
         vec[iovcnt - i - 1] = tmp;
     }
@@ -162,7 +261,7 @@ bool Record::get(iovec *iov, int iovcnt, unsigned char *header)
             iov[i].iov_len = vec[i];
     }
     // 最后一个字段长度
-    vec[iovcnt - 1] = length - vec[iovcnt - 1] - offset - HEADER_SIZE;
+    vec[iovcnt - 1] = length - vec[iovcnt - 1] - offset;
     if (vec[iovcnt - 1] > iov[iovcnt - 1].iov_len)
         return false;
     else
@@ -190,6 +289,13 @@ bool Record::get(iovec *iov, int iovcnt, unsigned char *header)
 bool Record::ref(iovec *iov, int iovcnt, unsigned char *header)
 {
     if (header == NULL) return false;
+    if (isFixed()) {
+        if (fields() != (size_t) iovcnt) return false; // 字段数目不对
+        for (int i = 0; i < iovcnt; ++i)
+            specialRef(iov[i], i);
+        ::memcpy(header, buffer_ + headerOffset(), HEADER_SIZE);
+        return true;
+    }
     size_t offset = 0;
 
     // 总长
@@ -199,28 +305,24 @@ bool Record::ref(iovec *iov, int iovcnt, unsigned char *header)
     if (!ret) return false;
     length = it.get();
 
-    // 枚举所有字段长度
-    size_t total = 0;
+    // 批量解码所有字段偏移量，注意是逆序
     offset += it.size();
-    std::vector<size_t> vec(iovcnt); // 存放各字段长度
-    while (true) {
-        if (offset >= length_) return false;
-        ret = it.decode((char *) buffer_ + offset, length_ - offset);
-        if (!ret) return false;
-
-        vec[total] = it.get(); // 临时存放偏移量，注意是逆序
-        if (++total > (size_t) iovcnt) return false;
-
-        // 找到尾部
-        if (it.value_ == (unsigned long) HEADER_SIZE)
-            break;
-        else
-            offset += it.size();
-    }
+    if (iovcnt <= 0 || offset >= length_) return false;
+    std::vector<unsigned long long> vec(iovcnt);
+    size_t bytes;
+    size_t total = Integer::decodeArray(
+        (const char *) buffer_ + offset,
+        length_ - offset,
+        &vec[0],
+        iovcnt,
+        HEADER_SIZE,
+        bytes);
     if (total != (size_t) iovcnt) return false; // 字段数目不对
+    if (vec[total - 1] != (unsigned long long) HEADER_SIZE) return false;
+    offset += bytes;
     // 逆序，先交换
     for (int i = 0; i < iovcnt / 2; ++i) {
-        size_t tmp = vec[i];
+        unsigned long long tmp = vec[i];
         vec[i] = vec[iovcnt - i - 1];
         vec[iovcnt - i - 1] = tmp;
     }
@@ -230,7 +332,7 @@ bool Record::ref(iovec *iov, int iovcnt, unsigned char *header)
         iov[i].iov_len = vec[i];
     }
     // 最后一个字段长度
-    vec[iovcnt - 1] = length - vec[iovcnt - 1] - offset - HEADER_SIZE;
+    vec[iovcnt - 1] = length - vec[iovcnt - 1] - offset;
     iov[iovcnt - 1].iov_len = vec[iovcnt - 1];
 
     // 拷贝header
@@ -247,6 +349,19 @@ bool Record::ref(iovec *iov, int iovcnt, unsigned char *header)
 }
 bool Record::specialRef(iovec &iov, unsigned int id)
 {
+    if (isFixed()) {
+        // 直接取第id个和第id+1个偏移量
+        unsigned int word = fixedWord(buffer_);
+        size_t count = (word >> 16) & 0x3FFF;
+        if (id >= count) return false;
+        size_t head = FIXED_LENGTH_SIZE + count * FIXED_OFFSET_SIZE;
+        size_t start = fixedOffset(buffer_, id);
+        size_t end = id + 1 < count ? fixedOffset(buffer_, id + 1)
+                                    : (word & 0xFFFF) - head;
+        iov.iov_base = (void *) (buffer_ + head + start);
+        iov.iov_len = end - start;
+        return true;
+    }
     size_t fieldNum = fields();
     struct iovec *iove = (struct iovec *) malloc(sizeof(iovec) * fieldNum);
     unsigned char header;
@@ -260,4 +375,56 @@ bool Record::specialRef(iovec &iov, unsigned int id)
         return false;
     }
 }
+bool Record::project(iovec *iov, const unsigned int *columns, int count)
+{
+    // 定长格式逐个字段O(1)定位
+    if (isFixed()) {
+        for (int i = 0; i < count; ++i)
+            if (!specialRef(iov[i], columns[i])) return false;
+        return true;
+    }
+
+    // 变长格式只解码一遍偏移量数组，只算要的字段
+    Integer it;
+    if (!it.decode((char *) buffer_, length_)) return false;
+    size_t length = it.get();
+    size_t offset = it.size();
+    std::vector<unsigned long long> offsets;
+    size_t total = skipOffsets(buffer_, length_, offset, &offsets);
+    if (total == 0) return false;
+    size_t last = length - offset; // 最后一个字段的结束位置
+    for (int i = 0; i < count; ++i) {
+        size_t id = columns[i];
+        if (id >= total) return false;
+        size_t start = offsets[total - 1 - id];
+        size_t end = id + 1 < total ? offsets[total - 2 - id] : last;
+        iov[i].iov_base = (void *) (buffer_ + offset + start);
+        iov[i].iov_len = end - start;
+    }
+    return true;
+}
+size_t Record::headerOffset()
+{
+    if (isFixed())
+        return FIXED_LENGTH_SIZE + fields() * FIXED_OFFSET_SIZE;
+    // bypass总长
+    Integer it;
+    bool ret = it.decode((char *) buffer_, length_);
+    if (!ret) return 0;
+    size_t offset = it.size();
+
+    // bypass字段偏移量数组
+    if (skipOffsets(buffer_, length_, offset) == 0) return 0;
+    return offset;
+}
+unsigned char Record::getHeader()
+{
+    size_t offset = headerOffset();
+    return offset ? buffer_[offset] : 0;
+}
+void Record::setHeader(unsigned char header)
+{
+    size_t offset = headerOffset();
+    if (offset) buffer_[offset] = header;
+}
 } // namespace db
@@ -15,6 +15,8 @@ const char *Schema::META_FILE = "meta.db";
 
 Schema::Schema(const char *name)
     : name_(name)
+    , tail_(0)
+    , blocks_(0)
 {
     buffer_ = (unsigned char *) malloc(Block::BLOCK_SIZE);
 }
@@ -32,40 +34,50 @@ int Schema::open()
     if (ret) return ret;
     if (length) {
         // 加载
-        metafile_.read(0, (char *) buffer_, Root::ROOT_SIZE);
+        unsigned char rb[Root::ROOT_SIZE];
+        metafile_.read(0, (char *) rb, Root::ROOT_SIZE);
         // TODO: 检查root？
-        // 获取第1个block
         Root root;
-        root.attach(buffer_);
+        root.attach(rb);
         unsigned int first = root.getHead();
-        size_t offset = (first - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-        metafile_.read(offset, (char *) buffer_, Block::BLOCK_SIZE);
-        // 加载tablespace_
-        MetaBlock block;
-        block.attach(buffer_);
-        unsigned short count = block.getSlotsNum();
-        for (unsigned short i = 0; i < count; ++i) {
-            // 获取slot
-            unsigned short slotoff = block.getSlot(i);
-            RelationInfo info;
-            // 得到记录
-            Record record;
-            unsigned char *rb = buffer_ + slotoff;
-            record.attach(rb, Block::BLOCK_SIZE);
-            // 先分配iovec
-            size_t fields = record.fields();
-            struct iovec *iov = (struct iovec *) malloc(sizeof(iovec) * fields);
-            unsigned char header;
-            // 从记录得到iovec
-            record.ref(iov, (int) fields, &header);
-            // 填充info
-            std::string table;
-            retrieveInfo(table, info, iov, (int) fields);
-            // 插入tablespace
-            tablespace_.insert(
-                std::pair<std::string, RelationInfo>(table, info));
-            free(iov);
+        blocks_ = root.getCnt();
+        if (blocks_ == 0) blocks_ = 1; // 旧文件只有1个block，没有记数目
+        // 数目不能超过文件实际的block数
+        if (length < (unsigned long long) Root::ROOT_SIZE ||
+            blocks_ > (length - Root::ROOT_SIZE) / Block::BLOCK_SIZE)
+            return EINVAL;
+
+        // meta block都是追加分配的，一次读入，再沿链表加载
+        unsigned char *all =
+            (unsigned char *) malloc((size_t) blocks_ * Block::BLOCK_SIZE);
+        if (all == NULL) return ENOMEM;
+        ret = metafile_.read(
+            Root::ROOT_SIZE, (char *) all, blocks_ * Block::BLOCK_SIZE);
+        if (ret) {
+            free(all);
+            return ret;
         }
+        // 链长不超过block数目，坏链不会死循环
+        unsigned int blockid = first;
+        tail_ = 0;
+        for (unsigned int n = 0;
+             n < blocks_ && blockid > 0 && blockid <= blocks_;
+             ++n) {
+            unsigned char *buffer = all + (blockid - 1) * Block::BLOCK_SIZE;
+            MetaBlock block;
+            block.attach(buffer);
+            load(block);
+            tail_ = blockid;
+            blockid = (unsigned int) block.getNextid();
+        }
+        if (tail_ == 0) {
+            free(all);
+            return EINVAL;
+        }
+        // 只留链尾，create在其中分配
+        ::memcpy(
+            buffer_, all + (tail_ - 1) * Block::BLOCK_SIZE, Block::BLOCK_SIZE);
+        free(all);
     } else {
         // 创建root
         Root root;
@@ -73,6 +85,9 @@ int Schema::open()
         root.attach(rb);
         root.clear(BLOCK_TYPE_META);
         root.setHead(1);
+        root.setCnt(1);
+        root.setChecksum();
+        blocks_ = tail_ = 1;
         // 创建第1个block
         MetaBlock block;
         block.attach(buffer_);
@@ -86,41 +101,174 @@ int Schema::open()
     return S_OK;
 }
 
-int Schema::create(const char *table, RelationInfo &info)
+void Schema::load(MetaBlock &block)
+{
+    unsigned short count = block.getSlotsNum();
+    for (unsigned short i = 0; i < count; ++i) {
+        // 获取slot
+        unsigned short slotoff = block.getSlot(i);
+        RelationInfo info;
+        // 得到记录
+        Record record;
+        unsigned char *rb = block.getBuffer() + slotoff;
+        record.attach(rb, Block::BLOCK_SIZE);
+        // 先分配iovec，字段数不是固定字段加整数个域描述的是坏记录，跳过
+        size_t fields = record.fields();
+        if (fields < (size_t) FIXED_FIELDS ||
+            (fields - FIXED_FIELDS) % 4 != 0)
+            continue;
+        struct iovec *iov = (struct iovec *) malloc(sizeof(iovec) * fields);
+        unsigned char header;
+        // 从记录得到iovec
+        if (!record.ref(iov, (int) fields, &header)) {
+            free(iov);
+            continue;
+        }
+        // 填充info
+        std::string table;
+        retrieveInfo(table, info, iov, (int) fields);
+        // 插入tablespace
+        tablespace_.insert(std::pair<std::string, RelationInfo>(table, info));
+        free(iov);
+    }
+}
+
+int Schema::writeRoot()
 {
-    if ((size_t) info.count != info.fields.size()) return EINVAL;
+    unsigned char rb[Root::ROOT_SIZE];
+    int ret = metafile_.read(0, (char *) rb, Root::ROOT_SIZE);
+    if (ret) return ret;
+    Root root;
+    root.attach(rb);
+    root.setCnt(blocks_);
+    root.setChecksum();
+    return metafile_.write(0, (const char *) rb, Root::ROOT_SIZE);
+}
+
+int Schema::create(const char *table, RelationInfo &relation)
+{
+    if ((size_t) relation.count != relation.fields.size()) return EINVAL;
+    // 组合键：检查各列，在最后补上隐藏的键值列，调用方的relation不变
+    RelationInfo info(relation);
+    if (!info.keys.empty()) {
+        for (size_t i = 0; i < info.keys.size(); ++i) {
+            if (info.keys[i] >= info.count) return EINVAL;
+            for (size_t j = 0; j < i; ++j)
+                if (info.keys[j] == info.keys[i]) return EINVAL;
+            // BYTES的normalize不带结束符，只能是最后一列
+            if (info.fields[info.keys[i]].fieldType == "BYTES" &&
+                i + 1 < info.keys.size())
+                return EINVAL;
+        }
+        FieldInfo field;
+        field.name = COMPOSITE_KEY_NAME;
+        field.index = info.count;
+        field.length = -65535;
+        field.fieldType = "BYTES";
+        info.fields.push_back(field);
+        info.key = info.count++;
+    }
+    // 检查叶子空间策略
+    if (info.fillFactor == 0 || info.fillFactor > 100 ||
+        info.splitRatio == 0 || info.splitRatio >= 100 ||
+        info.borrowRatio > 100 || info.mergeRatio >= info.borrowRatio ||
+        info.mergeRatio >= info.fillFactor)
+        return EINVAL;
+    // 前缀压缩按字节进行，未normalize时只支持字符串键值
+    if (info.keyFormat & ~(KEY_FORMAT_PREFIX | KEY_FORMAT_NORMALIZED))
+        return EINVAL;
+    if (info.keyMode > KEY_MODE_DUPLICATE) return EINVAL;
+    if (info.keyFormat == KEY_FORMAT_PREFIX) {
+        if (info.key >= info.count) return EINVAL;
+        const std::string &type = info.fields[info.key].fieldType;
+        if (type != "CHAR" && type != "VARCHAR" && type != "BYTES")
+            return EINVAL;
+    }
 
     // 先将info转化iov
-    int total = 7; // 未包括域的描述信息，需要保存7个字段
-    total += info.count * 4; // 不包括数据类型指针
+    int total = FIXED_FIELDS; // 未包括域的描述信息
+    total += info.count * 4;  // 不包括数据类型指针
     struct iovec *iov = (struct iovec *) calloc(total, sizeof(struct iovec));
 
-    // 初始化iov
-    initIov(table, info, iov);
+    // 初始化iov，转成big endian的是拷贝，info保持主机字节序
+    RelationInfo disk(info);
+    initIov(table, disk, iov);
 
     // 在表空间中添加
     std::string t(table);
     std::pair<TableSpace::iterator, bool> pret =
         tablespace_.insert(std::pair<std::string, RelationInfo>(t, info));
-    if (!pret.second) return EEXIST;
+    if (!pret.second) {
+        free(iov);
+        return EEXIST;
+    }
 
-    // 在当前meta块中分配
+    // 在链尾的meta块中分配，满了就在文件末尾追加一个block
     MetaBlock meta;
     meta.attach(buffer_);
     unsigned char header = 0;
+    // 写文件失败时恢复链尾block
+    unsigned char saved[Block::BLOCK_SIZE];
+    ::memcpy(saved, buffer_, Block::BLOCK_SIZE);
     bool ret = meta.allocate(&header, iov, total);
     if (!ret) {
-        // TODO: 再分配一个block
+        // 先在新block中分配，放不下说明记录超过一个block
+        unsigned int blockid = blocks_ + 1;
+        unsigned char *fresh = (unsigned char *) malloc(Block::BLOCK_SIZE);
+        MetaBlock next;
+        next.attach(fresh);
+        next.clear(blockid);
+        if (!next.allocate(&header, iov, total)) {
+            free(fresh);
+            tablespace_.erase(pret.first);
+            free(iov);
+            return EINVAL;
+        }
+        // 先写新block，再接到链尾，最后改root中的数目；中途崩溃时
+        // root和链都还停在旧链尾，只丢这张新表
+        next.setChecksum();
+        size_t offset = (blockid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+        int wret =
+            metafile_.write(offset, (const char *) fresh, Block::BLOCK_SIZE);
+        if (wret == S_OK) {
+            int nextid = meta.getNextid();
+            meta.setNextid((int) blockid);
+            meta.setChecksum();
+            offset = (tail_ - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+            wret = metafile_.write(
+                offset, (const char *) buffer_, Block::BLOCK_SIZE);
+            if (wret) meta.setNextid(nextid);
+        }
+        if (wret == S_OK) {
+            blocks_ = blockid;
+            wret = writeRoot();
+            if (wret) blocks_ = blockid - 1;
+        }
+        if (wret) {
+            free(fresh);
+            tablespace_.erase(pret.first);
+            free(iov);
+            return wret;
+        }
+        ::memcpy(buffer_, fresh, Block::BLOCK_SIZE);
+        free(fresh);
+        tail_ = blockid;
+        free(iov);
+        return S_OK;
     }
     // 不需要排序，因为有tablespace_
     // 处理checksum
     meta.setChecksum();
     // 写meta文件
-    unsigned int blockid = meta.blockid() - 1;
-    size_t offset = blockid * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-    metafile_.write(offset, (const char *) buffer_, Block::BLOCK_SIZE);
-
+    size_t offset = (tail_ - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+    int wret =
+        metafile_.write(offset, (const char *) buffer_, Block::BLOCK_SIZE);
     free(iov);
+    if (wret) {
+        ::memcpy(buffer_, saved, Block::BLOCK_SIZE);
+        tablespace_.erase(pret.first);
+        return wret;
+    }
     return S_OK;
 }
 
@@ -142,6 +290,14 @@ int Schema::loadIndex(TableSpace::iterator it)
     return it->second.indexFile.open(it->second.indexPath.c_str());
 }
 
+void Schema::indexesOf(const char *table, std::vector<std::string> &names)
+{
+    names.clear();
+    for (TableSpace::iterator it = tablespace_.begin(); it != tablespace_.end();
+         ++it)
+        if (it->second.base == table) names.push_back(it->first);
+}
+
 void Schema::initIov(const char *table, RelationInfo &info, struct iovec *iov)
 {
     iov[0].iov_base = (void *) table;
@@ -160,12 +316,43 @@ void Schema::initIov(const char *table, RelationInfo &info, struct iovec *iov)
     info.key = htobe32(info.key);
     iov[5].iov_base = &info.key;
     iov[5].iov_len = sizeof(unsigned int);
-    iov[6].iov_base = &info.size; // 初始化为0，不需要转化为big endian
+    info.size = htobe64(info.size);
+    iov[6].iov_base = &info.size;
     iov[6].iov_len = sizeof(unsigned long long);
-    iov[7].iov_base = &info.rows; // 初始化为0，不需要转化为big endian
+    info.rows = htobe64(info.rows);
+    iov[7].iov_base = &info.rows;
     iov[7].iov_len = sizeof(unsigned long long);
+    // 叶子空间策略
+    info.fillFactor = htobe16(info.fillFactor);
+    iov[8].iov_base = &info.fillFactor;
+    iov[8].iov_len = sizeof(unsigned short);
+    info.splitRatio = htobe16(info.splitRatio);
+    iov[9].iov_base = &info.splitRatio;
+    iov[9].iov_len = sizeof(unsigned short);
+    info.mergeRatio = htobe16(info.mergeRatio);
+    iov[10].iov_base = &info.mergeRatio;
+    iov[10].iov_len = sizeof(unsigned short);
+    info.borrowRatio = htobe16(info.borrowRatio);
+    iov[11].iov_base = &info.borrowRatio;
+    iov[11].iov_len = sizeof(unsigned short);
+    info.keyFormat = htobe16(info.keyFormat);
+    iov[12].iov_base = &info.keyFormat;
+    iov[12].iov_len = sizeof(unsigned short);
+    info.keyMode = htobe16(info.keyMode);
+    iov[13].iov_base = &info.keyMode;
+    iov[13].iov_len = sizeof(unsigned short);
+    for (size_t i = 0; i < info.keys.size(); ++i)
+        info.keys[i] = htobe32(info.keys[i]);
+    iov[14].iov_base = info.keys.empty() ? NULL : &info.keys[0];
+    iov[14].iov_len = info.keys.size() * sizeof(unsigned int);
+    iov[15].iov_base = (void *) info.base.c_str();
+    iov[15].iov_len = info.base.size() + 1;
+    for (size_t i = 0; i < info.sources.size(); ++i)
+        info.sources[i] = htobe32(info.sources[i]);
+    iov[16].iov_base = info.sources.empty() ? NULL : &info.sources[0];
+    iov[16].iov_len = info.sources.size() * sizeof(unsigned int);
     // 初始化field
-    size_t index = 8;
+    size_t index = FIXED_FIELDS;
     for (unsigned short i = 0; i < count; ++i) {
         iov[index].iov_base = (void *) info.fields[i].name.c_str();
         iov[index].iov_len = info.fields[i].name.size() + 1;
@@ -180,6 +367,7 @@ void Schema::initIov(const char *table, RelationInfo &info, struct iovec *iov)
         ++index;
         iov[index].iov_base = (void *) info.fields[i].fieldType.c_str();
         iov[index].iov_len = info.fields[i].fieldType.size() + 1;
+        ++index;
     }
 }
 
@@ -202,19 +390,46 @@ void Schema::retrieveInfo(
     info.size = be64toh(info.size);
     ::memcpy(&info.rows, iov[7].iov_base, sizeof(unsigned long long));
     info.rows = be64toh(info.rows);
-    int count = (iovcnt - 8) / 4;
+    ::memcpy(&info.fillFactor, iov[8].iov_base, sizeof(unsigned short));
+    info.fillFactor = be16toh(info.fillFactor);
+    ::memcpy(&info.splitRatio, iov[9].iov_base, sizeof(unsigned short));
+    info.splitRatio = be16toh(info.splitRatio);
+    ::memcpy(&info.mergeRatio, iov[10].iov_base, sizeof(unsigned short));
+    info.mergeRatio = be16toh(info.mergeRatio);
+    ::memcpy(&info.borrowRatio, iov[11].iov_base, sizeof(unsigned short));
+    info.borrowRatio = be16toh(info.borrowRatio);
+    ::memcpy(&info.keyFormat, iov[12].iov_base, sizeof(unsigned short));
+    info.keyFormat = be16toh(info.keyFormat);
+    ::memcpy(&info.keyMode, iov[13].iov_base, sizeof(unsigned short));
+    info.keyMode = be16toh(info.keyMode);
+    info.keys.resize(iov[14].iov_len / sizeof(unsigned int));
+    for (size_t i = 0; i < info.keys.size(); ++i) {
+        ::memcpy(
+            &info.keys[i],
+            (const unsigned char *) iov[14].iov_base + i * sizeof(unsigned int),
+            sizeof(unsigned int));
+        info.keys[i] = be32toh(info.keys[i]);
+    }
+    info.base = (const char *) iov[15].iov_base;
+    info.sources.resize(iov[16].iov_len / sizeof(unsigned int));
+    for (size_t i = 0; i < info.sources.size(); ++i) {
+        ::memcpy(
+            &info.sources[i],
+            (const unsigned char *) iov[16].iov_base + i * sizeof(unsigned int),
+            sizeof(unsigned int));
+        info.sources[i] = be32toh(info.sources[i]);
+    }
+    int count = (iovcnt - FIXED_FIELDS) / 4;
     info.fields.clear();
     for (int i = 0; i < count; ++i) {
+        struct iovec *fiov = iov + FIXED_FIELDS + i * 4;
         FieldInfo field;
-        field.name = (const char *) iov[8 + i * 4].iov_base;
-        ::memcpy(
-            &field.index,
-            iov[8 + i * 4 + 1].iov_base,
-            sizeof(unsigned long long));
+        field.name = (const char *) fiov[0].iov_base;
+        ::memcpy(&field.index, fiov[1].iov_base, sizeof(unsigned long long));
         field.index = be64toh(field.index);
-        ::memcpy(&field.length, iov[8 + i * 4 + 2].iov_base, sizeof(long long));
+        ::memcpy(&field.length, fiov[2].iov_base, sizeof(long long));
         field.length = be64toh(field.length);
-        field.fieldType=(const char *) iov[8 + i * 4 + 3].iov_base;
+        field.fieldType = (const char *) fiov[3].iov_base;
         field.type = findDataType(field.fieldType.c_str());
 
         info.fields.push_back(field);
@@ -11,10 +11,20 @@ namespace db {
 Table::Table()
     : relationInfo(NULL)
     , DataBlockCnt(0)
+    , deleteMode(DELETE_MODE_EAGER)
+    , stopping_(false)
 {
     buffer_ = (unsigned char *) malloc(Block::BLOCK_SIZE);
 }
-Table::~Table() { free(buffer_); }
+Table::~Table()
+{
+    stopCompactor();
+    for (std::map<std::string, Table *>::iterator it = secondaries_.begin();
+         it != secondaries_.end();
+         ++it)
+        delete it->second;
+    free(buffer_);
+}
 
 int Table::create(const char *name, RelationInfo &info)
 {
@@ -32,19 +42,54 @@ int Table::open(const char *name)
     unsigned int key = relationInfo->key;
     if (relationInfo->fields[key].type == NULL)
         relationInfo->fields[key].type =
-            findDataType(relationInfo->fields[0].fieldType.c_str());
+            findDataType(relationInfo->fields[key].fieldType.c_str());
+    // 选定特化的查找排序
+    relationInfo->fields[key].search =
+        findKeySearch(relationInfo->fields[key].type);
+    // 组合键各列，makeKey时normalize
+    for (size_t i = 0; i < relationInfo->keys.size(); i++) {
+        FieldInfo &column = relationInfo->fields[relationInfo->keys[i]];
+        if (column.type == NULL)
+            column.type = findDataType(column.fieldType.c_str());
+    }
     //索引
-    index_.open(name);
+    int ret = index_.open(name);
+    if (ret) return ret;
+    name_ = name;
+
+    //二级索引
+    std::vector<std::string> names;
+    gschema.indexesOf(name, names);
+    for (size_t i = 0; i < names.size(); i++) {
+        if (secondaries_.count(names[i])) continue;
+        Table *secondary = new Table;
+        secondary->open(names[i].c_str());
+        secondaries_[names[i]] = secondary;
+    }
 
     return S_OK;
 }
 void Table::close(const char *name)
 {
+    stopCompactor();
+    checkpoint();
     relationInfo->dataFile.close();
     index_.close(name);
+    for (std::map<std::string, Table *>::iterator it = secondaries_.begin();
+         it != secondaries_.end();
+         ++it)
+        it->second->close(it->first.c_str());
 }
 int Table::destroy(const char *dataPath, const char *indexPath)
 {
+    for (std::map<std::string, Table *>::iterator it = secondaries_.begin();
+         it != secondaries_.end();
+         ++it) {
+        RelationInfo *info = it->second->relationInfo;
+        int ret = it->second->destroy(
+            info->dataPath.c_str(), info->indexPath.c_str());
+        if (ret) return ret;
+    }
     int ret = index_.destroy(indexPath);
     if (ret) return ret;
     ret = relationInfo->dataFile.remove(dataPath);
@@ -84,77 +129,159 @@ int Table::initial()
     }
     ret = index_.initial();
     if (ret) return ret;
+    //第一次打开时加载统计信息，旧文件没有就扫描一遍
+    if (relationInfo->height == 0) {
+        unsigned char rb[Root::ROOT_SIZE];
+        relationInfo->dataFile.read(0, (char *) rb, Root::ROOT_SIZE);
+        Root root;
+        root.attach(rb);
+        if (!loadStats(root)) {
+            ret = rebuildStats();
+            if (ret) return ret;
+        }
+    }
     return S_OK;
 }
+//记录及slot在叶子中占用的字节数，同DataBlock::allocate
+static inline unsigned long long footprint(size_t length)
+{
+    return (length + Record::ALIGN_SIZE - 1) / Record::ALIGN_SIZE *
+               Record::ALIGN_SIZE +
+           2;
+}
+//block中第一条或最后一条有效记录的键值，没有时返回false
+static bool
+liveKey(DataBlock &block, bool first, unsigned int key, std::string &out)
+{
+    int slotsNum = block.getSlotsNum();
+    for (int i = 0; i < slotsNum; i++) {
+        Record record;
+        record.attach(
+            block.getBuffer() + block.getSlot(first ? i : slotsNum - 1 - i),
+            Block::BLOCK_SIZE);
+        if (record.isTombstone()) continue;
+        struct iovec field;
+        record.specialRef(field, key);
+        out.assign((const char *) field.iov_base, field.iov_len);
+        return true;
+    }
+    return false;
+}
+//slots[begin, end)中有效记录的行数和占用字节数，累加到rows、bytes
+static void liveRange(
+    DataBlock &block,
+    unsigned short begin,
+    unsigned short end,
+    unsigned long long &rows,
+    unsigned long long &bytes)
+{
+    for (unsigned short i = begin; i < end; i++) {
+        Record record;
+        record.attach(block.getBuffer() + block.getSlot(i), Block::BLOCK_SIZE);
+        if (record.isTombstone()) continue;
+        rows++;
+        bytes += footprint(record.length());
+    }
+}
+//第index条记录和前一条记录的键值是否相同
+static bool
+sameKey(DataBlock &block, unsigned short index, DataType *type, unsigned int key)
+{
+    Record prev, record;
+    prev.attach(block.getBuffer() + block.getSlot(index - 1), Block::BLOCK_SIZE);
+    record.attach(block.getBuffer() + block.getSlot(index), Block::BLOCK_SIZE);
+    struct iovec x, y;
+    prev.specialRef(x, key);
+    record.specialRef(y, key);
+    return type->compare3(x.iov_base, y.iov_base, x.iov_len, y.iov_len) == 0;
+}
 int Table::splitDataBlock(int blockid, int &newid, struct iovec *field)
 {
     unsigned int key = relationInfo->key;
 
-    //原block
+    //原block，前半部分原地保留
     int nextid;
     DataBlock block;
     readDataBlock(blockid);
     block.attach(buffer_);
     nextid = block.getNextid();
+    //不到两条记录分不开，由调用方另外处理
+    unsigned short slotsNum = block.getSlotsNum();
+    if (slotsNum < 2) return S_FALSE;
 
     //分裂的新block
-    DataBlock newBlock1, newBlock2;
-    unsigned char db1[Block::BLOCK_SIZE];
-    unsigned char db2[Block::BLOCK_SIZE];
-    newBlock1.attach(db1);
-    newBlock1.clear(blockid);
-    newid = ++DataBlockCnt;
-    newBlock1.setNextid(newid);
-    newBlock2.attach(db2);
-    newBlock2.clear(newid);
-    newBlock2.setNextid(nextid);
-
-    unsigned short slotsNum = block.getSlotsNum();
-    for (unsigned short index = 0; index < slotsNum / 2; index++) {
-        unsigned short recOffset = block.getSlot(index);
-        Record record;
-        record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-        // 先分配iovec
-        size_t fields = record.fields();
-        struct iovec *iov = (struct iovec *) malloc(sizeof(iovec) * fields);
-        unsigned char header;
-        // 从记录得到iovec
-        record.ref(iov, (int) fields, &header);
+    DataBlock newBlock;
+    unsigned char db[Block::BLOCK_SIZE];
+    newid = allocDataBlock();
+    newBlock.attach(db);
+    newBlock.clear(newid);
+    newBlock.setNextid(nextid);
 
-        newBlock1.allocate(&header, iov, (int) fields);
-        free(iov);
+    //按分裂点切分，两边至少各保留一个slot，split在[1, slotsNum)
+    unsigned short split =
+        (unsigned short) (slotsNum * relationInfo->splitRatio / 100);
+    if (split == 0) split = 1;
+    if (split >= slotsNum) split = slotsNum - 1;
+    //相同键值留在同一个block，先向后再向前找键值变化的位置
+    DataType *type = relationInfo->fields[key].type;
+    unsigned short boundary = split;
+    while (boundary < slotsNum && sameKey(block, boundary, type, key))
+        boundary++;
+    if (boundary == slotsNum) {
+        boundary = split;
+        while (boundary > 1 && sameKey(block, boundary, type, key))
+            boundary--;
     }
+    if (boundary < slotsNum && !sameKey(block, boundary, type, key))
+        split = boundary;
 
-    for (unsigned short index = slotsNum / 2; index < slotsNum; index++) {
+    //分裂点之后按字节复制到新block
+    for (unsigned short index = split; index < slotsNum; index++) {
         unsigned short recOffset = block.getSlot(index);
         Record record;
         record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
+        // 保留最后一条记录，保证新block至少有一个键值
+        if (record.isTombstone() &&
+            (index < slotsNum - 1 || newBlock.getSlotsNum() > 0))
+            continue;
 
-        // 先分配iovec
-        size_t fields = record.fields();
-        struct iovec *iov = (struct iovec *) malloc(sizeof(iovec) * fields);
-        unsigned char header;
-        // 从记录得到iovec
-        int ret = record.ref(iov, (int) fields, &header);
-        if (!ret) return S_FALSE;
         //新block的第一个key字段
-        if (index == slotsNum / 2) {
-            field->iov_base = malloc(iov[key].iov_len);
-            ::memcpy(field->iov_base, iov[key].iov_base, iov[key].iov_len);
-            field->iov_len = iov[key].iov_len;
+        if (newBlock.getSlotsNum() == 0) {
+            struct iovec keyField;
+            record.specialRef(keyField, key);
+            field->iov_base = malloc(keyField.iov_len);
+            ::memcpy(field->iov_base, keyField.iov_base, keyField.iov_len);
+            field->iov_len = keyField.iov_len;
         }
 
-        newBlock2.allocate(&header, iov, (int) fields);
-        free(iov);
+        if (!newBlock.copyRecord(buffer_ + recOffset)) return S_FALSE;
     }
+    newBlock.setChecksum();
 
-    //写block
-    size_t offset;
-    offset = (newBlock1.blockid() - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-    relationInfo->dataFile.write(offset, (const char *) db1, Block::BLOCK_SIZE);
+    //父节点只需要能分开两边的最短键值，截短新block的第一个键值
+    if (type->separate) {
+        Record record;
+        record.attach(buffer_ + block.getSlot(split - 1), Block::BLOCK_SIZE);
+        struct iovec lastField;
+        record.specialRef(lastField, key);
+        field->iov_len = type->separate(
+            field->iov_base,
+            lastField.iov_base,
+            field->iov_base,
+            lastField.iov_len,
+            field->iov_len);
+    }
 
-    offset = (newBlock2.blockid() - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-    relationInfo->dataFile.write(offset, (const char *) db2, Block::BLOCK_SIZE);
+    //截掉分裂点之后的部分，rewrite时顺便丢弃tombstone记录
+    block.setSlotsNum(split);
+    block.rewrite();
+    block.setNextid(newid);
+    block.setChecksum();
+
+    //写block
+    writeDataBlock(blockid);
+    size_t offset = (newid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+    relationInfo->dataFile.write(offset, (const char *) db, Block::BLOCK_SIZE);
 
     //更新root
     int ret = writeRoot();
@@ -186,54 +313,80 @@ int Table::combineDataBlock(
         unsigned short recOffset = comBlock.getSlot(index);
         Record record;
         record.attach(db + recOffset, Block::BLOCK_SIZE);
-        // 先分配iovec
-        size_t fields = record.fields();
-        struct iovec *iov = (struct iovec *) malloc(sizeof(iovec) * fields);
-        unsigned char header;
-        // 从记录得到iovec
-        record.ref(iov, (int) fields, &header);
 
         //得到删除block的第一个字段
         if (index == 0) {
-            field->iov_base = malloc(iov[key].iov_len);
-            ::memcpy(field->iov_base, iov[key].iov_base, iov[key].iov_len);
-            field->iov_len = iov[key].iov_len;
+            struct iovec keyField;
+            record.specialRef(keyField, key);
+            field->iov_base = malloc(keyField.iov_len);
+            ::memcpy(field->iov_base, keyField.iov_base, keyField.iov_len);
+            field->iov_len = keyField.iov_len;
         }
+        // 合并时顺便丢弃tombstone记录
+        if (record.isTombstone()) continue;
 
-        int ret = block.allocate(&header, iov, (int) fields);
-        if (!ret) return S_FALSE;
-        free(iov);
+        // comblock是block的后继，键值都更大，按序追加slot不用再排序
+        if (!block.copyRecord(db + recOffset)) return S_FALSE;
     }
 
-    // 排序
-    std::vector<unsigned short> slotsv;
-    for (int i = 0; i < block.getSlotsNum(); i++)
-        slotsv.push_back(block.getSlot(i));
-    if (relationInfo->fields[key].type == NULL)
-        relationInfo->fields[key].type =
-            findDataType(relationInfo->fields[key].fieldType.c_str());
-    Compare cmp(relationInfo->fields[key], key, *this);
-    std::sort(slotsv.begin(), slotsv.end(), cmp);
-    for (int i = 0; i < block.getSlotsNum(); i++)
-        block.setSlot(i, slotsv[i]);
-
-    //调整nextid
-    if (isRight) {
-        block.setNextid(comBlock.getNextid());
-        writeDataBlock(blockid);
-    } else {
-        writeDataBlock(blockid);
-        DataBlock prepreBlock;
-        auto bit = blockBegin();
-        for (; bit != blockEnd(); ++bit) {
-            prepreBlock = *bit;
-            if (prepreBlock.getNextid() == comblockid) break;
-        }
-        if (bit == blockEnd()) return S_FALSE;
+    //调整nextid，无论isRight，comblock总是block在叶子链上的后继
+    block.setNextid(comBlock.getNextid());
+    block.setChecksum();
+    writeDataBlock(blockid);
+    return S_OK;
+}
+int Table::allocDataBlock()
+{
+    unsigned char rb[Root::ROOT_SIZE];
+    relationInfo->dataFile.read(0, (char *) rb, Root::ROOT_SIZE);
+    Root root;
+    root.attach(rb);
+    int garbage = root.getGarbage();
+    relationInfo->leafBlocks++;
+    relationInfo->statsDirty = true;
+    if (garbage <= 0) return ++DataBlockCnt;
 
-        prepreBlock.setNextid(blockid);
-        writeDataBlock(prepreBlock.blockid());
-    }
+    //从空闲链头取一个block
+    unsigned char db[Block::BLOCK_SIZE];
+    size_t offset = (garbage - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+    relationInfo->dataFile.read(offset, (char *) db, Block::BLOCK_SIZE);
+    DataBlock block;
+    block.attach(db);
+    root.setGarbage(block.getNextid());
+    relationInfo->dataFile.write(0, (const char *) rb, Root::ROOT_SIZE);
+    return garbage;
+}
+int Table::freeDataBlock(int blockid)
+{
+    unsigned char rb[Root::ROOT_SIZE];
+    relationInfo->dataFile.read(0, (char *) rb, Root::ROOT_SIZE);
+    Root root;
+    root.attach(rb);
+
+    //清空后挂到空闲链头
+    unsigned char db[Block::BLOCK_SIZE];
+    DataBlock block;
+    block.attach(db);
+    block.clear(blockid);
+    block.setNextid(root.getGarbage());
+    size_t offset = (blockid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+    relationInfo->dataFile.write(offset, (const char *) db, Block::BLOCK_SIZE);
+    root.setGarbage(blockid);
+    relationInfo->dataFile.write(0, (const char *) rb, Root::ROOT_SIZE);
+    relationInfo->leafBlocks--;
+    relationInfo->statsDirty = true;
+    return S_OK;
+}
+int Table::linkDataBlock(int blockid, int nextid)
+{
+    unsigned char db[Block::BLOCK_SIZE];
+    DataBlock block;
+    block.attach(db);
+    size_t offset = (blockid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+    relationInfo->dataFile.read(offset, (char *) db, Block::BLOCK_SIZE);
+    block.setNextid(nextid);
+    block.setChecksum();
+    relationInfo->dataFile.write(offset, (const char *) db, Block::BLOCK_SIZE);
     return S_OK;
 }
 int Table::blockid()
@@ -276,19 +429,342 @@ int Table::writeRoot()
     Root root;
     root.attach(buffer_);
     root.setCnt(DataBlockCnt);
+    saveStats(root);
     relationInfo->dataFile.write(0, (const char *) buffer_, Root::ROOT_SIZE);
     return S_OK;
 }
+size_t Table::makeKey(
+    struct iovec *columns,
+    int count,
+    unsigned char *key,
+    size_t size)
+{
+    if (count > (int) relationInfo->keys.size()) return 0;
+    size_t length = 0;
+    for (int i = 0; i < count; i++) {
+        // normalize的输出最多比输入长1B
+        if (length + columns[i].iov_len + 1 > size) return 0;
+        DataType *type = relationInfo->fields[relationInfo->keys[i]].type;
+        length += type->normalize(
+            key + length, columns[i].iov_base, columns[i].iov_len);
+    }
+    return length;
+}
+struct iovec *Table::withKey(
+    struct iovec *record,
+    int &iovcnt,
+    std::vector<struct iovec> &full,
+    std::vector<unsigned char> &key)
+{
+    std::vector<unsigned int> &keys = relationInfo->keys;
+    if (keys.empty()) return record;
+    if (iovcnt + 1 != relationInfo->count) return NULL;
+
+    std::vector<struct iovec> columns(keys.size());
+    size_t size = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        columns[i] = record[keys[i]];
+        size += columns[i].iov_len + 1;
+    }
+    key.resize(size);
+    full.assign(record, record + iovcnt);
+    struct iovec field;
+    field.iov_base = &key[0];
+    field.iov_len = makeKey(&columns[0], (int) keys.size(), &key[0], size);
+    full.push_back(field);
+    iovcnt++;
+    return &full[0];
+}
+//从所在表的一条完整记录row取出二级索引的一行
+static void indexEntry(
+    RelationInfo *info,
+    struct iovec *row,
+    std::vector<struct iovec> &entry)
+{
+    entry.resize(info->sources.size());
+    for (size_t i = 0; i < info->sources.size(); i++)
+        entry[i] = row[info->sources[i]];
+}
+int Table::createIndex(
+    const char *index,
+    const unsigned int *columns,
+    int count,
+    RelationInfo &info,
+    const unsigned int *included,
+    int includedCount)
+{
+    std::lock_guard<std::recursive_mutex> guard(latch_);
+    int ret = initial();
+    if (ret) return ret;
+    //主键要唯一，索引条目才能定位到记录
+    if (count <= 0 || includedCount < 0 ||
+        relationInfo->keyMode != KEY_MODE_UNIQUE)
+        return EINVAL;
+
+    //各列之后是主键，全部作为组合键，相同的列值按主键排列；
+    //included列跟在主键之后，不参与比较
+    info.fields.clear();
+    info.sources.clear();
+    info.keys.clear();
+    int total = count + 1 + includedCount;
+    for (int i = 0; i < total; i++) {
+        unsigned int column;
+        if (i < count)
+            column = columns[i];
+        else if (i == count)
+            column = relationInfo->key;
+        else
+            column = included[i - count - 1];
+        if (column >= relationInfo->count) return EINVAL;
+        FieldInfo field(relationInfo->fields[column]);
+        field.index = i;
+        field.type = NULL;
+        field.search = NULL;
+        info.fields.push_back(field);
+        info.sources.push_back(column);
+        if (i <= count) info.keys.push_back(i);
+    }
+    info.count = (unsigned short) total;
+    info.key = 0;
+    info.keyMode = KEY_MODE_UNIQUE;
+    info.base = name_;
+    ret = gschema.create(index, info);
+    if (ret) return ret;
+
+    Table *secondary = new Table;
+    ret = secondary->open(index);
+    if (ret) {
+        delete secondary;
+        return ret;
+    }
+    secondaries_[index] = secondary;
+
+    //补进已有的记录
+    unsigned char header = 0;
+    std::vector<struct iovec> row(relationInfo->count);
+    std::vector<struct iovec> entry;
+    for (blockIter it1 = blockBegin(); it1 != blockEnd(); ++it1) {
+        for (iterator it2 = begin(it1); it2 != end(it1); ++it2) {
+            unsigned char h;
+            (*it2).ref(&row[0], relationInfo->count, &h);
+            indexEntry(secondary->relationInfo, &row[0], entry);
+            ret = secondary->insert(&header, &entry[0], (int) entry.size());
+            if (ret) return ret;
+        }
+    }
+    return S_OK;
+}
+int Table::get(struct iovec keyField, std::string &row)
+{
+    std::lock_guard<std::recursive_mutex> guard(latch_);
+    int ret = initial();
+    if (ret) return ret;
+    std::stack<int> path;
+    readDataBlock(index_.sraech(keyField, path));
+    DataBlock data;
+    data.attach(buffer_);
+    int index = data.findLive(&keyField, relationInfo);
+    if (index == -1) return S_FALSE;
+    Record record;
+    record.attach(buffer_ + data.getSlot(index), Block::BLOCK_SIZE);
+    row.assign(
+        (const char *) buffer_ + data.getSlot(index), record.length());
+    return S_OK;
+}
+int Table::indexColumn(const char *index, unsigned int column)
+{
+    std::map<std::string, Table *>::iterator it = secondaries_.find(index);
+    if (it == secondaries_.end()) return -1;
+    std::vector<unsigned int> &sources = it->second->relationInfo->sources;
+    for (size_t i = 0; i < sources.size(); i++)
+        if (sources[i] == column) return (int) i;
+    return -1;
+}
+int Table::lookupIndex(
+    const char *index,
+    struct iovec *columns,
+    int count,
+    std::vector<std::string> &entries)
+{
+    std::lock_guard<std::recursive_mutex> guard(latch_);
+    entries.clear();
+    std::map<std::string, Table *>::iterator it = secondaries_.find(index);
+    if (it == secondaries_.end()) return EINVAL;
+    Table *secondary = it->second;
+    RelationInfo *info = secondary->relationInfo;
+    if (count <= 0 || count >= (int) info->keys.size()) return EINVAL;
+
+    //索引列的前缀
+    size_t size = 0;
+    for (int i = 0; i < count; i++)
+        size += columns[i].iov_len + 1;
+    std::string prefix(size, '\0');
+    prefix.resize(secondary->makeKey(
+        columns, count, (unsigned char *) &prefix[0], prefix.size()));
+    struct iovec prefixField;
+    prefixField.iov_base = (void *) prefix.data();
+    prefixField.iov_len = prefix.size();
+
+    //顺序读出前缀相同的条目
+    bool done = false;
+    for (blockIter it1 = secondary->seekBlock(prefixField);
+         !done && it1 != secondary->blockEnd();
+         ++it1) {
+        iterator it2 = secondary->seek(it1, prefixField);
+        for (; it2 != secondary->end(it1); ++it2) {
+            struct iovec field;
+            (*it2).specialRef(field, info->key);
+            if (field.iov_len < prefix.size() ||
+                memcmp(field.iov_base, prefix.data(), prefix.size()) != 0) {
+                done = true;
+                break;
+            }
+            Record &record = *it2;
+            entries.push_back(std::string(
+                (const char *) record.getBuffer(), record.length()));
+        }
+    }
+    return S_OK;
+}
+int Table::lookup(
+    const char *index,
+    struct iovec *columns,
+    int count,
+    std::vector<std::string> &rows)
+{
+    std::lock_guard<std::recursive_mutex> guard(latch_);
+    rows.clear();
+    std::vector<std::string> entries;
+    int ret = lookupIndex(index, columns, count, entries);
+    if (ret) return ret;
+
+    //回表，组合键各列之后是主键
+    RelationInfo *info = secondaries_[index]->relationInfo;
+    unsigned int primary = (unsigned int) info->keys.size() - 1;
+    for (size_t i = 0; i < entries.size(); i++) {
+        Record entry;
+        entry.attach(
+            (unsigned char *) &entries[i][0],
+            (unsigned short) entries[i].size());
+        struct iovec keyField;
+        entry.specialRef(keyField, primary);
+        std::string row;
+        int ret = get(keyField, row);
+        if (ret == S_FALSE) continue;
+        if (ret) return ret;
+        rows.push_back(row);
+    }
+    return S_OK;
+}
+void Table::indexKeys(struct iovec *row, std::vector<std::string> &keys)
+{
+    keys.clear();
+    for (std::map<std::string, Table *>::iterator it = secondaries_.begin();
+         it != secondaries_.end();
+         ++it) {
+        Table *secondary = it->second;
+        std::vector<struct iovec> entry;
+        indexEntry(secondary->relationInfo, row, entry);
+        int count = (int) secondary->relationInfo->keys.size();
+        size_t size = 0;
+        for (int i = 0; i < count; i++)
+            size += entry[i].iov_len + 1;
+        std::string key(size, '\0');
+        key.resize(secondary->makeKey(
+            &entry[0], count, (unsigned char *) &key[0], size));
+        keys.push_back(key);
+    }
+}
+void Table::recordKeys(
+    DataBlock &data,
+    int index,
+    std::vector<std::string> &keys)
+{
+    keys.clear();
+    if (secondaries_.empty()) return;
+    Record record;
+    record.attach(data.getBuffer() + data.getSlot(index), Block::BLOCK_SIZE);
+    std::vector<struct iovec> row(relationInfo->count);
+    unsigned char header;
+    record.ref(&row[0], relationInfo->count, &header);
+    indexKeys(&row[0], keys);
+}
+int Table::currentKeys(struct iovec keyField, std::vector<std::string> &keys)
+{
+    keys.clear();
+    if (secondaries_.empty()) return S_OK;
+    std::stack<int> path;
+    readDataBlock(index_.sraech(keyField, path));
+    DataBlock data;
+    data.attach(buffer_);
+    int index = data.findLive(&keyField, relationInfo);
+    if (index != -1) recordKeys(data, index, keys);
+    return S_OK;
+}
+int Table::updateIndexes(std::vector<std::string> &old, struct iovec *row)
+{
+    if (secondaries_.empty()) return S_OK;
+    std::vector<std::string> keys;
+    if (row) indexKeys(row, keys);
+    unsigned char header = 0;
+    size_t i = 0;
+    for (std::map<std::string, Table *>::iterator it = secondaries_.begin();
+         it != secondaries_.end();
+         ++it, ++i) {
+        Table *secondary = it->second;
+        RelationInfo *info = secondary->relationInfo;
+        std::vector<struct iovec> entry;
+        if (row) indexEntry(info, row, entry);
+        int ret;
+        //索引列没有变化，只需要刷新included列
+        if (!old.empty() && row && old[i] == keys[i]) {
+            if (info->sources.size() == info->keys.size()) continue;
+            ret = secondary->upsert(&header, &entry[0], (int) entry.size());
+            if (ret) return ret;
+            continue;
+        }
+        if (!old.empty()) {
+            struct iovec keyField;
+            keyField.iov_base = (void *) old[i].data();
+            keyField.iov_len = old[i].size();
+            ret = secondary->remove(keyField);
+            if (ret) return ret;
+        }
+        if (row) {
+            ret = secondary->insert(&header, &entry[0], (int) entry.size());
+            if (ret) return ret;
+        }
+    }
+    return S_OK;
+}
 int Table::insert(const unsigned char *header, struct iovec *record, int iovcnt)
 {
+    return put(header, record, iovcnt, false);
+}
+int Table::upsert(const unsigned char *header, struct iovec *record, int iovcnt)
+{
+    return put(header, record, iovcnt, true);
+}
+int Table::put(
+    const unsigned char *header,
+    struct iovec *record,
+    int iovcnt,
+    bool replace)
+{
+    std::lock_guard<std::recursive_mutex> guard(latch_);
     //打开block
-    bool ret = initial();
+    int ret = initial();
     if (ret) return ret;
+    std::vector<struct iovec> full;
+    std::vector<unsigned char> composite;
+    record = withKey(record, iovcnt, full, composite);
+    if (record == NULL) return EINVAL;
     unsigned int key = relationInfo->key;
     iovec &keyField = record[key];
     DataBlock data;
-
-    // TODO:检查是否重复插入
+    //新记录总是有效的，tombstone位由删除设置
+    unsigned char live = *header & ~Record::MASK_TOMBSTONE;
+    header = &live;
 
     //路径
     std::stack<int> path;
@@ -298,61 +774,293 @@ int Table::insert(const unsigned char *header, struct iovec *record, int iovcnt)
     readDataBlock(insertid);
     data.attach(buffer_);
 
-    //插入
-    ret = data.allocate(header, record, iovcnt);
+    //在同一个叶子里二分查重，不需要再下降一次
+    if (replace || relationInfo->keyMode == KEY_MODE_UNIQUE) {
+        int index = data.findLive(&keyField, relationInfo);
+        if (index != -1) {
+            if (!replace) return EEXIST; //重复插入
+            std::vector<std::string> old;
+            recordKeys(data, index, old);
+            ret = replaceRecord(data, index, header, record, iovcnt, path);
+            if (ret) return ret;
+            return updateIndexes(old, record);
+        }
+    }
+
+    //插入，超过填充因子时当作已满，留出余量
+    std::pair<size_t, size_t> size =
+        Record::size(record, iovcnt, Record::FORMAT_FIXED);
+    bool done;
+    if (data.getSlotsNum() > 1 &&
+        data.getUsedspace() + (int) size.first + 2 >
+            leafBytes(relationInfo->fillFactor))
+        done = false;
+    else
+        done = data.allocate(header, record, iovcnt);
 
     //插入失败则分裂
-    if (!ret) {
-        struct iovec field;
-        int newid;
-        splitDataBlock(data.blockid(), newid, &field); //分裂
-
-        //判断插入的block的位置
-        if (relationInfo->fields[key].type->compare(
-                keyField.iov_base,
-                field.iov_base,
-                keyField.iov_len,
-                field.iov_len))
-            insertid = insertid;
-        else
-            insertid = newid;
-        readDataBlock(insertid);
-        data.attach(buffer_);
-        ret = data.allocate(header, record, iovcnt);
-        if (!ret) return S_FALSE;
-
-        //更新b+tree
-        ret = index_.insert(field, newid, path);
-        if (ret) return ret;
+    if (!done)
+        ret = splitInsert(insertid, header, record, iovcnt, path);
+    else {
+        // 排序
+        FieldInfo &keyInfo = relationInfo->fields[key];
+        keyInfo.search->sort(data, keyInfo.type, key);
+
+        // 处理checksum
+        data.setChecksum();
+
+        //写block
+        ret = writeDataBlock(insertid);
     }
+    if (ret) return ret;
+    countInsert(keyField, footprint(size.first));
+    std::vector<std::string> old;
+    return updateIndexes(old, record);
+}
+int Table::spillInsert(
+    int blockid,
+    const unsigned char *header,
+    struct iovec *record,
+    int iovcnt,
+    std::stack<int> &path)
+{
+    unsigned int key = relationInfo->key;
+    DataType *type = relationInfo->fields[key].type;
+    iovec &keyField = record[key];
 
-    // TODO:更新schema
+    //一个空block也放不下
+    std::pair<size_t, size_t> size =
+        Record::size(record, iovcnt, Record::FORMAT_FIXED);
+    if (footprint(size.first) > (size_t) DataBlock::INITIAL_FREE_SPACE_SIZE)
+        return S_FALSE;
 
-    // 排序
-    std::vector<unsigned short> slotsv;
-    for (int i = 0; i < data.getSlotsNum(); i++)
-        slotsv.push_back(data.getSlot(i));
-    if (relationInfo->fields[key].type == NULL)
-        relationInfo->fields[key].type =
-            findDataType(relationInfo->fields[key].fieldType.c_str());
-    Compare cmp(relationInfo->fields[key], key, *this);
-    std::sort(slotsv.begin(), slotsv.end(), cmp);
-    for (int i = 0; i < data.getSlotsNum(); i++)
-        data.setSlot(i, slotsv[i]);
+    DataBlock data;
+    readDataBlock(blockid);
+    data.attach(buffer_);
+    //没有有效记录，整理后就放得下
+    std::string old;
+    if (data.getSlotsNum() == 1) {
+        unsigned char *rb = buffer_ + data.getSlot(0);
+        Record only;
+        only.attach(rb, Block::BLOCK_SIZE);
+        //copyRecord按ALIGN_SIZE对齐复制，连padding一起保存
+        if (!only.isTombstone())
+            old.assign(
+                (const char *) rb,
+                (only.length() + Record::ALIGN_SIZE - 1) / Record::ALIGN_SIZE *
+                    Record::ALIGN_SIZE);
+    }
+    if (old.empty()) {
+        data.rewrite();
+        if (!data.allocate(header, record, iovcnt)) return S_FALSE;
+        data.setChecksum();
+        return writeDataBlock(blockid);
+    }
 
-    // 处理checksum
+    //键值小的留在blockid，大的放到接在后面的新block
+    Record oldRecord;
+    oldRecord.attach((unsigned char *) &old[0], (unsigned short) old.size());
+    struct iovec oldKey;
+    oldRecord.specialRef(oldKey, key);
+    bool before = type->compare(
+        keyField.iov_base, oldKey.iov_base, keyField.iov_len, oldKey.iov_len);
+    int nextid = data.getNextid();
+    int newid = allocDataBlock();
+    unsigned char db[Block::BLOCK_SIZE];
+    DataBlock fresh;
+    fresh.attach(db);
+    fresh.clear(newid);
+    fresh.setNextid(nextid);
+    readDataBlock(blockid);
+    data.clear(blockid);
+    data.setNextid(newid);
+    struct iovec field;
+    if (before) {
+        fresh.copyRecord((unsigned char *) &old[0]);
+        data.allocate(header, record, iovcnt);
+        field = oldKey;
+    } else {
+        data.copyRecord((unsigned char *) &old[0]);
+        fresh.allocate(header, record, iovcnt);
+        field = keyField;
+    }
+    fresh.setChecksum();
     data.setChecksum();
+    size_t offset = (newid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+    relationInfo->dataFile.write(offset, (const char *) db, Block::BLOCK_SIZE);
+    int ret = writeDataBlock(blockid);
+    if (ret) return ret;
+    ret = writeRoot();
+    if (ret) return ret;
 
-    //写block
-    ret = writeDataBlock(insertid);
+    //新block的第一个键值插入父节点，insert可能改写field
+    struct iovec copy;
+    copy.iov_base = malloc(field.iov_len);
+    ::memcpy(copy.iov_base, field.iov_base, field.iov_len);
+    copy.iov_len = field.iov_len;
+    ret = index_.insert(copy, newid, path);
+    free(copy.iov_base);
+    return ret;
+}
+int Table::splitInsert(
+    int blockid,
+    const unsigned char *header,
+    struct iovec *record,
+    int iovcnt,
+    std::stack<int> &path)
+{
+    unsigned int key = relationInfo->key;
+    iovec &keyField = record[key];
+    struct iovec field;
+    int newid;
+    //两边至少各留一条记录才能分裂
+    DataBlock block;
+    readDataBlock(blockid);
+    block.attach(buffer_);
+    if (block.getSlotsNum() < 2)
+        return spillInsert(blockid, header, record, iovcnt, path);
+    int ret = splitDataBlock(blockid, newid, &field); //分裂
+    if (ret) return ret;
+
+    //判断插入的block的位置
+    int insertid = relationInfo->fields[key].type->compare(
+                       keyField.iov_base,
+                       field.iov_base,
+                       keyField.iov_len,
+                       field.iov_len)
+                       ? blockid
+                       : newid;
+    //更新b+tree，field可能被改写
+    ret = index_.insert(field, newid, path);
+    free(field.iov_base);
     if (ret) return ret;
+
+    DataBlock data;
+    readDataBlock(insertid);
+    data.attach(buffer_);
+    if (!data.allocate(header, record, iovcnt)) return S_FALSE;
+
+    // 排序
+    FieldInfo &keyInfo = relationInfo->fields[key];
+    keyInfo.search->sort(data, keyInfo.type, key);
+    data.setChecksum();
+    return writeDataBlock(insertid);
+}
+int Table::update(
+    struct iovec keyField,
+    const unsigned char *header,
+    struct iovec *record,
+    int iovcnt)
+{
+    std::lock_guard<std::recursive_mutex> guard(latch_);
+    //打开block
+    int ret = initial();
+    if (ret) return ret;
+    //组合键的表keyField是makeKey得到的键值
+    std::vector<struct iovec> full;
+    std::vector<unsigned char> composite;
+    record = withKey(record, iovcnt, full, composite);
+    if (record == NULL) return EINVAL;
+    unsigned int key = relationInfo->key;
+    FieldInfo &keyInfo = relationInfo->fields[key];
+    //不能修改键值，需要时先remove再insert
+    if (keyInfo.type->compare3(
+            keyField.iov_base,
+            record[key].iov_base,
+            keyField.iov_len,
+            record[key].iov_len) != 0)
+        return EINVAL;
+    unsigned char live = *header & ~Record::MASK_TOMBSTONE;
+    header = &live;
+
+    //路径
+    std::stack<int> path;
+    //定位，目标位置的blockid
+    int targetid = index_.sraech(keyField, path);
+    readDataBlock(targetid);
+    DataBlock data;
+    data.attach(buffer_);
+    int index = data.findLive(&keyField, relationInfo);
+    if (index == -1) return S_FALSE; //记录不存在
+    std::vector<std::string> old;
+    recordKeys(data, index, old);
+    ret = replaceRecord(data, index, header, record, iovcnt, path);
+    if (ret) return ret;
+    return updateIndexes(old, record);
+}
+int Table::replaceRecord(
+    DataBlock &data,
+    int index,
+    const unsigned char *header,
+    struct iovec *record,
+    int iovcnt,
+    std::stack<int> &path)
+{
+    int blockid = (int) data.blockid();
+    size_t newLength = Record::size(record, iovcnt, Record::FORMAT_FIXED).first;
+    //一个空block也放不下，旧记录保持不动
+    if (footprint(newLength) > (size_t) DataBlock::INITIAL_FREE_SPACE_SIZE)
+        return S_FALSE;
+    //统计：行数不变，只调整字节数
+    Record old;
+    old.attach(data.getBuffer() + data.getSlot(index), Block::BLOCK_SIZE);
+    size_t oldLength = old.length();
+    int ret;
+    //本block内放得下，键值和slot顺序都不变，不用动索引
+    if (data.recReplace((unsigned short) index, header, record, iovcnt)) {
+        data.setChecksum();
+        ret = writeDataBlock(blockid);
+    } else {
+        //整个block都放不下，删掉旧记录后按插入的方式重新放置
+        data.recDelete(&record[relationInfo->key], relationInfo);
+        data.setChecksum();
+        ret = writeDataBlock(blockid);
+        if (ret) return ret;
+        //剩下不到两条记录时分不开，新记录放到新叶子
+        if (data.getSlotsNum() < 2)
+            ret = spillInsert(blockid, header, record, iovcnt, path);
+        else
+            ret = splitInsert(blockid, header, record, iovcnt, path);
+    }
+    if (ret) return ret;
+    relationInfo->size -= footprint(oldLength);
+    relationInfo->size += footprint(newLength);
+    relationInfo->statsDirty = true;
     return S_OK;
 }
+Table::blockIter Table::seekBlock(struct iovec keyField)
+{
+    std::lock_guard<std::recursive_mutex> guard(latch_);
+    if (initial()) return blockEnd();
+    std::stack<int> path;
+    return blockIter(index_.sraech(keyField, path), *this);
+}
+Table::iterator Table::seek(blockIter &blockIt, struct iovec keyField)
+{
+    unsigned int key = relationInfo->key;
+    FieldInfo &keyInfo = relationInfo->fields[key];
+    DataBlock &block = *blockIt;
+    unsigned short index =
+        block.lowerBound(&keyField, keyInfo.type, key, keyInfo.search);
+    return iterator(index, blockIt);
+}
 int Table::remove(struct iovec keyField)
 {
+    std::lock_guard<std::recursive_mutex> guard(latch_);
     //打开block
-    bool ret = initial();
+    int ret = initial();
+    if (ret) return ret;
+    //有二级索引时先取出旧记录的索引键值
+    std::vector<std::string> old;
+    ret = currentKeys(keyField, old);
     if (ret) return ret;
+    ret = removeRecord(keyField);
+    if (ret || old.empty()) return ret;
+    return updateIndexes(old, NULL);
+}
+int Table::removeRecord(struct iovec keyField)
+{
+    int ret;
     unsigned int key = relationInfo->key;
     DataBlock data;
 
@@ -364,16 +1072,32 @@ int Table::remove(struct iovec keyField)
     readDataBlock(targetid);
     data.attach(buffer_);
 
+    //统计
+    int live = data.findLive(&keyField, relationInfo);
+    if (live == -1) return S_OK; //记录不存在
+    Record victim;
+    victim.attach(buffer_ + data.getSlot(live), Block::BLOCK_SIZE);
+    countRemove(keyField, footprint(victim.length()));
+
+    //只设置tombstone，回收和合并推迟到rewrite
+    if (deleteMode == DELETE_MODE_TOMBSTONE) {
+        if (data.recTombstone(&keyField, relationInfo) == -1) return S_OK;
+        data.setChecksum();
+        return writeDataBlock(targetid);
+    }
+
     //删除
     int deleteIndex;
     deleteIndex = data.recDelete(&keyField, relationInfo);
+    if (deleteIndex == -1) return S_OK; //记录不存在
     writeDataBlock(targetid);
 
-    // 删除后结点填充度仍>=50%
-    if (data.getUsedspace() >= data.INITIAL_FREE_SPACE_SIZE / 3) {
+    // 删除后结点填充度仍不低于mergeRatio
+    if (data.getUsedspace() >= leafBytes(relationInfo->mergeRatio)) {
         //更新index
-        if (deleteIndex ==
-            0) //如果删除的记录是原本的第一条记录，那么blcok的最小键值发生了改变
+        if (deleteIndex == 0 &&
+            data.getSlotsNum() >
+                0) //如果删除的记录是原本的第一条记录，那么blcok的最小键值发生了改变
         {
             //获取删除后blcok的最小键值
             struct iovec updateField;
@@ -383,7 +1107,7 @@ int Table::remove(struct iovec keyField)
             record.specialRef(updateField, key);
 
             //更新父节点（IndexBlock）中指向这个DataBlock的右指针对应的键值
-            ret = index_.updata(path.top(), keyField, updateField, targetid);
+            ret = index_.updata(path.top(), updateField, targetid);
             if (ret) return ret;
         }
         return S_OK;
@@ -395,8 +1119,9 @@ int Table::remove(struct iovec keyField)
     //如果没有兄弟节点，则直接删除即可，无需其他合并、借操作
     if (brotherid == -1) {
         //更新index
-        if (deleteIndex ==
-            0) //如果删除的记录是原本的第一条记录，那么blcok的最小键值发生了改
+        if (deleteIndex == 0 &&
+            data.getSlotsNum() >
+                0) //如果删除的记录是原本的第一条记录，那么blcok的最小键值发生了改
         {
             //获取删除后blcok的最小键值
             struct iovec updateField;
@@ -406,7 +1131,7 @@ int Table::remove(struct iovec keyField)
             record.specialRef(updateField, key);
 
             //更新父节点（IndexBlock）中指向这个DataBlock的右指针对应的键值
-            ret = index_.updata(path.top(), keyField, updateField, targetid);
+            ret = index_.updata(path.top(), updateField, targetid);
             if (ret) return ret;
         }
         return S_OK;
@@ -419,8 +1144,10 @@ int Table::remove(struct iovec keyField)
     DataBlock brother;
     brother.attach(db);
 
-    // 兄弟结点填充度>50%,从兄弟节点借
-    if (brother.getUsedspace() > brother.INITIAL_FREE_SPACE_SIZE * 2 / 3) {
+    // 兄弟结点填充度高于borrowRatio，或者合并后放不下，从兄弟节点借
+    if (brother.getUsedspace() > leafBytes(relationInfo->borrowRatio) ||
+        brother.getUsedspace() + data.getUsedspace() >=
+            data.INITIAL_FREE_SPACE_SIZE) {
         if (isRight) //如果是右兄弟节点
         {
             unsigned short recOffset = brother.getSlot(0);
@@ -435,16 +1162,8 @@ int Table::remove(struct iovec keyField)
             data.allocate(&header, iov, (int) fields);
 
             // 排序
-            std::vector<unsigned short> slotsv;
-            for (int i = 0; i < data.getSlotsNum(); i++)
-                slotsv.push_back(data.getSlot(i));
-            if (relationInfo->fields[key].type == NULL)
-                relationInfo->fields[key].type =
-                    findDataType(relationInfo->fields[key].fieldType.c_str());
-            Compare cmp(relationInfo->fields[key], key, *this);
-            std::sort(slotsv.begin(), slotsv.end(), cmp);
-            for (int i = 0; i < data.getSlotsNum(); i++)
-                data.setSlot(i, slotsv[i]);
+            FieldInfo &keyInfo = relationInfo->fields[key];
+            keyInfo.search->sort(data, keyInfo.type, key);
 
             //删除兄弟节点所借的记录
             brother.recDelete(&iov[key], relationInfo);
@@ -459,7 +1178,7 @@ int Table::remove(struct iovec keyField)
             recOffset = brother.getSlot(0);
             record.attach(db + recOffset, Block::BLOCK_SIZE);
             record.specialRef(updateField, key);
-            ret = index_.updata(path.top(), iov[key], updateField, targetid);
+            ret = index_.updata(path.top(), updateField, brotherid);
             free(iov);
             if (ret) return ret;
         } else //如果是左兄弟节点
@@ -476,28 +1195,15 @@ int Table::remove(struct iovec keyField)
             record.ref(iov, (int) fields, &header);
 
             //更新父节点
-            struct iovec oldField;
-            Record rec;
-            recOffset = data.getSlot(0);
-            rec.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
-            rec.specialRef(oldField, key);
-            ret = index_.updata(path.top(), oldField, iov[key], targetid);
+            ret = index_.updata(path.top(), iov[key], targetid);
             if (ret) return ret;
 
             //借到的记录插入
             data.allocate(&header, iov, (int) fields);
 
             // 排序
-            std::vector<unsigned short> slotsv;
-            for (int i = 0; i < data.getSlotsNum(); i++)
-                slotsv.push_back(data.getSlot(i));
-            if (relationInfo->fields[key].type == NULL)
-                relationInfo->fields[key].type =
-                    findDataType(relationInfo->fields[key].fieldType.c_str());
-            Compare cmp(relationInfo->fields[key], key, *this);
-            std::sort(slotsv.begin(), slotsv.end(), cmp);
-            for (int i = 0; i < data.getSlotsNum(); i++)
-                data.setSlot(i, slotsv[i]);
+            FieldInfo &keyInfo = relationInfo->fields[key];
+            keyInfo.search->sort(data, keyInfo.type, key);
 
             //删除兄弟节点所借的记录
             brother.recDelete(&iov[key], relationInfo);
@@ -514,16 +1220,575 @@ int Table::remove(struct iovec keyField)
         return S_OK;
     }
 
-    //兄弟结点填充度<=50%
+    //兄弟结点填充度不高于borrowRatio
     struct iovec field;
+    field.iov_base = NULL;
+    int comblockid = isRight ? brotherid : targetid; //被合并掉的block
     if (isRight) //如果是右兄弟节点
-        combineDataBlock(targetid, brotherid, &field, 1);//兄弟节点合并到当前节点
+        ret = combineDataBlock(targetid, brotherid, &field, 1);//兄弟节点合并到当前节点
     else //如果是左兄弟节点
-        combineDataBlock(brotherid, targetid, &field, 0);//当前节点合并到兄弟节点
+        ret = combineDataBlock(brotherid, targetid, &field, 0);//当前节点合并到兄弟节点
+    free(field.iov_base);
+    if (ret) return ret;
 
+    //父节点中的键值可能比comblock的最小键值小，按指针取
+    ret = index_.getKey(path.top(), comblockid, &field);
+    if (ret) return ret;
     //更新b+tree
     ret = index_.remove(field, path);
+    free(field.iov_base);
+    if (ret) return ret;
+    //回收被合并掉的block
+    ret = freeDataBlock(comblockid);
     if (ret) return ret;
     return S_OK;
 }
-} // namespace db
\ No newline at end of file
+int Table::removeRange(struct iovec lo, struct iovec hi)
+{
+    std::lock_guard<std::recursive_mutex> guard(latch_);
+    //打开block
+    int ret = initial();
+    if (ret) return ret;
+    unsigned int key = relationInfo->key;
+    DataType *type = relationInfo->fields[key].type;
+    if (type->compare(hi.iov_base, lo.iov_base, hi.iov_len, lo.iov_len))
+        return EINVAL;
+
+    //有二级索引时逐条删除，同步索引
+    if (!secondaries_.empty()) {
+        std::vector<std::string> keys;
+        bool done = false;
+        for (blockIter it1 = seekBlock(lo); !done && it1 != blockEnd();
+             ++it1) {
+            for (iterator it2 = seek(it1, lo); it2 != end(it1); ++it2) {
+                struct iovec field;
+                (*it2).specialRef(field, key);
+                if (type->compare(
+                        hi.iov_base,
+                        field.iov_base,
+                        hi.iov_len,
+                        field.iov_len)) {
+                    done = true;
+                    break;
+                }
+                keys.push_back(
+                    std::string((const char *) field.iov_base, field.iov_len));
+            }
+        }
+        for (size_t i = 0; i < keys.size(); i++) {
+            struct iovec field;
+            field.iov_base = (void *) keys[i].data();
+            field.iov_len = keys[i].size();
+            ret = remove(field);
+            if (ret) return ret;
+        }
+        return S_OK;
+    }
+
+    //定位lo所在的block，只有它和范围末尾的block需要逐条删除
+    //先只读地走一遍叶子链，确定要改的block，再改索引，最后改叶子链
+    std::stack<int> path;
+    int firstid = index_.sraech(lo, path);
+    readDataBlock(firstid);
+    DataBlock data;
+    data.attach(buffer_);
+
+    //最小键值发生变化的边界block：blockid---新键值
+    std::vector<std::pair<int, std::string>> trimmed;
+    //整块摘除的block：blockid---最小键值
+    std::vector<std::pair<int, std::string>> dropped;
+    //摘除后要重新接上的链：前一个保留的block---后继
+    std::vector<std::pair<int, int>> links;
+
+    unsigned short slotsNum = data.getSlotsNum();
+    const KeySearch *search = relationInfo->fields[key].search;
+    unsigned short begin = data.lowerBound(&lo, type, key, search);
+    unsigned short firstEnd = data.upperBound(&hi, type, key, search);
+    bool more = firstEnd == slotsNum; //范围可能延续到后继block
+    if (begin == 0 && firstEnd > 0 && firstEnd < slotsNum) {
+        struct iovec newField;
+        Record record;
+        record.attach(buffer_ + data.getSlot(firstEnd), Block::BLOCK_SIZE);
+        record.specialRef(newField, key);
+        trimmed.push_back(std::make_pair(
+            firstid,
+            std::string((const char *) newField.iov_base, newField.iov_len)));
+    }
+    //统计：只计删掉的有效记录，tombstone删除时已经扣除
+    unsigned long long rows = 0, size = 0;
+    liveRange(data, begin, firstEnd, rows, size);
+
+    //沿叶子链向后，整块覆盖的block直接摘除
+    int previd = firstid;  //前一个保留的block
+    bool skipped = false;  // previd之后是否有block被摘除
+    int nextid = data.getNextid();
+    int lastid = -1;       //范围末尾要删除开头[0, lastEnd)的block
+    unsigned short lastEnd = 0;
+    unsigned char db[Block::BLOCK_SIZE];
+    DataBlock next;
+    next.attach(db);
+    while (more && nextid != -1) {
+        size_t offset = (nextid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+        relationInfo->dataFile.read(offset, (char *) db, Block::BLOCK_SIZE);
+        slotsNum = next.getSlotsNum();
+        unsigned short end = next.upperBound(&hi, type, key, search);
+
+        //空block没有键值可以定位索引，保留在链上
+        if (slotsNum > 0 && end == slotsNum) {
+            struct iovec field;
+            Record record;
+            record.attach(db + next.getSlot(0), Block::BLOCK_SIZE);
+            record.specialRef(field, key);
+            dropped.push_back(std::make_pair(
+                nextid,
+                std::string((const char *) field.iov_base, field.iov_len)));
+            liveRange(next, 0, slotsNum, rows, size);
+            skipped = true;
+            nextid = next.getNextid();
+            continue;
+        }
+
+        //保留的block接到前一个保留的block之后
+        if (skipped) {
+            links.push_back(std::make_pair(previd, nextid));
+            skipped = false;
+        }
+        if (slotsNum == 0) {
+            previd = nextid;
+            nextid = next.getNextid();
+            continue;
+        }
+
+        //范围末尾的block，删除开头的[0, end)
+        if (end > 0) {
+            struct iovec newField;
+            Record record;
+            record.attach(db + next.getSlot(end), Block::BLOCK_SIZE);
+            record.specialRef(newField, key);
+            trimmed.push_back(std::make_pair(
+                nextid,
+                std::string(
+                    (const char *) newField.iov_base, newField.iov_len)));
+            liveRange(next, 0, end, rows, size);
+            lastid = nextid;
+            lastEnd = end;
+        }
+        more = false;
+    }
+    //摘除到了链尾
+    if (skipped) links.push_back(std::make_pair(previd, -1));
+
+    //摘除的block按指针在索引中定位，重复键值时分隔键找不到唯一的儿子
+    //找不到说明索引和叶子链不一致，此时什么都还没改
+    for (size_t i = 0; i < dropped.size(); i++) {
+        struct iovec field;
+        field.iov_base = (void *) dropped[i].second.data();
+        field.iov_len = dropped[i].second.size();
+        std::stack<int> dpath;
+        ret = index_.locate(field, dropped[i].first, dpath);
+        if (ret) return ret;
+    }
+
+    //先修正索引：删除指向摘除block的条目，更新边界block的键值
+    for (size_t i = 0; i < dropped.size(); i++) {
+        struct iovec field;
+        field.iov_base = (void *) dropped[i].second.data();
+        field.iov_len = dropped[i].second.size();
+        std::stack<int> dpath;
+        ret = index_.locate(field, dropped[i].first, dpath);
+        if (ret) return ret;
+        ret = index_.unlink(dropped[i].first, dpath);
+        if (ret) return ret;
+    }
+    for (size_t i = 0; i < trimmed.size(); i++) {
+        struct iovec newField;
+        newField.iov_base = (void *) trimmed[i].second.data();
+        newField.iov_len = trimmed[i].second.size();
+        std::stack<int> tpath;
+        ret = index_.locate(newField, trimmed[i].first, tpath);
+        if (ret) return ret;
+        ret = index_.updata(tpath.top(), newField, trimmed[i].first);
+        if (ret) return ret;
+    }
+
+    //再改叶子链，中途不返回
+    readDataBlock(firstid);
+    data.attach(buffer_);
+    data.recDeleteRange(begin, firstEnd);
+    data.setChecksum();
+    ret = writeDataBlock(firstid);
+    if (lastid != -1) {
+        size_t offset = (lastid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+        relationInfo->dataFile.read(offset, (char *) db, Block::BLOCK_SIZE);
+        next.recDeleteRange(0, lastEnd);
+        next.setChecksum();
+        relationInfo->dataFile.write(
+            offset, (const char *) db, Block::BLOCK_SIZE);
+    }
+    for (size_t i = 0; i < links.size(); i++)
+        linkDataBlock(links[i].first, links[i].second);
+    for (size_t i = 0; i < dropped.size(); i++)
+        freeDataBlock(dropped[i].first);
+    if (rows) {
+        relationInfo->rows -= rows;
+        relationInfo->size -= size;
+        relationInfo->boundsStale = true;
+        relationInfo->statsDirty = true;
+    }
+    return ret;
+}
+int Table::compact()
+{
+    //先收集指向叶子的节点
+    std::vector<int> parents;
+    {
+        std::lock_guard<std::recursive_mutex> guard(latch_);
+        int ret = initial();
+        if (ret) return ret;
+        ret = index_.getLeafParents(parents);
+        if (ret) return ret;
+    }
+    //逐个节点整理，节点之间释放latch，前台操作不会被长时间阻塞
+    for (size_t i = 0; i < parents.size(); i++) {
+        std::lock_guard<std::recursive_mutex> guard(latch_);
+        int ret = compactNode(parents[i]);
+        if (ret) return ret;
+    }
+    return S_OK;
+}
+int Table::compactNode(int fatherid)
+{
+    //节点可能在释放latch期间被回收或改作他用
+    std::vector<int> children;
+    if (index_.getChildren(fatherid, children) != NODE_TYPE_POINT_TO_LEAF)
+        return S_OK;
+
+    //碎片整理，用自己的buffer
+    unsigned char db[Block::BLOCK_SIZE];
+    DataBlock data;
+    data.attach(db);
+    std::vector<int> usedspace;
+    for (size_t i = 0; i < children.size(); i++) {
+        size_t offset = (children[i] - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+        relationInfo->dataFile.read(offset, (char *) db, Block::BLOCK_SIZE);
+        if (data.getFragment() >= COMPACT_FRAGMENT_SIZE) {
+            data.rewrite();
+            data.setChecksum();
+            relationInfo->dataFile.write(
+                offset, (const char *) db, Block::BLOCK_SIZE);
+        }
+        usedspace.push_back(data.getUsedspace());
+    }
+
+    //合并相邻的兄弟，右边合并到左边，合并后不超过填充因子
+    int underfull = leafBytes(relationInfo->mergeRatio);
+    int limit = leafBytes(relationInfo->fillFactor);
+    if (limit > COMPACT_MERGE_SIZE) limit = COMPACT_MERGE_SIZE;
+    size_t i = 0;
+    while (i + 1 < children.size()) {
+        if (usedspace[i] >= underfull && usedspace[i + 1] >= underfull) {
+            i++;
+            continue;
+        }
+        if (usedspace[i] + usedspace[i + 1] > limit) {
+            i++;
+            continue;
+        }
+        struct iovec field;
+        field.iov_base = NULL;
+        int ret = combineDataBlock(children[i], children[i + 1], &field, 1);
+        if (ret) return ret;
+        free(field.iov_base);
+        //右兄弟不是最左边指针，摘除不会让父节点变空
+        std::stack<int> path;
+        path.push(fatherid);
+        ret = index_.unlink(children[i + 1], path);
+        if (ret) return ret;
+        ret = freeDataBlock(children[i + 1]);
+        if (ret) return ret;
+
+        //继续尝试把下一个兄弟合并进来
+        DataBlock block;
+        block.attach(buffer_);
+        usedspace[i] = block.getUsedspace();
+        children.erase(children.begin() + i + 1);
+        usedspace.erase(usedspace.begin() + i + 1);
+    }
+    return S_OK;
+}
+//由block数和有效字节数得到填充度和空间放大
+static void spaceRatios(SpaceInfo &info)
+{
+    info.fill = 0;
+    info.amplification = 0;
+    if (info.leafBlocks)
+        info.fill = (double) info.liveBytes /
+                    ((double) info.leafBlocks *
+                     DataBlock::INITIAL_FREE_SPACE_SIZE);
+    if (info.liveBytes)
+        info.amplification =
+            (double) (info.dataBlocks + info.indexBlocks) * Block::BLOCK_SIZE /
+            (double) info.liveBytes;
+}
+int Table::spaceInfo(SpaceInfo &info)
+{
+    std::lock_guard<std::recursive_mutex> guard(latch_);
+    int ret = initial();
+    if (ret) return ret;
+
+    info = SpaceInfo();
+    for (blockIter it = blockBegin(); it != blockEnd(); ++it) {
+        DataBlock &block = *it;
+        info.leafBlocks++;
+        info.liveBytes += block.getUsedspace();
+    }
+    info.dataBlocks = DataBlockCnt;
+    info.indexBlocks = index_.blockNum();
+    spaceRatios(info);
+    return S_OK;
+}
+int Table::statistics(TableStats &stats)
+{
+    std::lock_guard<std::recursive_mutex> guard(latch_);
+    int ret = initial();
+    if (ret) return ret;
+    if (relationInfo->boundsStale) {
+        ret = locateBounds();
+        if (ret) return ret;
+    }
+
+    stats.rows = relationInfo->rows;
+    stats.liveBytes = relationInfo->size;
+    stats.leafBlocks = relationInfo->leafBlocks;
+    stats.dataBlocks = DataBlockCnt;
+    stats.indexBlocks = index_.blockNum();
+    spaceRatios(stats);
+    stats.height = relationInfo->height;
+    stats.minKey = relationInfo->minKey;
+    stats.maxKey = relationInfo->maxKey;
+    return S_OK;
+}
+int Table::checkpoint()
+{
+    std::lock_guard<std::recursive_mutex> guard(latch_);
+    if (relationInfo == NULL || !relationInfo->statsDirty) return S_OK;
+    unsigned char rb[Root::ROOT_SIZE];
+    int ret = relationInfo->dataFile.read(0, (char *) rb, Root::ROOT_SIZE);
+    if (ret) return ret;
+    Root root;
+    root.attach(rb);
+    saveStats(root);
+    return relationInfo->dataFile.write(0, (const char *) rb, Root::ROOT_SIZE);
+}
+void Table::countInsert(struct iovec &keyField, unsigned long long bytes)
+{
+    RelationInfo *info = relationInfo;
+    std::string key((const char *) keyField.iov_base, keyField.iov_len);
+    if (info->rows == 0) {
+        info->minKey = info->maxKey = key;
+        info->boundsStale = false;
+    } else if (!info->boundsStale) {
+        DataType *type = info->fields[info->key].type;
+        if (type->compare(
+                key.data(),
+                info->minKey.data(),
+                key.size(),
+                info->minKey.size()))
+            info->minKey = key;
+        if (type->compare(
+                info->maxKey.data(),
+                key.data(),
+                info->maxKey.size(),
+                key.size()))
+            info->maxKey = key;
+    }
+    info->rows++;
+    info->size += bytes;
+    info->statsDirty = true;
+}
+void Table::countRemove(struct iovec &keyField, unsigned long long bytes)
+{
+    RelationInfo *info = relationInfo;
+    std::string key((const char *) keyField.iov_base, keyField.iov_len);
+    if (key == info->minKey || key == info->maxKey) info->boundsStale = true;
+    info->rows--;
+    info->size -= bytes;
+    info->statsDirty = true;
+}
+void Table::saveStats(Root &root)
+{
+    RelationInfo *info = relationInfo;
+    unsigned long long rows = htobe64(info->rows);
+    unsigned long long size = htobe64(info->size);
+    unsigned int leafBlocks = htobe32(info->leafBlocks);
+    unsigned short height = htobe16(info->height);
+    struct iovec iov[6];
+    iov[0].iov_base = &rows;
+    iov[0].iov_len = sizeof(rows);
+    iov[1].iov_base = &size;
+    iov[1].iov_len = sizeof(size);
+    iov[2].iov_base = &leafBlocks;
+    iov[2].iov_len = sizeof(leafBlocks);
+    iov[3].iov_base = &height;
+    iov[3].iov_len = sizeof(height);
+    //最小、最大键值过期或者太长时不保存，加载后重新定位
+    iov[4].iov_base = (void *) info->minKey.data();
+    iov[4].iov_len = info->boundsStale ? 0 : info->minKey.size();
+    iov[5].iov_base = (void *) info->maxKey.data();
+    iov[5].iov_len = info->boundsStale ? 0 : info->maxKey.size();
+    if (Record::size(iov, 6, Record::FORMAT_FIXED).first + 2 >
+        (size_t) Root::ROOT_STATS_SIZE)
+        iov[4].iov_len = iov[5].iov_len = 0;
+
+    //2B长度，之后是记录
+    unsigned char *area = root.getStats();
+    Record record;
+    record.attach(area + 2, Root::ROOT_STATS_SIZE - 2);
+    unsigned char header = 0;
+    unsigned short length = htobe16(
+        (unsigned short) record.set(iov, 6, &header, Record::FORMAT_FIXED));
+    ::memcpy(area, &length, sizeof(length));
+    info->statsDirty = false;
+}
+bool Table::loadStats(Root &root)
+{
+    unsigned char *area = root.getStats();
+    unsigned short length;
+    ::memcpy(&length, area, sizeof(length));
+    length = be16toh(length);
+    if (length == 0 || length > Root::ROOT_STATS_SIZE - 2) return false;
+    Record record;
+    record.attach(area + 2, length);
+    if (record.fields() != 6) return false;
+    struct iovec iov[6];
+    unsigned char header;
+    if (!record.ref(iov, 6, &header)) return false;
+
+    RelationInfo *info = relationInfo;
+    unsigned long long value;
+    ::memcpy(&value, iov[0].iov_base, sizeof(value));
+    info->rows = be64toh(value);
+    ::memcpy(&value, iov[1].iov_base, sizeof(value));
+    info->size = be64toh(value);
+    unsigned int leafBlocks;
+    ::memcpy(&leafBlocks, iov[2].iov_base, sizeof(leafBlocks));
+    info->leafBlocks = be32toh(leafBlocks);
+    unsigned short height;
+    ::memcpy(&height, iov[3].iov_base, sizeof(height));
+    info->height = be16toh(height);
+    info->minKey.assign((const char *) iov[4].iov_base, iov[4].iov_len);
+    info->maxKey.assign((const char *) iov[5].iov_base, iov[5].iov_len);
+    info->boundsStale = info->rows > 0 && iov[4].iov_len == 0;
+    info->statsDirty = false;
+    return info->height > 0;
+}
+int Table::rebuildStats()
+{
+    RelationInfo *info = relationInfo;
+    unsigned int key = info->key;
+    info->rows = 0;
+    info->size = 0;
+    info->leafBlocks = 0;
+    info->minKey.clear();
+    info->maxKey.clear();
+
+    //沿叶子链扫描，不动buffer_
+    unsigned char rb[Root::ROOT_SIZE];
+    info->dataFile.read(0, (char *) rb, Root::ROOT_SIZE);
+    Root root;
+    root.attach(rb);
+    unsigned char db[Block::BLOCK_SIZE];
+    DataBlock block;
+    block.attach(db);
+    for (int blockid = (int) root.getHead(); blockid != -1;
+         blockid = block.getNextid()) {
+        size_t offset = (blockid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+        int ret = info->dataFile.read(offset, (char *) db, Block::BLOCK_SIZE);
+        if (ret) return ret;
+        info->leafBlocks++;
+        info->size += block.getUsedspace();
+        unsigned short slotsNum = block.getSlotsNum();
+        for (unsigned short i = 0; i < slotsNum; i++) {
+            Record record;
+            record.attach(db + block.getSlot(i), Block::BLOCK_SIZE);
+            if (!record.isTombstone()) info->rows++;
+        }
+        if (info->minKey.empty()) liveKey(block, true, key, info->minKey);
+        liveKey(block, false, key, info->maxKey);
+    }
+    info->height = (unsigned short) index_.height();
+    info->boundsStale = false;
+    info->statsDirty = true;
+    return S_OK;
+}
+int Table::locateBounds()
+{
+    RelationInfo *info = relationInfo;
+    unsigned int key = info->key;
+    info->minKey.clear();
+    info->maxKey.clear();
+    info->boundsStale = false;
+    info->statsDirty = true;
+    if (info->rows == 0) return S_OK;
+
+    unsigned char rb[Root::ROOT_SIZE];
+    info->dataFile.read(0, (char *) rb, Root::ROOT_SIZE);
+    Root root;
+    root.attach(rb);
+    unsigned char db[Block::BLOCK_SIZE];
+    DataBlock block;
+    block.attach(db);
+
+    //最大键值在最右边的叶子，通常不用扫描
+    int last = index_.lastLeaf();
+    size_t offset = (last - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+    int ret = info->dataFile.read(offset, (char *) db, Block::BLOCK_SIZE);
+    if (ret) return ret;
+    bool found = liveKey(block, false, key, info->maxKey);
+
+    //最小键值从链头找起，跳过只有tombstone的叶子
+    for (int blockid = (int) root.getHead(); blockid != -1;
+         blockid = block.getNextid()) {
+        offset = (blockid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+        ret = info->dataFile.read(offset, (char *) db, Block::BLOCK_SIZE);
+        if (ret) return ret;
+        if (info->minKey.empty()) {
+            if (!liveKey(block, true, key, info->minKey)) continue;
+            if (found) break;
+        }
+        //最右边的叶子全是tombstone，扫到链尾
+        liveKey(block, false, key, info->maxKey);
+    }
+    return S_OK;
+}
+void Table::compactLoop(unsigned int interval)
+{
+    std::unique_lock<std::mutex> lock(stopMutex_);
+    while (!stopping_) {
+        lock.unlock();
+        compact();
+        checkpoint();
+        lock.lock();
+        stopCond_.wait_for(lock, std::chrono::milliseconds(interval), [this] {
+            return stopping_;
+        });
+    }
+}
+int Table::startCompactor(unsigned int interval)
+{
+    if (compactor_.joinable()) return EINVAL;
+    stopping_ = false;
+    compactor_ = std::thread(&Table::compactLoop, this, interval);
+    return S_OK;
+}
+void Table::stopCompactor()
+{
+    if (!compactor_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(stopMutex_);
+        stopping_ = true;
+    }
+    stopCond_.notify_one();
+    compactor_.join();
+}
+} // namespace db
@@ -4,119 +4,114 @@
 // 实现时辍
 //
 //
-#include <stdio.h>
-#include <time.h>
-#include <string>
 #include <db/timestamp.h>
 
 namespace db {
 
-bool TimeStamp::toString(char *buffer, size_t size) const
+static const long long MICROS_PER_SECOND = 1000000LL;
+static const long long SECONDS_PER_DAY = 86400LL;
+
+// 向下取整的除法，纪元之前的时戳也落到正确的日期
+static inline long long floorDiv(long long x, long long y)
 {
-    struct tm tm;
-    time_t tmt;
-    int ms = (int)
-            (std::chrono::duration_cast<std::chrono::microseconds>(stamp_.time_since_epoch()).count() % 1000000);
-    tmt = std::chrono::system_clock::to_time_t(stamp_);
-    localtime_s(&tm, &tmt);
-    int ret = snprintf(
-        buffer,
-        size,
-        "%4d_%02d_%02d-%02d:%02d:%02d.%06d", // 26?
-        tm.tm_year + 1900,
-        tm.tm_mon + 1, // 0 - 11
-        tm.tm_mday,
-        tm.tm_hour,
-        tm.tm_min,
-        tm.tm_sec,
-        ms);
-    return ret > 0;
+    long long q = x / y;
+    if ((x % y != 0) && ((x < 0) != (y < 0))) --q;
+    return q;
 }
 
-void TimeStamp::fromString(const char *time)
+// 纪元以来的天数转成公历日期，见H. Hinnant的civil_from_days
+static void civilFromDays(long long z, int &y, int &m, int &d)
 {
-    struct tm tm;
-    memset(&tm, 0, sizeof(tm));
-    tm.tm_year = std::stoi(time) - 1900;
-    tm.tm_mon = std::stoi(time + 5) - 1;
-    tm.tm_mday = std::stoi(time + 8);
-    tm.tm_hour = std::stoi(time + 11);
-    tm.tm_min = std::stoi(time + 14);
-    tm.tm_sec = std::stoi(time + 17);
-    std::chrono::microseconds micro(std::stoi(time + 20));
-
-    time_t tmt;
-    tmt = mktime(&tm);
-    stamp_ = std::chrono::system_clock::from_time_t(tmt);
-    stamp_ += micro;
+    // 以3月1日为年初，400年一个周期
+    z += 719468;
+    long long era = floorDiv(z, 146097);
+    unsigned doe = (unsigned) (z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    d = (int) (doy - (153 * mp + 2) / 5 + 1);
+    m = (int) (mp < 10 ? mp + 3 : mp - 9);
+    y = (int) (yoe + era * 400) + (m <= 2);
 }
 
-bool operator<(const TimeStamp &lhs, const TimeStamp &rhs)
+// 公历日期转成纪元以来的天数
+static long long daysFromCivil(int y, int m, int d)
 {
-    char buf_lhs[512];
-    char buf_rhs[512];
-    lhs.toString(buf_lhs, 512);
-    rhs.toString(buf_rhs, 512);
-    int i = 0;
-    while (buf_lhs[i]) {
-        if (buf_lhs[i] > buf_rhs[i]) {
-            return false;
-        } else if (buf_lhs[i] < buf_rhs[i]) {
-            return true;
-        } else {
-            i++;
-        }
-    }
-    return false;
+    y -= m <= 2;
+    long long era = floorDiv(y, 400);
+    unsigned yoe = (unsigned) (y - era * 400);
+    unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (long long) doe - 719468;
 }
 
-bool operator>(const TimeStamp &lhs, const TimeStamp &rhs)
+// 定宽输出十进制数字
+static inline void putDigits(char *buffer, unsigned value, int width)
 {
-    char buf_lhs[512];
-    char buf_rhs[512];
-    lhs.toString(buf_lhs, 512);
-    rhs.toString(buf_rhs, 512);
-    int i = 0;
-    while (buf_lhs[i]) {
-        if (buf_lhs[i] < buf_rhs[i]) {
-            return false;
-        } else if (buf_lhs[i] > buf_rhs[i]) {
-            return true;
-        } else {
-            i++;
-        }
+    for (int i = width - 1; i >= 0; --i) {
+        buffer[i] = (char) ('0' + value % 10);
+        value /= 10;
     }
-    return false;
 }
 
-bool operator==(const TimeStamp &lhs, const TimeStamp &rhs)
+// 解析定宽十进制数字
+static inline bool getDigits(const char *time, int width, int &value)
 {
-    char buf_lhs[512];
-    char buf_rhs[512];
-    lhs.toString(buf_lhs, 512);
-    rhs.toString(buf_rhs, 512);
-    int i = 0;
-    while (buf_lhs[i]) {
-        if (buf_lhs[i] == buf_rhs[i]) {
-            i++;
-        } else {
-            return false;
-        }
+    value = 0;
+    for (int i = 0; i < width; ++i) {
+        if (time[i] < '0' || time[i] > '9') return false;
+        value = value * 10 + (time[i] - '0');
     }
     return true;
 }
 
-bool operator<=(const TimeStamp &lhs, const TimeStamp &rhs)
-{
-    return !operator>(lhs, rhs);
-}
-bool operator>=(const TimeStamp &lhs, const TimeStamp &rhs)
+bool TimeStamp::toString(char *buffer, size_t size) const
 {
-    return !operator<(lhs, rhs);
+    if (size < STRING_SIZE) return false;
+    long long seconds = floorDiv(stamp_, MICROS_PER_SECOND);
+    unsigned micro = (unsigned) (stamp_ - seconds * MICROS_PER_SECOND);
+    long long days = floorDiv(seconds, SECONDS_PER_DAY);
+    unsigned sod = (unsigned) (seconds - days * SECONDS_PER_DAY);
+    int y, m, d;
+    civilFromDays(days, y, m, d);
+    if (y < 0 || y > 9999) return false;
+
+    // YYYY_MM_DD-HH:MM:SS.uuuuuu
+    putDigits(buffer, (unsigned) y, 4);
+    buffer[4] = '_';
+    putDigits(buffer + 5, (unsigned) m, 2);
+    buffer[7] = '_';
+    putDigits(buffer + 8, (unsigned) d, 2);
+    buffer[10] = '-';
+    putDigits(buffer + 11, sod / 3600, 2);
+    buffer[13] = ':';
+    putDigits(buffer + 14, sod / 60 % 60, 2);
+    buffer[16] = ':';
+    putDigits(buffer + 17, sod % 60, 2);
+    buffer[19] = '.';
+    putDigits(buffer + 20, micro, 6);
+    buffer[26] = '\0';
+    return true;
 }
-bool operator!=(const TimeStamp &lhs, const TimeStamp &rhs)
+
+bool TimeStamp::fromString(const char *time)
 {
-    return !operator==(lhs, rhs);
+    int y, m, d, hh, mm, ss, micro;
+    if (!getDigits(time, 4, y) || time[4] != '_' ||
+        !getDigits(time + 5, 2, m) || time[7] != '_' ||
+        !getDigits(time + 8, 2, d) || time[10] != '-' ||
+        !getDigits(time + 11, 2, hh) || time[13] != ':' ||
+        !getDigits(time + 14, 2, mm) || time[16] != ':' ||
+        !getDigits(time + 17, 2, ss) || time[19] != '.' ||
+        !getDigits(time + 20, 6, micro))
+        return false;
+    if (m < 1 || m > 12 || d < 1 || d > 31 || hh > 23 || mm > 59 || ss > 60)
+        return false;
+
+    long long seconds = daysFromCivil(y, m, d) * SECONDS_PER_DAY +
+                        hh * 3600LL + mm * 60LL + ss;
+    stamp_ = seconds * MICROS_PER_SECOND + micro;
+    return true;
 }
 
 } // namespace db
@@ -6,6 +6,8 @@
 #include "../catch.hpp"
 #include <db/block.h>
 #include <db/record.h>
+#include <chrono>
+#include <iostream>
 using namespace db;
 
 TEST_CASE("db/block.h")
@@ -156,4 +158,334 @@ TEST_CASE("db/block.h")
         REQUIRE(f2 >= (unsigned short) ret.first);
         REQUIRE(f2 % 8 == 0);
     }
+
+    SECTION("copyRecord")
+    {
+        DataBlock block, copy;
+        unsigned char buffer[Block::BLOCK_SIZE];
+        unsigned char buffer2[Block::BLOCK_SIZE];
+        block.attach(buffer);
+        block.clear(1);
+        copy.attach(buffer2);
+        copy.clear(2);
+
+        struct iovec iov[2];
+        long long id;
+        const char *name = "junix";
+        iov[0].iov_base = &id;
+        iov[0].iov_len = sizeof(id);
+        iov[1].iov_base = (void *) name;
+        iov[1].iov_len = strlen(name) + 1;
+        unsigned char header = 0;
+        unsigned char tombstone = Record::MASK_TOMBSTONE;
+        for (id = 0; id < 3; id++)
+            REQUIRE(block.allocate(id == 1 ? &tombstone : &header, iov, 2));
+        int size = (block.getUsedspace() - 6) / 3;
+
+        // 按字节复制，tombstone不计入usedspace
+        for (unsigned short i = 0; i < 3; i++)
+            REQUIRE(copy.copyRecord(buffer + block.getSlot(i)));
+        REQUIRE(copy.getSlotsNum() == 3);
+        REQUIRE(copy.getUsedspace() == (size + 2) * 2);
+        for (unsigned short i = 0; i < 3; i++)
+            REQUIRE(
+                memcmp(
+                    buffer + block.getSlot(i),
+                    buffer2 + copy.getSlot(i),
+                    size) == 0);
+
+        // 原地rewrite，丢弃tombstone，剩余记录前移
+        copy.recDeleteRange(0, 1);
+        copy.rewrite();
+        unsigned short start = DataBlock::DATA_DEFAULT_FREESPACE;
+        REQUIRE(copy.getSlotsNum() == 1);
+        REQUIRE(copy.getSlot(0) == start);
+        REQUIRE(copy.getFreespace() == start + size);
+        REQUIRE(copy.getUsedspace() == size + 2);
+        REQUIRE(copy.getFragment() == 0);
+        Record record;
+        record.attach(buffer2 + copy.getSlot(0), Block::BLOCK_SIZE);
+        REQUIRE(!record.isTombstone());
+        struct iovec field;
+        record.specialRef(field, 0);
+        REQUIRE(*(long long *) field.iov_base == 2);
+    }
+    SECTION("tombstoneRange")
+    {
+        DataBlock block;
+        unsigned char buffer[Block::BLOCK_SIZE];
+        block.attach(buffer);
+        block.clear(1);
+
+        RelationInfo info;
+        FieldInfo field;
+        field.type = findDataType("BIGINT");
+        info.fields.push_back(field);
+        info.key = 0;
+
+        struct iovec iov[2];
+        long long id;
+        const char *name = "junix";
+        iov[0].iov_base = &id;
+        iov[0].iov_len = sizeof(id);
+        iov[1].iov_base = (void *) name;
+        iov[1].iov_len = strlen(name) + 1;
+        unsigned char header = 0;
+        for (id = 0; id < 8; id++)
+            REQUIRE(block.allocate(&header, iov, 2));
+        int size = block.getUsedspace() / 8; // 每条记录连slot
+
+        // tombstone已经扣除，范围删除时不能再扣一次
+        for (id = 2; id < 4; id++)
+            REQUIRE(block.recTombstone(&iov[0], &info) == id);
+        REQUIRE(block.getUsedspace() == size * 6);
+        REQUIRE(block.recDeleteRange(2, 6) == 4);
+        REQUIRE(block.getSlotsNum() == 4);
+        REQUIRE(block.getUsedspace() == size * 4);
+        block.rewrite();
+        REQUIRE(block.getUsedspace() == size * 4);
+    }
+    SECTION("prefix")
+    {
+        IndexBlock block;
+        unsigned char buffer[Block::BLOCK_SIZE];
+        block.attach(buffer);
+        block.clear(1);
+        DataType *type = findDataType("VARCHAR");
+
+        // 按序插入3个有公共前缀的键值
+        const char *keys[] = {"user/alice", "user/bob", "user/carol"};
+        int pointer = 0;
+        struct iovec iov[2];
+        iov[1].iov_base = &pointer;
+        iov[1].iov_len = sizeof(int);
+        unsigned char header = 0;
+        for (int i = 0; i < 3; i++) {
+            iov[0].iov_base = (void *) keys[i];
+            iov[0].iov_len = strlen(keys[i]) + 1;
+            REQUIRE(block.allocate(&header, iov, 2));
+        }
+        unsigned short used = block.getUsedspace();
+        REQUIRE(block.compress());
+        REQUIRE(block.getPrefixLength() == 5);
+        REQUIRE(memcmp(block.getPrefix(), "user/", 5) == 0);
+        REQUIRE(block.getUsedspace() < used);
+        REQUIRE(!block.compress());
+
+        // 取出的是完整键值
+        struct iovec key;
+        block.getKey(1, &key);
+        REQUIRE(strcmp((const char *) key.iov_base, "user/bob") == 0);
+        free(key.iov_base);
+        key.iov_base = (void *) "user/bob";
+        key.iov_len = 9;
+        REQUIRE(block.compareKey(&key, 1, type) == 0);
+        REQUIRE(block.compareKey(&key, 0, type) > 0);
+        REQUIRE(block.upperBound(&key, type, 0) == 2);
+        key.iov_base = (void *) "admin";
+        key.iov_len = 6;
+        REQUIRE(block.upperBound(&key, type, 0) == 0);
+
+        // 不共享前缀的键值插入时缩短前缀
+        iov[0].iov_base = (void *) "usr";
+        iov[0].iov_len = 4;
+        REQUIRE(block.allocate(&header, iov, 2));
+        REQUIRE(block.getPrefixLength() == 2);
+        block.getKey(0, &key);
+        REQUIRE(strcmp((const char *) key.iov_base, "user/alice") == 0);
+        free(key.iov_base);
+        block.getKey(3, &key);
+        REQUIRE(strcmp((const char *) key.iov_base, "usr") == 0);
+        free(key.iov_base);
+    }
+    SECTION("keySearch")
+    {
+        // 比较特化版本和逐次调用函数指针的通用版本，结果必须一致
+        DataBlock block;
+        unsigned char buffer[Block::BLOCK_SIZE];
+        block.attach(buffer);
+        block.clear(1);
+        DataType *type = findDataType("BIGINT");
+        const KeySearch *search = findKeySearch(type);
+        REQUIRE(strcmp(search->name, "BIGINT") == 0);
+
+        // 乱序插入后排序
+        struct iovec iov[1];
+        long long id;
+        iov[0].iov_base = &id;
+        iov[0].iov_len = sizeof(id);
+        unsigned char header = 0;
+        const int count = 400;
+        for (long long i = 0; i < count; i++) {
+            id = i * 7919 % count * 2;
+            REQUIRE(block.allocate(&header, iov, 1));
+        }
+        search->sort(block, type, 0);
+        for (int i = 0; i < count; i++) {
+            Record record;
+            record.attach(buffer + block.getSlot(i), Block::BLOCK_SIZE);
+            struct iovec field;
+            record.specialRef(field, 0);
+            REQUIRE(*(long long *) field.iov_base == i * 2);
+        }
+
+        // 计时：同样的查找各做一遍
+        const int rounds = 200;
+        unsigned long long sum[2] = {0, 0};
+        std::chrono::steady_clock::duration cost[2];
+        for (int path = 0; path < 2; path++) {
+            const KeySearch *s = path ? search : NULL;
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            for (int r = 0; r < rounds; r++)
+                for (id = -1; id <= count * 2; id++)
+                    sum[path] += block.lowerBound(iov, type, 0, s) +
+                                 block.upperBound(iov, type, 0, s);
+            cost[path] = std::chrono::steady_clock::now() - start;
+        }
+        REQUIRE(sum[0] == sum[1]);
+        for (id = -1; id <= count * 2; id++) {
+            REQUIRE(
+                block.lowerBound(iov, type, 0) ==
+                block.lowerBound(iov, type, 0, search));
+            REQUIRE(
+                block.upperBound(iov, type, 0) ==
+                block.upperBound(iov, type, 0, search));
+        }
+        std::cout << "keySearch compare: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(
+                         cost[0])
+                         .count()
+                  << "us, specialized: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(
+                         cost[1])
+                         .count()
+                  << "us" << std::endl;
+
+        // 没有特化的类型用通用版本
+        DataType other = *type;
+        other.name = "OTHER";
+        REQUIRE(findKeySearch(&other)->name == NULL);
+    }
+    SECTION("replace")
+    {
+        DataBlock block;
+        unsigned char buffer[Block::BLOCK_SIZE];
+        block.attach(buffer);
+        block.clear(1);
+
+        // 顺序插入直到放不下
+        std::vector<std::string> names;
+        struct iovec iov[2];
+        long long id = 0;
+        iov[0].iov_base = &id;
+        iov[0].iov_len = sizeof(id);
+        unsigned char header = 0;
+        while (true) {
+            std::string name(50, 'a');
+            iov[1].iov_base = (void *) name.c_str();
+            iov[1].iov_len = name.size() + 1;
+            if (!block.allocate(&header, iov, 2)) break;
+            names.push_back(name);
+            id++;
+        }
+        int count = (int) names.size();
+
+        // 放不下时保留旧记录，变短原地覆盖，变长在block内重新分配
+        std::string large(2000, 'x');
+        id = count / 2;
+        iov[1].iov_base = (void *) large.c_str();
+        iov[1].iov_len = large.size() + 1;
+        REQUIRE(!block.recReplace((unsigned short) id, &header, iov, 2));
+        for (id = 0; id < 30; id++) {
+            names[id] = std::string(10, 'b');
+            iov[1].iov_base = (void *) names[id].c_str();
+            iov[1].iov_len = names[id].size() + 1;
+            REQUIRE(block.recReplace((unsigned short) id, &header, iov, 2));
+        }
+        id = 20;
+        names[id] = std::string(300, 'c');
+        iov[1].iov_base = (void *) names[id].c_str();
+        iov[1].iov_len = names[id].size() + 1;
+        REQUIRE(block.recReplace((unsigned short) id, &header, iov, 2));
+
+        REQUIRE(block.getSlotsNum() == count);
+        for (int i = 0; i < count; i++) {
+            Record record;
+            record.attach(buffer + block.getSlot(i), Block::BLOCK_SIZE);
+            struct iovec key, name;
+            record.specialRef(key, 0);
+            record.specialRef(name, 1);
+            REQUIRE(*(long long *) key.iov_base == i);
+            REQUIRE(std::string((char *) name.iov_base) == names[i]);
+        }
+    }
+    SECTION("fixedLayout")
+    {
+        IndexBlock block;
+        unsigned char buffer[Block::BLOCK_SIZE];
+        block.attach(buffer);
+        block.clear(1);
+        block.setLayout(INDEX_LAYOUT_INT64);
+        REQUIRE(block.getLayout() == INDEX_LAYOUT_INT64);
+        DataType *type = findDataType("BIGINT");
+
+        // 乱序插入偶数键值，指针是键值的相反数
+        long long id;
+        struct iovec key;
+        key.iov_base = &id;
+        key.iov_len = sizeof(id);
+        const int count = 1000;
+        for (int i = 0; i < count; i++) {
+            id = (long long) i * 7919 % count * 2 - count;
+            REQUIRE(block.insertEntry(&key, (int) -id, type));
+        }
+        REQUIRE(block.getSlotsNum() == count);
+        REQUIRE(!block.compress());
+        for (int i = 0; i < count; i++) {
+            struct iovec field;
+            block.getKey(i, &field);
+            REQUIRE(*(long long *) field.iov_base == i * 2 - count);
+            free(field.iov_base);
+            REQUIRE(block.getPointer(i) == count - i * 2);
+        }
+
+        // 查找结果和逐个比较一致，奇数键值不存在
+        for (id = -count - 1; id <= count + 1; id++) {
+            unsigned short lower = 0;
+            while (lower < count && block.compareKey(&key, lower, type) > 0)
+                lower++;
+            unsigned short upper = lower;
+            while (upper < count && block.compareKey(&key, upper, type) == 0)
+                upper++;
+            REQUIRE(block.lowerBound(&key, type, 0) == lower);
+            REQUIRE(block.upperBound(&key, type, 0) == upper);
+        }
+
+        // 删除、截断和复制
+        REQUIRE(block.findPointer(count) == 0);
+        REQUIRE(block.findPointer(1) == -1);
+        REQUIRE(block.removeEntries(0, 10) == 10);
+        REQUIRE(block.getPointer(0) == count - 20);
+        IndexBlock block2;
+        unsigned char buffer2[Block::BLOCK_SIZE];
+        block2.attach(buffer2);
+        block2.clear(2);
+        block2.setLayout(INDEX_LAYOUT_INT64);
+        REQUIRE(block.copyEntries(block2, 490, count - 10));
+        block.truncate(490);
+        REQUIRE(block.getSlotsNum() == 490);
+        REQUIRE(block2.getSlotsNum() == 500);
+        REQUIRE(block2.getPointer(0) == 0);
+        id = 0;
+        REQUIRE(block2.lowerBound(&key, type, 0) == 0);
+        REQUIRE(block.lowerBound(&key, type, 0) == 490);
+
+        // 放满后插入失败
+        unsigned short capacity = block.getCapacity();
+        id = count * 2;
+        while (block.getSlotsNum() < capacity)
+            REQUIRE(block.appendEntry(&key, 0));
+        REQUIRE(!block.insertEntry(&key, 0, type));
+    }
 }
\ No newline at end of file
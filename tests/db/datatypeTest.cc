@@ -5,6 +5,8 @@
 //
 #include "../catch.hpp"
 #include <db/datatype.h>
+#include <db/timestamp.h>
+#include <limits>
 using namespace db;
 
 TEST_CASE("db/datatype.h")
@@ -18,10 +20,26 @@ TEST_CASE("db/datatype.h")
         const char *hello = "hello";
         const char *hello2 = "hello2";
         REQUIRE(dt->compare(hello, hello2, strlen(hello), strlen(hello2)));
+        REQUIRE(dt->compare3(hello, hello2, 6, 7) < 0);
+        REQUIRE(dt->compare3(hello2, hello, 7, 6) > 0);
+        REQUIRE(dt->compare3(hello, "hello", 6, 6) == 0);
 
         char buffer[32];
         REQUIRE(dt->copy(buffer, hello, 32, strlen(hello) + 1));
         REQUIRE(strncmp(hello, buffer, strlen(hello)) == 0);
+
+        // 最短分隔键
+        const char *x = "https://a.com/item/1234";
+        const char *y = "https://a.com/item/2000";
+        size_t len = dt->separate(buffer, x, y, strlen(x) + 1, strlen(y) + 1);
+        REQUIRE(len == 21);
+        REQUIRE(strcmp(buffer, "https://a.com/item/2") == 0);
+        REQUIRE(dt->compare(x, buffer, strlen(x) + 1, len));
+        REQUIRE(!dt->compare(y, buffer, strlen(y) + 1, len));
+        // y只比x多一个字节时无法截短
+        len = dt->separate(buffer, hello, hello2, 6, 7);
+        REQUIRE(len == 7);
+        REQUIRE(strcmp(buffer, hello2) == 0);
     }
     SECTION("BIGINT")
     {
@@ -32,5 +50,101 @@ TEST_CASE("db/datatype.h")
         long long test1=1;
         long long test2=2;
         REQUIRE(dt->compare(&test1, &test2, 1, 1));
+        REQUIRE(dt->compare3(&test1, &test2, 8, 8) < 0);
+        REQUIRE(dt->compare3(&test2, &test1, 8, 8) > 0);
+        REQUIRE(dt->compare3(&test1, &test1, 8, 8) == 0);
+        long long min = -1LL << 63;
+        REQUIRE(dt->compare3(&min, &test1, 8, 8) < 0);
+        REQUIRE(dt->separate == NULL);
+    }
+    SECTION("normalize")
+    {
+        // 转换后按memcmp比较和原来的顺序一致
+        DataType *bytes = findDataType("BYTES");
+        DataType *dt = findDataType("BIGINT");
+        long long values[] = {-1LL << 62, -300, -1, 0, 1, 256, 1LL << 62};
+        unsigned char x[8], y[8];
+        for (int i = 0; i + 1 < 7; i++) {
+            REQUIRE(dt->normalize(x, &values[i], 8) == 8);
+            REQUIRE(dt->normalize(y, &values[i + 1], 8) == 8);
+            REQUIRE(memcmp(x, y, 8) < 0);
+            REQUIRE(bytes->compare(x, y, 8, 8));
+            long long back;
+            REQUIRE(dt->denormalize(&back, x, 8) == 8);
+            REQUIRE(back == values[i]);
+        }
+
+        dt = findDataType("SMALLINT");
+        short s1 = -2, s2 = 3, back;
+        dt->normalize(x, &s1, 2);
+        dt->normalize(y, &s2, 2);
+        REQUIRE(memcmp(x, y, 2) < 0);
+        dt->denormalize(&back, x, 2);
+        REQUIRE(back == s1);
+
+        // 字符串截到'\0'，短的排在前面
+        dt = findDataType("VARCHAR");
+        char a[16], b[16];
+        size_t la = dt->normalize(a, "ab", 2);
+        size_t lb = dt->normalize(b, "abc\0xyz", 7);
+        REQUIRE(la == 3);
+        REQUIRE(lb == 4);
+        REQUIRE(bytes->compare(a, b, la, lb));
+        REQUIRE(!bytes->compare(b, a, lb, la));
+        REQUIRE(bytes->separate(a, a, b, la, lb) == 3);
+        REQUIRE(memcmp(a, "abc", 3) == 0);
+    }
+    SECTION("TIMESTAMP")
+    {
+        DataType *dt = findDataType("TIMESTAMP");
+        REQUIRE(dt);
+        REQUIRE(dt->size == 8);
+        TimeStamp x, y;
+        REQUIRE(x.fromString("2024_02_29-23:59:59.999999"));
+        REQUIRE(y.fromString("2024_03_01-00:00:00.000000"));
+        REQUIRE(dt->compare(&x.stamp_, &y.stamp_, 8, 8));
+        REQUIRE(dt->compare3(&y.stamp_, &x.stamp_, 8, 8) > 0);
+
+        // DATE是当天0点
+        dt = findDataType("DATE");
+        REQUIRE(dt);
+        TimeStamp dx = x.date(), dy = y.date();
+        char buffer[TimeStamp::STRING_SIZE];
+        REQUIRE(dx.toString(buffer, sizeof(buffer)));
+        REQUIRE(strcmp(buffer, "2024_02_29-00:00:00.000000") == 0);
+        REQUIRE(dt->compare3(&dx.stamp_, &dy.stamp_, 8, 8) < 0);
+        TimeStamp same = x.date();
+        REQUIRE(dt->compare3(&dx.stamp_, &same.stamp_, 8, 8) == 0);
+        x.setMicros(-1);
+        REQUIRE(x.date().micros() == -TimeStamp::MICROS_PER_DAY);
+    }
+    SECTION("DOUBLE")
+    {
+        DataType *dt = findDataType("DOUBLE");
+        DataType *bytes = findDataType("BYTES");
+        REQUIRE(dt);
+        REQUIRE(dt->size == 8);
+        double inf = std::numeric_limits<double>::infinity();
+        double values[] = {
+            -inf, -1e300, -2.5, -1e-300, -0.0, 0.0, 1e-300, 1.0, 3.5, inf};
+        const int count = sizeof(values) / sizeof(double);
+        unsigned char x[8], y[8];
+        for (int i = 0; i + 1 < count; i++) {
+            REQUIRE(dt->compare(&values[i], &values[i + 1], 8, 8));
+            REQUIRE(!dt->compare(&values[i + 1], &values[i], 8, 8));
+            REQUIRE(dt->compare3(&values[i], &values[i + 1], 8, 8) < 0);
+            REQUIRE(dt->compare3(&values[i], &values[i], 8, 8) == 0);
+            // 转换后按字节比较顺序不变
+            REQUIRE(dt->normalize(x, &values[i], 8) == 8);
+            REQUIRE(dt->normalize(y, &values[i + 1], 8) == 8);
+            REQUIRE(bytes->compare(x, y, 8, 8));
+            double back;
+            REQUIRE(dt->denormalize(&back, x, 8) == 8);
+            REQUIRE(memcmp(&back, &values[i], 8) == 0);
+        }
+        // NaN也有确定的位置
+        double nan = std::numeric_limits<double>::quiet_NaN();
+        REQUIRE(dt->compare3(&nan, &nan, 8, 8) == 0);
+        REQUIRE(dt->compare(&inf, &nan, 8, 8));
     }
-}
\ No newline at end of file
+}
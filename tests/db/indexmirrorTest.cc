@@ -0,0 +1,107 @@
+////
+// @file indexmirrorTest.cc
+// @brief
+//
+//
+#include "../catch.hpp"
+#include <db/indexmirror.h>
+#include <stdio.h>
+#include <stdint.h>
+using namespace db;
+
+// 用IndexBlock::upperBound得到应当进入的儿子
+static int childOf(IndexBlock &block, struct iovec *key, DataType *type)
+{
+    unsigned short pos = block.upperBound(key, type, 0);
+    return pos ? block.getPointer(pos - 1) : block.getNextid();
+}
+
+TEST_CASE("db/indexmirror.h")
+{
+    SECTION("fixed")
+    {
+        IndexBlock block;
+        unsigned char buffer[Block::BLOCK_SIZE];
+        block.attach(buffer);
+        block.clear(3);
+        block.setLayout(INDEX_LAYOUT_INT64);
+        block.setNodeType(NODE_TYPE_INTERNAL);
+        block.setNextid(100);
+        DataType *type = findDataType("BIGINT");
+
+        // 键值是10的倍数，儿子是键值+1
+        long long id;
+        struct iovec key;
+        key.iov_base = &id;
+        key.iov_len = sizeof(id);
+        for (id = 0; id < 5000; id += 10)
+            REQUIRE(block.appendEntry(&key, (int) id + 1));
+
+        IndexMirror mirror;
+        mirror.reset(type);
+        REQUIRE(mirror.find(3) == NULL);
+        IndexMirror::Node *node = mirror.load(block);
+        REQUIRE(mirror.find(3) == node);
+        REQUIRE(node->nodeType == NODE_TYPE_INTERNAL);
+        REQUIRE(node->count == 500);
+        REQUIRE((uintptr_t) node->keys % IndexMirror::LINE_SIZE == 0);
+        REQUIRE((uintptr_t) node->children % IndexMirror::LINE_SIZE == 0);
+        for (id = -5; id <= 5005; id++)
+            REQUIRE(mirror.search(node, &key) == childOf(block, &key, type));
+
+        // 改写后重建，回收后丢弃
+        block.removeEntries(0, 250);
+        mirror.refresh(block);
+        node = mirror.find(3);
+        REQUIRE(node->count == 250);
+        for (id = -5; id <= 5005; id += 3)
+            REQUIRE(mirror.search(node, &key) == childOf(block, &key, type));
+        mirror.drop(3);
+        REQUIRE(mirror.find(3) == NULL);
+        mirror.refresh(block);
+        REQUIRE(mirror.size() == 0);
+    }
+    SECTION("record")
+    {
+        IndexBlock block;
+        unsigned char buffer[Block::BLOCK_SIZE];
+        block.attach(buffer);
+        block.clear(4);
+        block.setNodeType(NODE_TYPE_POINT_TO_LEAF);
+        block.setNextid(100);
+        DataType *type = findDataType("VARCHAR");
+
+        // 有公共前缀的变长键值
+        char name[32];
+        struct iovec key;
+        key.iov_base = name;
+        for (int i = 0; i < 300; i += 2) {
+            key.iov_len = snprintf(name, sizeof(name), "user/%05d", i);
+            REQUIRE(block.insertEntry(&key, i + 1, type));
+        }
+        REQUIRE(block.compress());
+        REQUIRE(block.getPrefixLength() > 0);
+
+        IndexMirror mirror;
+        mirror.reset(type);
+        IndexMirror::Node *node = mirror.load(block);
+        REQUIRE(node->width == 0);
+        for (int i = -1; i <= 301; i++) {
+            key.iov_len = snprintf(name, sizeof(name), "user/%05d", i);
+            REQUIRE(mirror.search(node, &key) == childOf(block, &key, type));
+        }
+        key.iov_len = snprintf(name, sizeof(name), "a");
+        REQUIRE(mirror.search(node, &key) == 100);
+        key.iov_len = snprintf(name, sizeof(name), "z");
+        REQUIRE(mirror.search(node, &key) == 299);
+
+        // 空节点只有最左边指针
+        block.clear(5);
+        block.setNextid(7);
+        node = mirror.load(block);
+        REQUIRE(mirror.size() == 2);
+        REQUIRE(mirror.search(node, &key) == 7);
+        mirror.clear();
+        REQUIRE(mirror.size() == 0);
+    }
+}
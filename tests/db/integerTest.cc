@@ -6,6 +6,9 @@
 //
 #include "../catch.hpp"
 #include <db/integer.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
 using namespace db;
 
 TEST_CASE("db/integer.h")
@@ -91,4 +94,84 @@ TEST_CASE("db/integer.h")
         REQUIRE(it.decode((char *) &x4, 8));
         REQUIRE(it.get() == 0x40000000);
     }
-}
\ No newline at end of file
+    SECTION("array")
+    {
+        // 各种长度混在一起，最后是结束标记1
+        const size_t count = 4096;
+        std::vector<unsigned long long> values(count);
+        for (size_t i = 0; i < count - 1; i++) {
+            unsigned long long limits[] = {
+                0x3F, 0x3FFF, 0x3FFFFFFF, 0x3FFFFFFFFFFFFFFF};
+            values[i] = (i * 2654435761ULL) % (limits[i % 4] + 1);
+            if (values[i] == 1) values[i] = 2;
+        }
+        values[count - 1] = 1;
+
+        // 批量编码和逐个编码的结果一致
+        std::vector<char> batch(count * 8), scalar(count * 8);
+        size_t bytes = Integer::encodeArray(
+            &values[0], count, &batch[0], batch.size());
+        size_t offset = 0;
+        for (size_t i = 0; i < count; i++) {
+            Integer it;
+            it.set(values[i]);
+            REQUIRE(it.encode(&scalar[offset], scalar.size() - offset));
+            offset += it.size();
+        }
+        REQUIRE(bytes == offset);
+        REQUIRE(memcmp(&batch[0], &scalar[0], bytes) == 0);
+
+        // 批量解码，在结束标记处停下，末尾不足8B时也正确
+        std::vector<unsigned long long> decoded(count);
+        size_t used = 0;
+        REQUIRE(
+            Integer::decodeArray(
+                &batch[0], bytes, &decoded[0], count, 1, used) == count);
+        REQUIRE(used == bytes);
+        REQUIRE(decoded == values);
+        REQUIRE(
+            Integer::decodeArray(
+                &batch[0], bytes, &decoded[0], 10, 1, used) == 10);
+        REQUIRE(Integer::decodeArray(&batch[0], 3, &decoded[0], 10, 1, used) <
+                10);
+        unsigned long long big = 0x4000000000000000ULL;
+        REQUIRE(Integer::encodeArray(&big, 1, &batch[0], batch.size()) == 0);
+        REQUIRE(Integer::encodeArray(&values[0], 4, &batch[0], 3) == 0);
+
+        // 计时：同样的数据逐个解码和批量解码
+        const int rounds = 200;
+        unsigned long long sum[2] = {0, 0};
+        std::chrono::steady_clock::duration cost[2];
+        for (int path = 0; path < 2; path++) {
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            for (int r = 0; r < rounds; r++) {
+                if (path) {
+                    Integer::decodeArray(
+                        &batch[0], bytes, &decoded[0], count, 1, used);
+                    for (size_t i = 0; i < count; i++)
+                        sum[path] += decoded[i];
+                    continue;
+                }
+                Integer it;
+                offset = 0;
+                for (size_t i = 0; i < count; i++) {
+                    it.decode(&batch[offset], bytes - offset);
+                    sum[path] += it.get();
+                    offset += it.size();
+                }
+            }
+            cost[path] = std::chrono::steady_clock::now() - start;
+        }
+        REQUIRE(sum[0] == sum[1]);
+        std::cout << "integer decode: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(
+                         cost[0])
+                         .count()
+                  << "us, batch: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(
+                         cost[1])
+                         .count()
+                  << "us" << std::endl;
+    }
+}
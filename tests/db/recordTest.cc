@@ -76,5 +76,118 @@ TEST_CASE("db/record.h")
         REQUIRE(iov2[2].iov_len == strlen(hello) + 1);
         REQUIRE(length == length2);
         REQUIRE(iov2[3].iov_len == sizeof(size_t));
+        REQUIRE(header2 == header);
+
+        REQUIRE(record.getHeader() == header);
+        REQUIRE(!record.isTombstone());
+        record.setTombstone();
+        REQUIRE(record.isTombstone());
+        REQUIRE(record.getHeader() == (header | Record::MASK_TOMBSTONE));
+        REQUIRE(record.get(iov2, 4, &header2));
+        REQUIRE(length == length2);
+    }
+    SECTION("fixed")
+    {
+        struct iovec iov[3];
+        long long id = 7;
+        const char *name = "junix";
+        int age = 18;
+        iov[0].iov_base = &id;
+        iov[0].iov_len = sizeof(id);
+        iov[1].iov_base = (void *) name;
+        iov[1].iov_len = strlen(name) + 1;
+        iov[2].iov_base = &age;
+        iov[2].iov_len = sizeof(age);
+
+        // 4B字段数+总长度，3个2B偏移量，header，字段
+        std::pair<size_t, size_t> ret =
+            Record::size(iov, 3, Record::FORMAT_FIXED);
+        REQUIRE(ret.second == 10);
+        REQUIRE(ret.first == 10 + 1 + 8 + 6 + 4);
+
+        unsigned char buffer[80];
+        Record record;
+        record.attach(buffer, 80);
+        unsigned char header = 0x08;
+        REQUIRE(record.set(iov, 3, &header, Record::FORMAT_FIXED) == 32);
+        REQUIRE(record.isFixed());
+        REQUIRE(buffer[0] >> 6 == 2);
+        REQUIRE(record.length() == ret.first);
+        REQUIRE(record.fields() == 3);
+        REQUIRE(record.headerOffset() == 10);
+        REQUIRE(record.getHeader() == header);
+
+        // 逐个字段引用
+        struct iovec field;
+        REQUIRE(record.specialRef(field, 0));
+        REQUIRE(*(long long *) field.iov_base == id);
+        REQUIRE(field.iov_len == sizeof(id));
+        REQUIRE(record.specialRef(field, 1));
+        REQUIRE(strcmp((const char *) field.iov_base, name) == 0);
+        REQUIRE(field.iov_len == strlen(name) + 1);
+        REQUIRE(record.specialRef(field, 2));
+        REQUIRE(*(int *) field.iov_base == age);
+        REQUIRE(field.iov_len == sizeof(age));
+        REQUIRE(!record.specialRef(field, 3));
+
+        // ref和get与变长格式一致
+        struct iovec iov2[3];
+        unsigned char header2;
+        REQUIRE(record.ref(iov2, 3, &header2));
+        REQUIRE(header2 == header);
+        REQUIRE(iov2[1].iov_len == strlen(name) + 1);
+        REQUIRE(!record.ref(iov2, 2, &header2));
+        long long id2;
+        char name2[16];
+        int age2;
+        iov2[0].iov_base = &id2;
+        iov2[0].iov_len = sizeof(id2);
+        iov2[1].iov_base = name2;
+        iov2[1].iov_len = 4;
+        iov2[2].iov_base = &age2;
+        iov2[2].iov_len = sizeof(age2);
+        REQUIRE(!record.get(iov2, 3, &header2));
+        iov2[1].iov_len = sizeof(name2);
+        REQUIRE(record.get(iov2, 3, &header2));
+        REQUIRE(id2 == id);
+        REQUIRE(strcmp(name2, name) == 0);
+        REQUIRE(age2 == age);
+
+        record.setTombstone();
+        REQUIRE(record.isTombstone());
+        REQUIRE(record.specialRef(field, 2));
+        REQUIRE(*(int *) field.iov_base == age);
+    }
+    SECTION("project")
+    {
+        // 两种格式投影的结果都和ref一致
+        struct iovec iov[5];
+        int values[5] = {10, 20, 30, 40, 50};
+        for (int i = 0; i < 5; i++) {
+            iov[i].iov_base = &values[i];
+            iov[i].iov_len = sizeof(int) * (i % 2 + 1) - (i == 4);
+        }
+        int formats[2] = {Record::FORMAT_VARINT, Record::FORMAT_FIXED};
+        for (int f = 0; f < 2; f++) {
+            unsigned char buffer[80];
+            Record record;
+            record.attach(buffer, 80);
+            unsigned char header = 0;
+            REQUIRE(record.set(iov, 5, &header, formats[f]) > 0);
+
+            struct iovec all[5];
+            unsigned char header2;
+            REQUIRE(record.ref(all, 5, &header2));
+            unsigned int columns[3] = {4, 1, 3};
+            struct iovec fields[3];
+            REQUIRE(record.project(fields, columns, 3));
+            for (int i = 0; i < 3; i++) {
+                REQUIRE(fields[i].iov_base == all[columns[i]].iov_base);
+                REQUIRE(fields[i].iov_len == all[columns[i]].iov_len);
+            }
+            REQUIRE(*(int *) fields[1].iov_base == 20);
+            columns[2] = 5;
+            REQUIRE(!record.project(fields, columns, 3));
+        }
     }
-}
\ No newline at end of file
+}
@@ -5,6 +5,10 @@
 //
 #include "../catch.hpp"
 #include <db/schema.h>
+#include <db/block.h>
+#include <stdio.h>
+#include <chrono>
+#include <iostream>
 using namespace db;
 
 TEST_CASE("db/schema.h")
@@ -41,9 +45,31 @@ TEST_CASE("db/schema.h")
 
         relation.count = 3;
         relation.key = 0;
+        relation.fillFactor = 90;
+        relation.splitRatio = 80;
+
+        // 合并下限不能超过填充因子
+        relation.mergeRatio = 95;
+        ret = schema.create("table", relation);
+        REQUIRE(ret == EINVAL);
+        relation.mergeRatio = DEFAULT_MERGE_RATIO;
 
         ret = schema.create("table", relation);
         REQUIRE(ret == S_OK);
+        // 调用方的info保持主机字节序
+        REQUIRE(relation.count == 3);
+        REQUIRE(relation.fields[2].length == -255);
+
+        // 组合键(phone, id)，补一个隐藏列
+        relation.dataPath = "composite.dat";
+        relation.keys.push_back(1);
+        relation.keys.push_back(1);
+        REQUIRE(schema.create("composite", relation) == EINVAL);
+        relation.keys[1] = 3;
+        REQUIRE(schema.create("composite", relation) == EINVAL);
+        relation.keys[1] = 0;
+        REQUIRE(schema.create("composite", relation) == S_OK);
+        REQUIRE(relation.count == 3);
     }
 
     SECTION("load")
@@ -58,10 +84,166 @@ TEST_CASE("db/schema.h")
         ret = schema.loadData(bret.first);
         REQUIRE(ret == S_OK);
 
+        RelationInfo &info = bret.first->second;
+        REQUIRE(info.count == 3);
+        REQUIRE(info.key == 0);
+        REQUIRE(info.fields.size() == 3);
+        REQUIRE(info.fields[1].name == "phone");
+        REQUIRE(info.fields[1].index == 1);
+        REQUIRE(info.fields[2].length == -255);
+        REQUIRE(info.fields[2].fieldType == "VARCHAR");
+        REQUIRE(info.fillFactor == 90);
+        REQUIRE(info.splitRatio == 80);
+        REQUIRE(info.mergeRatio == DEFAULT_MERGE_RATIO);
+        REQUIRE(info.borrowRatio == DEFAULT_BORROW_RATIO);
+
+        bret = schema.lookup("composite");
+        REQUIRE(bret.second);
+        REQUIRE(schema.loadData(bret.first) == S_OK);
+        RelationInfo &composite = bret.first->second;
+        REQUIRE(composite.count == 4);
+        REQUIRE(composite.key == 3);
+        REQUIRE(composite.keys.size() == 2);
+        REQUIRE(composite.keys[0] == 1);
+        REQUIRE(composite.keys[1] == 0);
+        REQUIRE(composite.fields[3].name == COMPOSITE_KEY_NAME);
+        REQUIRE(composite.fields[3].fieldType == "BYTES");
+        REQUIRE(info.keys.empty());
+
         // 删除表，删除元文件
-        Schema::TableSpace::iterator it = bret.first;
+        composite.dataFile.close();
+        REQUIRE(composite.dataFile.remove("composite.dat") == S_OK);
+        Schema::TableSpace::iterator it = schema.lookup("table").first;
         it->second.dataFile.close();
         REQUIRE(it->second.dataFile.remove("table.dat") == S_OK);
         REQUIRE(schema.destroy() == S_OK);
     }
+
+    SECTION("catalog")
+    {
+        // 建很多表，元信息跨越多个meta block
+        const int count = 3000;
+        char name[32], path[64];
+        RelationInfo relation;
+        FieldInfo field;
+        field.name = "id";
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        relation.count = 1;
+        {
+            Schema schema("catalog.db");
+            REQUIRE(schema.open() == S_OK);
+            for (int i = 0; i < count - 1; i++) {
+                snprintf(name, sizeof(name), "table%04d", i);
+                snprintf(path, sizeof(path), "data/table%04d.dat", i);
+                relation.dataPath = path;
+                REQUIRE(schema.create(name, relation) == S_OK);
+            }
+            REQUIRE(schema.create("table0000", relation) == EEXIST);
+            // 一个block都放不下的表
+            relation.dataPath = std::string(Block::BLOCK_SIZE, 'x');
+            REQUIRE(schema.create("huge", relation) == EINVAL);
+            REQUIRE(!schema.lookup("huge").second);
+        }
+        // 重新打开后接着在链尾分配
+        {
+            Schema schema("catalog.db");
+            REQUIRE(schema.open() == S_OK);
+            snprintf(name, sizeof(name), "table%04d", count - 1);
+            snprintf(path, sizeof(path), "data/table%04d.dat", count - 1);
+            relation.dataPath = path;
+            REQUIRE(schema.create(name, relation) == S_OK);
+        }
+        // 模拟追加block后崩溃：新block已写，还没接到链尾，root数目未改
+        {
+            FILE *fp = fopen("catalog.db", "ab");
+            std::string fresh(Block::BLOCK_SIZE, 'x');
+            REQUIRE(fwrite(fresh.data(), 1, fresh.size(), fp) == fresh.size());
+            fclose(fp);
+        }
+
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        Schema schema("catalog.db");
+        REQUIRE(schema.open() == S_OK);
+        std::chrono::steady_clock::duration cost =
+            std::chrono::steady_clock::now() - start;
+        for (int i = 0; i < count; i++) {
+            snprintf(name, sizeof(name), "table%04d", i);
+            snprintf(path, sizeof(path), "data/table%04d.dat", i);
+            std::pair<Schema::TableSpace::iterator, bool> bret =
+                schema.lookup(name);
+            REQUIRE(bret.second);
+            REQUIRE(bret.first->second.dataPath == path);
+        }
+        std::cout << "open catalog of " << count << " tables: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(
+                         cost)
+                         .count()
+                  << "us" << std::endl;
+
+        // root中的数目超过文件长度
+        {
+            FILE *fp = fopen("catalog.db", "r+b");
+            unsigned char rb[Root::ROOT_SIZE];
+            REQUIRE(fread(rb, 1, sizeof(rb), fp) == sizeof(rb));
+            Root root;
+            root.attach(rb);
+            root.setCnt(100000);
+            root.setChecksum();
+            fseek(fp, 0, SEEK_SET);
+            REQUIRE(fwrite(rb, 1, sizeof(rb), fp) == sizeof(rb));
+            fclose(fp);
+            Schema corrupt("catalog.db");
+            REQUIRE(corrupt.open() == EINVAL);
+        }
+        REQUIRE(schema.destroy() == S_OK);
+    }
+
+    SECTION("badRecord")
+    {
+        RelationInfo relation;
+        FieldInfo field;
+        field.name = "id";
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        relation.count = 1;
+        relation.dataPath = "data/good.dat";
+        {
+            Schema schema("badcat.db");
+            REQUIRE(schema.open() == S_OK);
+            REQUIRE(schema.create("good", relation) == S_OK);
+        }
+        // 往meta block里塞两条字段数不对的记录
+        {
+            FILE *fp = fopen("badcat.db", "r+b");
+            unsigned char buffer[Block::BLOCK_SIZE];
+            fseek(fp, Root::ROOT_SIZE, SEEK_SET);
+            REQUIRE(fread(buffer, 1, sizeof(buffer), fp) == sizeof(buffer));
+            MetaBlock block;
+            block.attach(buffer);
+            std::vector<struct iovec> iov(18);
+            const char *text = "bad";
+            for (size_t i = 0; i < iov.size(); i++) {
+                iov[i].iov_base = (void *) text;
+                iov[i].iov_len = 4;
+            }
+            unsigned char header = 0;
+            REQUIRE(block.allocate(&header, &iov[0], 5));
+            REQUIRE(block.allocate(&header, &iov[0], 18));
+            block.setChecksum();
+            fseek(fp, Root::ROOT_SIZE, SEEK_SET);
+            REQUIRE(fwrite(buffer, 1, sizeof(buffer), fp) == sizeof(buffer));
+            fclose(fp);
+        }
+        Schema schema("badcat.db");
+        REQUIRE(schema.open() == S_OK);
+        REQUIRE(schema.lookup("good").second);
+        REQUIRE(!schema.lookup("bad").second);
+        relation.dataPath = "data/other.dat";
+        REQUIRE(schema.create("other", relation) == S_OK);
+        REQUIRE(schema.destroy() == S_OK);
+    }
 }
\ No newline at end of file
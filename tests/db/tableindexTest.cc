@@ -6,8 +6,10 @@
 //
 #include "../catch.hpp"
 #include <db/tableindex.h>
+#include <db/timestamp.h>
 #include <iostream>
 #include <fstream>
+#include <chrono>
 using namespace db;
 
 TEST_CASE("db/tableindex.h")
@@ -171,6 +173,1520 @@ TEST_CASE("db/tableindex.h")
         outputfile.close();
         table.close("tablee.dat");
     }
+    SECTION("removeRange")
+    {
+        Table table;
+        int ret = table.open("tablee");
+        REQUIRE(ret == S_OK);
+        ret = table.initial();
+        REQUIRE(ret == S_OK);
+
+        // 剩余80000~100000，删除[85000, 95000]
+        long long lo = 85000, hi = 95000;
+        iovec loField, hiField;
+        loField.iov_base = &lo;
+        loField.iov_len = sizeof(long long);
+        hiField.iov_base = &hi;
+        hiField.iov_len = sizeof(long long);
+        unsigned int before = table.blockNum();
+        ret = table.removeRange(loField, hiField);
+        REQUIRE(ret == S_OK);
+
+        long long cnt = 80000;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1) {
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                Record record = *it2;
+                iovec keyField;
+                record.specialRef(keyField, 0);
+                long long id = *((long long *) keyField.iov_base);
+                REQUIRE(id == cnt);
+                cnt = cnt == lo - 1 ? hi + 1 : cnt + 1;
+            }
+        }
+        REQUIRE(cnt == 100001);
+
+        // 摘除的block可以被分裂复用
+        for (long long i = lo; i <= hi; i++) {
+            struct iovec iov[3];
+            long long id = i;
+            iov[0].iov_base = &id;
+            iov[0].iov_len = sizeof(long long);
+            char *phone = "13534500702";
+            iov[1].iov_base = (void *) phone;
+            iov[1].iov_len = strlen(phone) + 1;
+            char *name = "Junix";
+            iov[2].iov_base = (void *) name;
+            iov[2].iov_len = strlen(name) + 1;
+            unsigned char header = 0;
+            ret = table.insert(&header, iov, 3);
+            REQUIRE(ret == S_OK);
+        }
+        REQUIRE(table.blockNum() == before);
+
+        cnt = 80000;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1) {
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                Record record = *it2;
+                iovec keyField;
+                record.specialRef(keyField, 0);
+                REQUIRE(*((long long *) keyField.iov_base) == cnt++);
+            }
+        }
+        REQUIRE(cnt == 100001);
+        table.close("tablee");
+    }
+    SECTION("tombstone")
+    {
+        Table table;
+        int ret = table.open("tablee");
+        REQUIRE(ret == S_OK);
+        ret = table.initial();
+        REQUIRE(ret == S_OK);
+        table.setDeleteMode(DELETE_MODE_TOMBSTONE);
+
+        // 只打标记，不合并block
+        unsigned int blocks = table.blockNum();
+        for (long long i = 80000; i < 81000; i++) {
+            iovec field;
+            long long id = i;
+            field.iov_base = &id;
+            field.iov_len = sizeof(long long);
+            ret = table.remove(field);
+            REQUIRE(ret == S_OK);
+        }
+        REQUIRE(table.blockNum() == blocks);
+
+        // 扫描跳过tombstone
+        long long cnt = 81000;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1) {
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                Record record = *it2;
+                REQUIRE(!record.isTombstone());
+                iovec keyField;
+                record.specialRef(keyField, 0);
+                REQUIRE(*((long long *) keyField.iov_base) == cnt++);
+            }
+        }
+        REQUIRE(cnt == 100001);
+        table.close("tablee");
+    }
+    SECTION("compact")
+    {
+        Table table;
+        int ret = table.open("tablee");
+        REQUIRE(ret == S_OK);
+        ret = table.initial();
+        REQUIRE(ret == S_OK);
+
+        // tombstone被回收，填充度低的叶子被合并
+        unsigned int before = 0, after = 0;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1)
+            before++;
+        ret = table.compact();
+        REQUIRE(ret == S_OK);
+        int fragment = Table::COMPACT_FRAGMENT_SIZE;
+        long long cnt = 81000;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1) {
+            after++;
+            REQUIRE((*it1).getFragment() < fragment);
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                Record record = *it2;
+                iovec keyField;
+                record.specialRef(keyField, 0);
+                REQUIRE(*((long long *) keyField.iov_base) == cnt++);
+            }
+        }
+        REQUIRE(cnt == 100001);
+        REQUIRE(after < before);
+
+        // 后台整理期间插入、删除
+        ret = table.startCompactor(1);
+        REQUIRE(ret == S_OK);
+        for (long long i = 80000; i < 81000; i++) {
+            struct iovec iov[3];
+            long long id = i;
+            iov[0].iov_base = &id;
+            iov[0].iov_len = sizeof(long long);
+            char *phone = "13534500702";
+            iov[1].iov_base = (void *) phone;
+            iov[1].iov_len = strlen(phone) + 1;
+            char *name = "Junix";
+            iov[2].iov_base = (void *) name;
+            iov[2].iov_len = strlen(name) + 1;
+            unsigned char header = 0;
+            ret = table.insert(&header, iov, 3);
+            REQUIRE(ret == S_OK);
+        }
+        for (long long i = 90000; i < 95000; i++) {
+            iovec field;
+            long long id = i;
+            field.iov_base = &id;
+            field.iov_len = sizeof(long long);
+            ret = table.remove(field);
+            REQUIRE(ret == S_OK);
+        }
+        table.stopCompactor();
+
+        cnt = 80000;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1) {
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                Record record = *it2;
+                iovec keyField;
+                record.specialRef(keyField, 0);
+                REQUIRE(*((long long *) keyField.iov_base) == cnt);
+                cnt = cnt == 89999 ? 95000 : cnt + 1;
+            }
+        }
+        REQUIRE(cnt == 100001);
+        table.close("tablee");
+    }
+    SECTION("project")
+    {
+        Table table;
+        REQUIRE(table.open("tablee") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+
+        // 只取name和id两列，顺序按给定的列
+        unsigned int columns[2] = {2, 0};
+        Projection projection(columns, 2);
+        long long cnt = 80000;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1) {
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                struct iovec *fields = it2.project(projection);
+                REQUIRE(fields == &projection.fields[0]);
+                REQUIRE(*(long long *) fields[1].iov_base == cnt);
+                REQUIRE(strncmp((char *) fields[0].iov_base, "Junix", 5) == 0);
+                REQUIRE(
+                    fields[0].iov_len == strlen((char *) fields[0].iov_base) + 1);
+                struct iovec name;
+                (*it2).specialRef(name, 2);
+                REQUIRE(fields[0].iov_base == name.iov_base);
+                cnt = cnt == 89999 ? 95000 : cnt + 1;
+            }
+        }
+        REQUIRE(cnt == 100001);
+
+        // 不存在的列
+        columns[0] = 3;
+        Projection bad(columns, 2);
+        auto it1 = table.blockBegin();
+        auto it2 = table.begin(it1);
+        REQUIRE(it2.project(bad) == NULL);
+        table.close("tablee");
+    }
+    SECTION("fillFactor")
+    {
+        RelationInfo relation;
+        relation.dataPath = "tablef.dat";
+        relation.indexPath = "tablef.idx";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        field.name = "name";
+        field.index = 1;
+        field.length = -255;
+        field.fieldType = "VARCHAR";
+        relation.fields.push_back(field);
+        relation.count = 2;
+        relation.key = 0;
+        // 顺序插入、留30%余量
+        relation.fillFactor = 70;
+        relation.splitRatio = 90;
+
+        Table table;
+        relation.mergeRatio = 70;
+        REQUIRE(table.create("tablef", relation) == EINVAL);
+        relation.mergeRatio = 30;
+        REQUIRE(table.create("tablef", relation) == S_OK);
+        REQUIRE(table.open("tablef") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+
+        std::string name(200, 'x');
+        for (long long id = 0; id < 5000; id++) {
+            struct iovec iov[2];
+            iov[0].iov_base = &id;
+            iov[0].iov_len = sizeof(long long);
+            iov[1].iov_base = (void *) name.c_str();
+            iov[1].iov_len = name.size() + 1;
+            unsigned char header = 0;
+            REQUIRE(table.insert(&header, iov, 2) == S_OK);
+        }
+
+        // 每个叶子都不超过填充因子，按90%分裂后平均填充度接近63%
+        int limit = DataBlock::INITIAL_FREE_SPACE_SIZE * 70 / 100;
+        for (auto it = table.blockBegin(); it != table.blockEnd(); ++it)
+            REQUIRE((*it).getUsedspace() <= limit);
+        SpaceInfo info;
+        REQUIRE(table.spaceInfo(info) == S_OK);
+        REQUIRE(info.leafBlocks > 1);
+        REQUIRE(info.fill > 0.55);
+        REQUIRE(info.fill < 0.7);
+        REQUIRE(info.amplification > 1 / 0.7);
+        table.close("tablef");
+        REQUIRE(table.destroy("tablef.dat", "tablef.idx") == S_OK);
+    }
+    SECTION("largeRows")
+    {
+        RelationInfo relation;
+        relation.dataPath = "tablew.dat";
+        relation.indexPath = "tablew.idx";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        field.name = "name";
+        field.index = 1;
+        field.length = -20000;
+        field.fieldType = "VARCHAR";
+        relation.fields.push_back(field);
+        relation.count = 2;
+        relation.key = 0;
+
+        Table table;
+        REQUIRE(table.create("tablew", relation) == S_OK);
+        REQUIRE(table.open("tablew") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+
+        // 两条大记录放不进一个叶子，只有一个slot的叶子不能分裂
+        long long ids[] = {10, 20, 5, 30};
+        size_t sizes[] = {7000, 9500, 9500, 17000};
+        for (int i = 0; i < 4; i++) {
+            std::string name(sizes[i], 'a' + i);
+            struct iovec iov[2];
+            iov[0].iov_base = &ids[i];
+            iov[0].iov_len = sizeof(long long);
+            iov[1].iov_base = (void *) name.c_str();
+            iov[1].iov_len = name.size() + 1;
+            unsigned char header = 0;
+            // 一个空block都放不下
+            REQUIRE(table.insert(&header, iov, 2) == (i < 3 ? S_OK : S_FALSE));
+        }
+
+        long long expect[] = {5, 10, 20};
+        size_t lengths[] = {9500, 7000, 9500};
+        int rows = 0;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1)
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                struct iovec key, name;
+                (*it2).specialRef(key, 0);
+                (*it2).specialRef(name, 1);
+                REQUIRE(rows < 3);
+                REQUIRE(*(long long *) key.iov_base == expect[rows]);
+                REQUIRE(strlen((const char *) name.iov_base) == lengths[rows]);
+                rows++;
+            }
+        REQUIRE(rows == 3);
+        for (int i = 0; i < 4; i++) {
+            struct iovec keyField;
+            keyField.iov_base = &ids[i];
+            keyField.iov_len = sizeof(long long);
+            std::string row;
+            REQUIRE(table.get(keyField, row) == (i < 3 ? S_OK : S_FALSE));
+        }
+        table.close("tablew");
+        REQUIRE(table.destroy("tablew.dat", "tablew.idx") == S_OK);
+    }
+    SECTION("indexVersion")
+    {
+        RelationInfo relation;
+        relation.dataPath = "tableg.dat";
+        relation.indexPath = "tableg.idx";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        relation.count = 1;
+        relation.key = 0;
+
+        Table table;
+        REQUIRE(table.create("tableg", relation) == S_OK);
+        REQUIRE(table.open("tableg") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+        long long id = 1;
+        struct iovec iov;
+        iov.iov_base = &id;
+        iov.iov_len = sizeof(long long);
+        unsigned char header = 0;
+        REQUIRE(table.insert(&header, &iov, 1) == S_OK);
+        table.close("tableg");
+        REQUIRE(table.open("tableg") == S_OK);
+        table.close("tableg");
+
+        // 旧格式的索引文件没有版本号
+        {
+            FILE *fp = fopen("tableg.idx", "r+b");
+            unsigned char rb[Root::ROOT_SIZE];
+            REQUIRE(fread(rb, 1, sizeof(rb), fp) == sizeof(rb));
+            Root root;
+            root.attach(rb);
+            ::memset(root.getStats(), 0, sizeof(unsigned short));
+            root.setChecksum();
+            fseek(fp, 0, SEEK_SET);
+            REQUIRE(fwrite(rb, 1, sizeof(rb), fp) == sizeof(rb));
+            fclose(fp);
+        }
+        REQUIRE(table.open("tableg") == EINVAL);
+        REQUIRE(table.destroy("tableg.dat", "tableg.idx") == S_OK);
+    }
+    SECTION("keyFormat")
+    {
+        // 长公共前缀的字符串键值，比较不压缩和压缩前缀的索引大小
+        unsigned int indexBlocks[2];
+        std::string payload(1000, 'x');
+        for (unsigned short format = KEY_FORMAT_PLAIN;
+             format <= KEY_FORMAT_PREFIX;
+             format++) {
+            RelationInfo relation;
+            relation.dataPath = "tablep.dat";
+            relation.indexPath = "tablep.idx";
+            FieldInfo field;
+            field.name = "url";
+            field.index = 0;
+            field.length = -255;
+            field.fieldType = "VARCHAR";
+            relation.fields.push_back(field);
+            field.name = "body";
+            field.index = 1;
+            field.length = -2048;
+            field.fieldType = "VARCHAR";
+            relation.fields.push_back(field);
+            relation.count = 2;
+            relation.key = 0;
+            relation.keyFormat = format;
+
+            Table table;
+            std::string name = format ? "tablep" : "tablen";
+            REQUIRE(table.create(name.c_str(), relation) == S_OK);
+            REQUIRE(table.open(name.c_str()) == S_OK);
+            REQUIRE(table.initial() == S_OK);
+
+            // 乱序插入
+            char url[64];
+            for (int i = 0; i < 20000; i++) {
+                snprintf(
+                    url,
+                    sizeof(url),
+                    "https://www.example.com/catalog/items/%08d",
+                    i * 7919 % 20000);
+                struct iovec iov[2];
+                iov[0].iov_base = url;
+                iov[0].iov_len = strlen(url) + 1;
+                iov[1].iov_base = (void *) payload.c_str();
+                iov[1].iov_len = payload.size() + 1;
+                unsigned char header = 0;
+                REQUIRE(table.insert(&header, iov, 2) == S_OK);
+            }
+            indexBlocks[format] = table.indexBlockNum();
+
+            // 删除奇数键值
+            for (int i = 1; i < 20000; i += 2) {
+                snprintf(
+                    url,
+                    sizeof(url),
+                    "https://www.example.com/catalog/items/%08d",
+                    i);
+                struct iovec key;
+                key.iov_base = url;
+                key.iov_len = strlen(url) + 1;
+                REQUIRE(table.remove(key) == S_OK);
+            }
+
+            // 剩下的偶数键值有序
+            int cnt = 0;
+            for (auto it1 = table.blockBegin(); it1 != table.blockEnd();
+                 ++it1) {
+                for (auto it2 = table.begin(it1); it2 != table.end(it1);
+                     ++it2) {
+                    struct iovec key;
+                    (*it2).specialRef(key, 0);
+                    snprintf(
+                        url,
+                        sizeof(url),
+                        "https://www.example.com/catalog/items/%08d",
+                        cnt * 2);
+                    REQUIRE(strcmp((const char *) key.iov_base, url) == 0);
+                    cnt++;
+                }
+            }
+            REQUIRE(cnt == 10000);
+            table.close(name.c_str());
+            REQUIRE(table.destroy("tablep.dat", "tablep.idx") == S_OK);
+        }
+        REQUIRE(indexBlocks[KEY_FORMAT_PREFIX] < indexBlocks[KEY_FORMAT_PLAIN]);
+
+        // 前缀压缩只支持字符串键值
+        RelationInfo relation;
+        relation.dataPath = "tablep.dat";
+        relation.indexPath = "tablep.idx";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        relation.count = 1;
+        relation.key = 0;
+        relation.keyFormat = KEY_FORMAT_PREFIX;
+        Table table;
+        REQUIRE(table.create("tablei", relation) == EINVAL);
+        relation.keyFormat = 4;
+        REQUIRE(table.create("tablei", relation) == EINVAL);
+    }
+    SECTION("normalized")
+    {
+        // 有符号整数键值normalize后按字节比较，同时压缩前缀
+        RelationInfo relation;
+        relation.dataPath = "tablem.dat";
+        relation.indexPath = "tablem.idx";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        field.name = "body";
+        field.index = 1;
+        field.length = -2048;
+        field.fieldType = "VARCHAR";
+        relation.fields.push_back(field);
+        relation.count = 2;
+        relation.key = 0;
+        relation.keyFormat = KEY_FORMAT_NORMALIZED | KEY_FORMAT_PREFIX;
+
+        Table table;
+        REQUIRE(table.create("tablem", relation) == S_OK);
+        REQUIRE(table.open("tablem") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+
+        // 乱序插入[-10000, 10000)
+        std::string payload(1000, 'x');
+        for (long long i = 0; i < 20000; i++) {
+            long long id = i * 7919 % 20000 - 10000;
+            struct iovec iov[2];
+            iov[0].iov_base = &id;
+            iov[0].iov_len = sizeof(long long);
+            iov[1].iov_base = (void *) payload.c_str();
+            iov[1].iov_len = payload.size() + 1;
+            unsigned char header = 0;
+            REQUIRE(table.insert(&header, iov, 2) == S_OK);
+        }
+        REQUIRE(table.indexBlockNum() > 1);
+
+        // 删除奇数键值
+        for (long long id = -9999; id < 10000; id += 2) {
+            struct iovec key;
+            key.iov_base = &id;
+            key.iov_len = sizeof(long long);
+            REQUIRE(table.remove(key) == S_OK);
+        }
+        // 再删掉中间一段，叶子合并时父节点的键值要还原后再删除
+        for (long long id = -4000; id < 4000; id += 2) {
+            struct iovec key;
+            key.iov_base = &id;
+            key.iov_len = sizeof(long long);
+            REQUIRE(table.remove(key) == S_OK);
+        }
+
+        long long expect = -10000;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1) {
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                struct iovec key;
+                (*it2).specialRef(key, 0);
+                REQUIRE(*(long long *) key.iov_base == expect);
+                expect += expect == -4002 ? 8002 : 2;
+            }
+        }
+        REQUIRE(expect == 10000);
+        table.close("tablem");
+        REQUIRE(table.destroy("tablem.dat", "tablem.idx") == S_OK);
+    }
+    SECTION("update")
+    {
+        RelationInfo relation;
+        relation.dataPath = "tableu.dat";
+        relation.indexPath = "tableu.idx";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        field.name = "name";
+        field.index = 1;
+        field.length = -2048;
+        field.fieldType = "VARCHAR";
+        relation.fields.push_back(field);
+        relation.count = 2;
+        relation.key = 0;
+
+        Table table;
+        REQUIRE(table.create("tableu", relation) == S_OK);
+        REQUIRE(table.open("tableu") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+
+        std::vector<std::string> names(1000, std::string(100, 'a'));
+        long long id;
+        struct iovec iov[2];
+        iov[0].iov_base = &id;
+        iov[0].iov_len = sizeof(long long);
+        unsigned char header = 0;
+        for (id = 0; id < 1000; id++) {
+            iov[1].iov_base = (void *) names[id].c_str();
+            iov[1].iov_len = names[id].size() + 1;
+            REQUIRE(table.insert(&header, iov, 2) == S_OK);
+        }
+        unsigned int blocks = table.blockNum();
+
+        // 变短时原地覆盖，变长时在本block内重新分配，都不动索引
+        for (id = 0; id < 50; id++) {
+            names[id] = std::string(10, 'b');
+            iov[1].iov_base = (void *) names[id].c_str();
+            iov[1].iov_len = names[id].size() + 1;
+            REQUIRE(table.update(iov[0], &header, iov, 2) == S_OK);
+        }
+        for (id = 0; id < 20; id++) {
+            names[id] = std::string(200, 'c');
+            iov[1].iov_base = (void *) names[id].c_str();
+            iov[1].iov_len = names[id].size() + 1;
+            REQUIRE(table.update(iov[0], &header, iov, 2) == S_OK);
+        }
+        REQUIRE(table.blockNum() == blocks);
+
+        // block放不下时分裂
+        for (id = 0; id < 1000; id += 3) {
+            names[id] = std::string(1000, 'd');
+            iov[1].iov_base = (void *) names[id].c_str();
+            iov[1].iov_len = names[id].size() + 1;
+            REQUIRE(table.update(iov[0], &header, iov, 2) == S_OK);
+        }
+        REQUIRE(table.blockNum() > blocks);
+
+        // 记录不存在、修改键值
+        id = 1000;
+        REQUIRE(table.update(iov[0], &header, iov, 2) == S_FALSE);
+        long long other = 1;
+        struct iovec otherKey;
+        otherKey.iov_base = &other;
+        otherKey.iov_len = sizeof(long long);
+        id = 2;
+        REQUIRE(table.update(otherKey, &header, iov, 2) == EINVAL);
+
+        long long expect = 0;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1) {
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                struct iovec key, name;
+                (*it2).specialRef(key, 0);
+                (*it2).specialRef(name, 1);
+                REQUIRE(*(long long *) key.iov_base == expect);
+                REQUIRE(std::string((char *) name.iov_base) == names[expect]);
+                expect++;
+            }
+        }
+        REQUIRE(expect == 1000);
+        table.close("tableu");
+        REQUIRE(table.destroy("tableu.dat", "tableu.idx") == S_OK);
+
+        // 两条大记录共用一个叶子，变长后删掉旧记录只剩一条，不能分裂
+        relation.dataPath = "tableq.dat";
+        relation.indexPath = "tableq.idx";
+        relation.fields[1].length = -20000;
+        REQUIRE(table.create("tableq", relation) == S_OK);
+        REQUIRE(table.open("tableq") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+        std::string large[2] = {std::string(7000, 'e'), std::string(7000, 'f')};
+        for (id = 0; id < 2; id++) {
+            iov[1].iov_base = (void *) large[id].c_str();
+            iov[1].iov_len = large[id].size() + 1;
+            REQUIRE(table.insert(&header, iov, 2) == S_OK);
+        }
+        REQUIRE(table.blockNum() == 1);
+        id = 1;
+        large[1] = std::string(9500, 'g');
+        iov[1].iov_base = (void *) large[1].c_str();
+        iov[1].iov_len = large[1].size() + 1;
+        REQUIRE(table.update(iov[0], &header, iov, 2) == S_OK);
+        REQUIRE(table.blockNum() == 2);
+        // 一个空block也放不下时失败，旧记录不变
+        std::string huge(17000, 'h');
+        iov[1].iov_base = (void *) huge.c_str();
+        iov[1].iov_len = huge.size() + 1;
+        REQUIRE(table.update(iov[0], &header, iov, 2) == S_FALSE);
+
+        expect = 0;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1) {
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                struct iovec key, name;
+                (*it2).specialRef(key, 0);
+                (*it2).specialRef(name, 1);
+                REQUIRE(*(long long *) key.iov_base == expect);
+                REQUIRE(std::string((char *) name.iov_base) == large[expect]);
+                expect++;
+            }
+        }
+        REQUIRE(expect == 2);
+        table.close("tableq");
+        REQUIRE(table.destroy("tableq.dat", "tableq.idx") == S_OK);
+    }
+    SECTION("upsert")
+    {
+        RelationInfo relation;
+        relation.dataPath = "tablev.dat";
+        relation.indexPath = "tablev.idx";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        field.name = "name";
+        field.index = 1;
+        field.length = -2048;
+        field.fieldType = "VARCHAR";
+        relation.fields.push_back(field);
+        relation.count = 2;
+        relation.key = 0;
+
+        Table table;
+        REQUIRE(table.create("tablev", relation) == S_OK);
+        REQUIRE(table.open("tablev") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+
+        // 偶数先插入，重复插入被拒绝
+        std::vector<std::string> names(2000);
+        long long id;
+        struct iovec iov[2];
+        iov[0].iov_base = &id;
+        iov[0].iov_len = sizeof(long long);
+        unsigned char header = 0;
+        for (id = 0; id < 2000; id += 2) {
+            names[id] = std::string(50, 'a');
+            iov[1].iov_base = (void *) names[id].c_str();
+            iov[1].iov_len = names[id].size() + 1;
+            REQUIRE(table.insert(&header, iov, 2) == S_OK);
+        }
+        for (id = 0; id < 2000; id += 2)
+            REQUIRE(table.insert(&header, iov, 2) == EEXIST);
+
+        // 偶数替换，奇数插入
+        for (id = 0; id < 2000; id++) {
+            names[id] = std::string(id % 2 ? 80 : 300, 'b');
+            iov[1].iov_base = (void *) names[id].c_str();
+            iov[1].iov_len = names[id].size() + 1;
+            REQUIRE(table.upsert(&header, iov, 2) == S_OK);
+        }
+
+        long long expect = 0;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1) {
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                struct iovec key, name;
+                (*it2).specialRef(key, 0);
+                (*it2).specialRef(name, 1);
+                REQUIRE(*(long long *) key.iov_base == expect);
+                REQUIRE(std::string((char *) name.iov_base) == names[expect]);
+                expect++;
+            }
+        }
+        REQUIRE(expect == 2000);
+        table.close("tablev");
+        REQUIRE(table.destroy("tablev.dat", "tablev.idx") == S_OK);
+    }
+    SECTION("duplicate")
+    {
+        RelationInfo relation;
+        relation.dataPath = "tabled.dat";
+        relation.indexPath = "tabled.idx";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        field.name = "seq";
+        field.index = 1;
+        field.length = 4;
+        field.fieldType = "INT";
+        relation.fields.push_back(field);
+        field.name = "name";
+        field.index = 2;
+        field.length = -255;
+        field.fieldType = "VARCHAR";
+        relation.fields.push_back(field);
+        relation.count = 3;
+        relation.key = 0;
+
+        Table table;
+        relation.keyMode = 2;
+        REQUIRE(table.create("tabled", relation) == EINVAL);
+        relation.keyMode = KEY_MODE_DUPLICATE;
+        REQUIRE(table.create("tabled", relation) == S_OK);
+        REQUIRE(table.open("tabled") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+
+        // 每个键值乱序插入3次，seq记录插入顺序
+        std::string name(200, 'x');
+        long long id;
+        int seq;
+        struct iovec iov[3];
+        iov[0].iov_base = &id;
+        iov[0].iov_len = sizeof(long long);
+        iov[1].iov_base = &seq;
+        iov[1].iov_len = sizeof(int);
+        iov[2].iov_base = (void *) name.c_str();
+        iov[2].iov_len = name.size() + 1;
+        unsigned char header = 0;
+        for (seq = 0; seq < 1500; seq++) {
+            id = seq * 7919 % 500;
+            REQUIRE(table.insert(&header, iov, 3) == S_OK);
+        }
+        REQUIRE(table.blockNum() > 2);
+
+        // 相同键值相邻，按插入顺序排列，分裂不会把它们分开
+        long long last = -1;
+        int lastSeq = -1, copies = 0, rows = 0;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1) {
+            bool first = true;
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                struct iovec key, order;
+                (*it2).specialRef(key, 0);
+                (*it2).specialRef(order, 1);
+                long long k = *(long long *) key.iov_base;
+                int s = *(int *) order.iov_base;
+                if (k == last) {
+                    REQUIRE(!first);
+                    REQUIRE(s > lastSeq);
+                    copies++;
+                } else {
+                    REQUIRE(k > last);
+                    REQUIRE((last == -1 || copies == 3));
+                    copies = 1;
+                }
+                last = k;
+                lastSeq = s;
+                first = false;
+                rows++;
+            }
+        }
+        REQUIRE(copies == 3);
+        REQUIRE(rows == 1500);
+
+        // 每次删除一条
+        table.setDeleteMode(DELETE_MODE_TOMBSTONE);
+        for (id = 0; id < 500; id += 2)
+            for (int i = 0; i < 3; i++)
+                REQUIRE(table.remove(iov[0]) == S_OK);
+        rows = 0;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1)
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                struct iovec key;
+                (*it2).specialRef(key, 0);
+                REQUIRE(*(long long *) key.iov_base % 2 == 1);
+                rows++;
+            }
+        REQUIRE(rows == 750);
+        table.close("tabled");
+        REQUIRE(table.destroy("tabled.dat", "tabled.idx") == S_OK);
+    }
+    SECTION("duplicateRange")
+    {
+        RelationInfo relation;
+        relation.dataPath = "tablez.dat";
+        relation.indexPath = "tablez.idx";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        field.name = "name";
+        field.index = 1;
+        field.length = -255;
+        field.fieldType = "VARCHAR";
+        relation.fields.push_back(field);
+        relation.count = 2;
+        relation.key = 0;
+        relation.keyMode = KEY_MODE_DUPLICATE;
+
+        Table table;
+        REQUIRE(table.create("tablez", relation) == S_OK);
+        REQUIRE(table.open("tablez") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+
+        // 500的600个副本跨越多个叶子，父节点中的分隔键相同
+        std::string name(200, 'x');
+        long long id;
+        struct iovec iov[2];
+        iov[0].iov_base = &id;
+        iov[0].iov_len = sizeof(long long);
+        iov[1].iov_base = (void *) name.c_str();
+        iov[1].iov_len = name.size() + 1;
+        unsigned char header = 0;
+        for (id = 0; id < 1000; id += 10)
+            REQUIRE(table.insert(&header, iov, 2) == S_OK);
+        id = 500;
+        for (int i = 0; i < 600; i++)
+            REQUIRE(table.insert(&header, iov, 2) == S_OK);
+        for (id = 1000; id < 2000; id += 10)
+            REQUIRE(table.insert(&header, iov, 2) == S_OK);
+
+        long long lo = 200, hi = 900;
+        struct iovec loField, hiField;
+        loField.iov_base = &lo;
+        loField.iov_len = sizeof(lo);
+        hiField.iov_base = &hi;
+        hiField.iov_len = sizeof(hi);
+        REQUIRE(table.removeRange(loField, hiField) == S_OK);
+
+        // 再插入的记录都在叶子链上
+        for (id = 300; id < 800; id += 5)
+            REQUIRE(table.insert(&header, iov, 2) == S_OK);
+        std::string row;
+        for (id = 300; id < 800; id += 5)
+            REQUIRE(table.get(iov[0], row) == S_OK);
+        int rows = 0, inserted = 0;
+        long long last = -1;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1)
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                struct iovec key;
+                (*it2).specialRef(key, 0);
+                long long k = *(long long *) key.iov_base;
+                REQUIRE(k >= last);
+                if (k >= 300 && k < 800) inserted++;
+                last = k;
+                rows++;
+            }
+        REQUIRE(inserted == 100);
+        REQUIRE(rows == 20 + 100 + 100 + 9);
+        table.close("tablez");
+        REQUIRE(table.destroy("tablez.dat", "tablez.idx") == S_OK);
+    }
+    SECTION("timestamp")
+    {
+        RelationInfo relation;
+        relation.dataPath = "tablet.dat";
+        relation.indexPath = "tablet.idx";
+        FieldInfo field;
+        field.name = "ts";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "TIMESTAMP";
+        relation.fields.push_back(field);
+        field.name = "value";
+        field.index = 1;
+        field.length = 8;
+        field.fieldType = "DOUBLE";
+        relation.fields.push_back(field);
+        relation.count = 2;
+        relation.key = 0;
+
+        Table table;
+        REQUIRE(table.create("tablet", relation) == S_OK);
+        REQUIRE(table.open("tablet") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+
+        // 每秒一个事件，乱序到达
+        TimeStamp base;
+        REQUIRE(base.fromString("2024_01_01-00:00:00.000000"));
+        const int count = 20000;
+        TimeStamp ts;
+        double value;
+        struct iovec iov[2];
+        iov[0].iov_base = &ts.stamp_;
+        iov[0].iov_len = sizeof(long long);
+        iov[1].iov_base = &value;
+        iov[1].iov_len = sizeof(double);
+        unsigned char header = 0;
+        for (int i = 0; i < count; i++) {
+            int second = i * 7919 % count;
+            ts.setMicros(base.micros() + second * 1000000LL);
+            value = second * 0.5 - 100;
+            REQUIRE(table.insert(&header, iov, 2) == S_OK);
+        }
+
+        // 时间范围[lo, hi)：一次定位后顺序读
+        TimeStamp lo, hi;
+        REQUIRE(lo.fromString("2024_01_01-01:00:00.500000"));
+        REQUIRE(hi.fromString("2024_01_01-02:00:00.000000"));
+        struct iovec loKey;
+        loKey.iov_base = &lo.stamp_;
+        loKey.iov_len = sizeof(long long);
+        long long expect = 3601;
+        bool done = false;
+        for (auto it1 = table.seekBlock(loKey);
+             !done && it1 != table.blockEnd();
+             ++it1) {
+            auto it2 = table.seek(it1, loKey);
+            for (; it2 != table.end(it1); ++it2) {
+                struct iovec key, metric;
+                (*it2).specialRef(key, 0);
+                (*it2).specialRef(metric, 1);
+                TimeStamp at;
+                at.setMicros(*(long long *) key.iov_base);
+                if (at >= hi) {
+                    done = true;
+                    break;
+                }
+                REQUIRE(at.micros() == base.micros() + expect * 1000000LL);
+                REQUIRE(*(double *) metric.iov_base == expect * 0.5 - 100);
+                expect++;
+            }
+        }
+        REQUIRE(expect == 7200);
+        table.close("tablet");
+        REQUIRE(table.destroy("tablet.dat", "tablet.idx") == S_OK);
+    }
+    SECTION("composite")
+    {
+        RelationInfo relation;
+        relation.dataPath = "tablek.dat";
+        relation.indexPath = "tablek.idx";
+        FieldInfo field;
+        field.name = "tenant";
+        field.index = 0;
+        field.length = 4;
+        field.fieldType = "INT";
+        relation.fields.push_back(field);
+        field.name = "ts";
+        field.index = 1;
+        field.length = 8;
+        field.fieldType = "TIMESTAMP";
+        relation.fields.push_back(field);
+        field.name = "value";
+        field.index = 2;
+        field.length = 8;
+        field.fieldType = "DOUBLE";
+        relation.fields.push_back(field);
+        relation.count = 3;
+        relation.keys.push_back(0);
+        relation.keys.push_back(1);
+
+        Table table;
+        REQUIRE(table.create("tablek", relation) == S_OK);
+        REQUIRE(table.open("tablek") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+
+        // 10个租户各1000秒，乱序到达，负数租户排在前面
+        const int count = 10000;
+        int tenant;
+        long long micros;
+        double value;
+        struct iovec iov[3];
+        iov[0].iov_base = &tenant;
+        iov[0].iov_len = sizeof(int);
+        iov[1].iov_base = &micros;
+        iov[1].iov_len = sizeof(long long);
+        iov[2].iov_base = &value;
+        iov[2].iov_len = sizeof(double);
+        unsigned char header = 0;
+        for (int i = 0; i < count; i++) {
+            int n = i * 7919 % count;
+            tenant = n / 1000 - 5;
+            micros = n % 1000 * 1000000LL;
+            value = n;
+            REQUIRE(table.insert(&header, iov, 3) == S_OK);
+        }
+        REQUIRE(table.insert(&header, iov, 3) == EEXIST);
+        REQUIRE(table.insert(&header, iov, 2) == EINVAL);
+
+        // 按完整键值改写、删除
+        unsigned char key[32], prefix[32];
+        struct iovec keyField;
+        keyField.iov_base = key;
+        tenant = 2;
+        micros = 5000000LL;
+        value = -1;
+        keyField.iov_len = table.makeKey(iov, 2, key, sizeof(key));
+        REQUIRE(keyField.iov_len == 12);
+        REQUIRE(table.makeKey(iov, 2, key, 8) == 0);
+        REQUIRE(table.update(keyField, &header, iov, 3) == S_OK);
+        micros = 6000000LL;
+        keyField.iov_len = table.makeKey(iov, 2, key, sizeof(key));
+        REQUIRE(table.remove(keyField) == S_OK);
+
+        // 租户2的前缀扫描，按时间有序
+        struct iovec prefixField;
+        prefixField.iov_base = prefix;
+        prefixField.iov_len = table.makeKey(iov, 1, prefix, sizeof(prefix));
+        REQUIRE(prefixField.iov_len == 4);
+        long long expect = 0;
+        bool done = false;
+        for (auto it1 = table.seekBlock(prefixField);
+             !done && it1 != table.blockEnd();
+             ++it1) {
+            auto it2 = table.seek(it1, prefixField);
+            for (; it2 != table.end(it1); ++it2) {
+                struct iovec at, ts, metric;
+                (*it2).specialRef(at, 3);
+                if (at.iov_len < prefixField.iov_len ||
+                    memcmp(at.iov_base, prefix, prefixField.iov_len) != 0) {
+                    done = true;
+                    break;
+                }
+                (*it2).specialRef(ts, 1);
+                (*it2).specialRef(metric, 2);
+                if (expect == 6) expect++;
+                REQUIRE(*(long long *) ts.iov_base == expect * 1000000LL);
+                REQUIRE(
+                    *(double *) metric.iov_base ==
+                    (expect == 5 ? -1 : 7000 + expect));
+                expect++;
+            }
+        }
+        REQUIRE(expect == 1000);
+        table.close("tablek");
+        REQUIRE(table.destroy("tablek.dat", "tablek.idx") == S_OK);
+    }
+    SECTION("secondary")
+    {
+        RelationInfo relation;
+        relation.dataPath = "tableo.dat";
+        relation.indexPath = "tableo.idx";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        field.name = "city";
+        field.index = 1;
+        field.length = -32;
+        field.fieldType = "VARCHAR";
+        relation.fields.push_back(field);
+        field.name = "amount";
+        field.index = 2;
+        field.length = 8;
+        field.fieldType = "DOUBLE";
+        relation.fields.push_back(field);
+        relation.count = 3;
+        relation.key = 0;
+
+        Table table;
+        REQUIRE(table.create("tableo", relation) == S_OK);
+        REQUIRE(table.open("tableo") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+
+        // 30个城市轮流，一半记录在建索引之前插入
+        const int count = 3000;
+        long long id;
+        char city[16];
+        double amount;
+        struct iovec iov[3];
+        iov[0].iov_base = &id;
+        iov[0].iov_len = sizeof(long long);
+        iov[1].iov_base = city;
+        iov[2].iov_base = &amount;
+        iov[2].iov_len = sizeof(double);
+        unsigned char header = 0;
+        for (int i = 0; i < count; i++) {
+            id = i * 7919 % count;
+            iov[1].iov_len =
+                snprintf(city, sizeof(city), "city%02d", (int) id % 30);
+            amount = id * 0.5;
+            REQUIRE(table.insert(&header, iov, 3) == S_OK);
+            if (i == count / 2) {
+                RelationInfo index;
+                index.dataPath = "tableo_city.dat";
+                index.indexPath = "tableo_city.idx";
+                unsigned int columns[] = {1};
+                REQUIRE(
+                    table.createIndex("tableo_city", columns, 1, index) ==
+                    S_OK);
+                REQUIRE(index.sources.size() == 2);
+                REQUIRE(index.sources[1] == 0);
+            }
+        }
+
+        // 按城市查找，同城按主键有序
+        struct iovec where;
+        where.iov_base = city;
+        std::vector<std::string> rows;
+        where.iov_len = snprintf(city, sizeof(city), "city07");
+        REQUIRE(table.lookup("tableo_city", &where, 1, rows) == S_OK);
+        REQUIRE(rows.size() == 100);
+        for (size_t i = 0; i < rows.size(); i++) {
+            Record record;
+            record.attach(
+                (unsigned char *) &rows[i][0], (unsigned short) rows[i].size());
+            struct iovec at;
+            record.specialRef(at, 0);
+            REQUIRE(*(long long *) at.iov_base == (long long) i * 30 + 7);
+            record.specialRef(at, 2);
+            REQUIRE(*(double *) at.iov_base == (i * 30 + 7) * 0.5);
+        }
+        where.iov_len = snprintf(city, sizeof(city), "city");
+        REQUIRE(table.lookup("tableo_city", &where, 1, rows) == S_OK);
+        REQUIRE(rows.empty());
+        REQUIRE(table.lookup("tableo_none", &where, 1, rows) == EINVAL);
+
+        // update、upsert换城市，remove和removeRange删除，索引随之变化
+        struct iovec keyField;
+        keyField.iov_base = &id;
+        keyField.iov_len = sizeof(long long);
+        id = 7;
+        iov[1].iov_len = snprintf(city, sizeof(city), "city99");
+        REQUIRE(table.update(keyField, &header, iov, 3) == S_OK);
+        id = 37;
+        REQUIRE(table.upsert(&header, iov, 3) == S_OK);
+        id = 67;
+        REQUIRE(table.remove(keyField) == S_OK);
+        REQUIRE(table.remove(keyField) == S_OK);
+        long long lo = 2000, hi = 2999;
+        struct iovec loField, hiField;
+        loField.iov_base = &lo;
+        loField.iov_len = sizeof(long long);
+        hiField.iov_base = &hi;
+        hiField.iov_len = sizeof(long long);
+        REQUIRE(table.removeRange(loField, hiField) == S_OK);
+
+        where.iov_len = snprintf(city, sizeof(city), "city99");
+        REQUIRE(table.lookup("tableo_city", &where, 1, rows) == S_OK);
+        REQUIRE(rows.size() == 2);
+        where.iov_len = snprintf(city, sizeof(city), "city07");
+        REQUIRE(table.lookup("tableo_city", &where, 1, rows) == S_OK);
+        REQUIRE(rows.size() == 64);
+
+        // 重新打开时按schema找到索引
+        table.close("tableo");
+        Table reopen;
+        REQUIRE(reopen.open("tableo") == S_OK);
+        REQUIRE(reopen.initial() == S_OK);
+        REQUIRE(reopen.lookup("tableo_city", &where, 1, rows) == S_OK);
+        REQUIRE(rows.size() == 64);
+        reopen.close("tableo");
+        REQUIRE(reopen.destroy("tableo.dat", "tableo.idx") == S_OK);
+    }
+    SECTION("covering")
+    {
+        RelationInfo relation;
+        relation.dataPath = "tablei.dat";
+        relation.indexPath = "tablei.idx";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        field.name = "region";
+        field.index = 1;
+        field.length = 4;
+        field.fieldType = "INT";
+        relation.fields.push_back(field);
+        field.name = "amount";
+        field.index = 2;
+        field.length = 8;
+        field.fieldType = "DOUBLE";
+        relation.fields.push_back(field);
+        field.name = "note";
+        field.index = 3;
+        field.length = -255;
+        field.fieldType = "VARCHAR";
+        relation.fields.push_back(field);
+        relation.count = 4;
+        relation.key = 0;
+
+        Table table;
+        REQUIRE(table.create("tablei", relation) == S_OK);
+        REQUIRE(table.open("tablei") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+        RelationInfo index;
+        index.dataPath = "tablei_region.dat";
+        index.indexPath = "tablei_region.idx";
+        unsigned int columns[] = {1};
+        unsigned int included[] = {2};
+        REQUIRE(
+            table.createIndex(
+                "tablei_region", columns, 1, index, included, 1) == S_OK);
+        REQUIRE(table.indexColumn("tablei_region", 1) == 0);
+        REQUIRE(table.indexColumn("tablei_region", 0) == 1);
+        REQUIRE(table.indexColumn("tablei_region", 2) == 2);
+        REQUIRE(table.indexColumn("tablei_region", 3) == -1);
+
+        // 每行带一段长备注，回表要多读很多block
+        const int count = 4000;
+        long long id;
+        int region;
+        double amount;
+        char note[200];
+        memset(note, 'x', sizeof(note));
+        struct iovec iov[4];
+        iov[0].iov_base = &id;
+        iov[0].iov_len = sizeof(long long);
+        iov[1].iov_base = &region;
+        iov[1].iov_len = sizeof(int);
+        iov[2].iov_base = &amount;
+        iov[2].iov_len = sizeof(double);
+        iov[3].iov_base = note;
+        iov[3].iov_len = sizeof(note);
+        unsigned char header = 0;
+        for (int i = 0; i < count; i++) {
+            id = i * 7919 % count;
+            region = (int) id % 20;
+            amount = (double) id;
+            REQUIRE(table.insert(&header, iov, 4) == S_OK);
+        }
+
+        // 只改included列，索引条目随之刷新
+        id = 3;
+        region = 3;
+        amount = -1;
+        struct iovec keyField;
+        keyField.iov_base = &id;
+        keyField.iov_len = sizeof(long long);
+        REQUIRE(table.update(keyField, &header, iov, 4) == S_OK);
+
+        // region=3的amount合计：只读索引和回表结果相同
+        struct iovec where;
+        where.iov_base = &region;
+        where.iov_len = sizeof(int);
+        double expect = -1;
+        for (long long i = 23; i < count; i += 20)
+            expect += (double) i;
+
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        std::vector<std::string> entries;
+        REQUIRE(table.lookupIndex("tablei_region", &where, 1, entries) == S_OK);
+        REQUIRE(entries.size() == count / 20);
+        double sum = 0;
+        for (size_t i = 0; i < entries.size(); i++) {
+            Record record;
+            record.attach(
+                (unsigned char *) &entries[i][0],
+                (unsigned short) entries[i].size());
+            struct iovec at;
+            record.specialRef(at, 2);
+            sum += *(double *) at.iov_base;
+        }
+        std::chrono::steady_clock::duration covering =
+            std::chrono::steady_clock::now() - start;
+        REQUIRE(sum == expect);
+
+        start = std::chrono::steady_clock::now();
+        std::vector<std::string> rows;
+        REQUIRE(table.lookup("tablei_region", &where, 1, rows) == S_OK);
+        REQUIRE(rows.size() == count / 20);
+        sum = 0;
+        for (size_t i = 0; i < rows.size(); i++) {
+            Record record;
+            record.attach(
+                (unsigned char *) &rows[i][0], (unsigned short) rows[i].size());
+            struct iovec at;
+            record.specialRef(at, 2);
+            sum += *(double *) at.iov_base;
+        }
+        std::chrono::steady_clock::duration fetch =
+            std::chrono::steady_clock::now() - start;
+        REQUIRE(sum == expect);
+        std::cout << "secondary index only: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(
+                         covering)
+                         .count()
+                  << "us, with fetch: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(
+                         fetch)
+                         .count()
+                  << "us" << std::endl;
+
+        table.close("tablei");
+        REQUIRE(table.destroy("tablei.dat", "tablei.idx") == S_OK);
+    }
+    SECTION("statistics")
+    {
+        RelationInfo relation;
+        relation.dataPath = "tablex.dat";
+        relation.indexPath = "tablex.idx";
+        FieldInfo field;
+        field.name = "name";
+        field.index = 0;
+        field.length = -1024;
+        field.fieldType = "VARCHAR";
+        relation.fields.push_back(field);
+        field.name = "value";
+        field.index = 1;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        relation.count = 2;
+        relation.key = 0;
+
+        Table table;
+        REQUIRE(table.create("tablex", relation) == S_OK);
+        REQUIRE(table.open("tablex") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+
+        // 空表
+        TableStats stats;
+        REQUIRE(table.statistics(stats) == S_OK);
+        REQUIRE(stats.rows == 0);
+        REQUIRE(stats.leafBlocks == 1);
+        REQUIRE(stats.height == 2);
+        REQUIRE(stats.minKey.empty());
+
+        // 增量维护的结果和扫描一致
+        auto check = [&table](TableStats &stats) {
+            REQUIRE(table.statistics(stats) == S_OK);
+            SpaceInfo space;
+            REQUIRE(table.spaceInfo(space) == S_OK);
+            REQUIRE(stats.liveBytes == space.liveBytes);
+            REQUIRE(stats.leafBlocks == space.leafBlocks);
+            REQUIRE(stats.dataBlocks == space.dataBlocks);
+            REQUIRE(stats.indexBlocks == space.indexBlocks);
+            unsigned long long rows = 0;
+            for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1)
+                for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2)
+                    rows++;
+            REQUIRE(stats.rows == rows);
+        };
+
+        // 长公共前缀的键值截不短，索引很快长到3层
+        const int count = 3000;
+        char name[600];
+        auto nameOf = [&name](int id) {
+            memset(name, 'x', sizeof(name));
+            snprintf(name + sizeof(name) - 7, 7, "%06d", id);
+            return std::string(name, sizeof(name));
+        };
+        long long value;
+        struct iovec iov[2];
+        iov[0].iov_base = name;
+        iov[0].iov_len = sizeof(name);
+        iov[1].iov_base = &value;
+        iov[1].iov_len = sizeof(long long);
+        unsigned char header = 0;
+        for (int i = 0; i < count; i++) {
+            value = i * 7919 % count;
+            nameOf((int) value);
+            REQUIRE(table.insert(&header, iov, 2) == S_OK);
+        }
+        check(stats);
+        REQUIRE(stats.rows == count);
+        REQUIRE(stats.height == 3);
+        REQUIRE(stats.minKey == nameOf(0));
+        REQUIRE(stats.maxKey == nameOf(count - 1));
+        REQUIRE(stats.fill > 0.4);
+
+        // 替换不改变行数，删除最小、最大键值后重新定位
+        struct iovec keyField = iov[0];
+        for (int id = 100; id < 200; id++) {
+            nameOf(id);
+            value = -id;
+            REQUIRE(table.upsert(&header, iov, 2) == S_OK);
+        }
+        nameOf(0);
+        REQUIRE(table.remove(keyField) == S_OK);
+        nameOf(count - 1);
+        REQUIRE(table.remove(keyField) == S_OK);
+        REQUIRE(table.remove(keyField) == S_OK);
+        check(stats);
+        REQUIRE(stats.rows == count - 2);
+        REQUIRE(stats.minKey == nameOf(1));
+        REQUIRE(stats.maxKey == nameOf(count - 2));
+
+        std::string lo = nameOf(1000), hi = nameOf(1999);
+        struct iovec loField, hiField;
+        loField.iov_base = (void *) lo.data();
+        loField.iov_len = lo.size();
+        hiField.iov_base = (void *) hi.data();
+        hiField.iov_len = hi.size();
+        REQUIRE(table.removeRange(loField, hiField) == S_OK);
+        check(stats);
+        REQUIRE(stats.rows == count - 1002);
+
+        table.setDeleteMode(DELETE_MODE_TOMBSTONE);
+        for (int id = 2000; id < 2500; id += 2) {
+            nameOf(id);
+            REQUIRE(table.remove(keyField) == S_OK);
+        }
+        check(stats);
+        REQUIRE(stats.rows == count - 1252);
+        REQUIRE(table.compact() == S_OK);
+        check(stats);
+
+        // 写入root，重新加载
+        table.close("tablex");
+        RelationInfo &info = gschema.lookup("tablex").first->second;
+        REQUIRE(!info.statsDirty);
+        info.height = 0;
+        info.rows = 0;
+        Table reopen;
+        REQUIRE(reopen.open("tablex") == S_OK);
+        REQUIRE(reopen.initial() == S_OK);
+        TableStats loaded;
+        REQUIRE(reopen.statistics(loaded) == S_OK);
+        REQUIRE(loaded.rows == stats.rows);
+        REQUIRE(loaded.liveBytes == stats.liveBytes);
+        REQUIRE(loaded.leafBlocks == stats.leafBlocks);
+        REQUIRE(loaded.height == stats.height);
+        REQUIRE(loaded.minKey == stats.minKey);
+        REQUIRE(loaded.maxKey == stats.maxKey);
+        reopen.close("tablex");
+        REQUIRE(reopen.destroy("tablex.dat", "tablex.idx") == S_OK);
+    }
+    SECTION("statisticsTombstone")
+    {
+        RelationInfo relation;
+        relation.dataPath = "tabley.dat";
+        relation.indexPath = "tabley.idx";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        field.name = "name";
+        field.index = 1;
+        field.length = -255;
+        field.fieldType = "VARCHAR";
+        relation.fields.push_back(field);
+        relation.count = 2;
+        relation.key = 0;
+
+        Table table;
+        REQUIRE(table.create("tabley", relation) == S_OK);
+        REQUIRE(table.open("tabley") == S_OK);
+        REQUIRE(table.initial() == S_OK);
+        table.setDeleteMode(DELETE_MODE_TOMBSTONE);
+
+        long long id;
+        const char *name = "junix";
+        struct iovec iov[2];
+        iov[0].iov_base = &id;
+        iov[0].iov_len = sizeof(id);
+        iov[1].iov_base = (void *) name;
+        iov[1].iov_len = strlen(name) + 1;
+        unsigned char header = 0;
+        for (id = 0; id < 2000; id++)
+            REQUIRE(table.insert(&header, iov, 2) == S_OK);
+        for (id = 100; id < 400; id++)
+            REQUIRE(table.remove(iov[0]) == S_OK);
+
+        // 范围里有tombstone，只扣除有效记录
+        long long lo = 50, hi = 500;
+        struct iovec loField, hiField;
+        loField.iov_base = &lo;
+        loField.iov_len = sizeof(lo);
+        hiField.iov_base = &hi;
+        hiField.iov_len = sizeof(hi);
+        for (int pass = 0; pass < 2; pass++) {
+            REQUIRE(table.removeRange(loField, hiField) == S_OK);
+            TableStats stats;
+            REQUIRE(table.statistics(stats) == S_OK);
+            SpaceInfo space;
+            REQUIRE(table.spaceInfo(space) == S_OK);
+            REQUIRE(stats.rows == 2000 - 451);
+            REQUIRE(stats.liveBytes == space.liveBytes);
+            REQUIRE(stats.minKey.size() == sizeof(long long));
+            REQUIRE(*(const long long *) stats.minKey.data() == 0);
+        }
+        table.close("tabley");
+        REQUIRE(table.destroy("tabley.dat", "tabley.idx") == S_OK);
+    }
     SECTION("destroy")
     {
         Table table;
@@ -180,4 +1696,4 @@ TEST_CASE("db/tableindex.h")
         REQUIRE(table.destroy("tablee.dat", "tablee.idx") == S_OK);
         REQUIRE(gschema.destroy() == S_OK);
     }
-}
\ No newline at end of file
+}
@@ -6,6 +6,12 @@
 //
 #include "../catch.hpp"
 #include <db/timestamp.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
 using namespace db;
 
 TEST_CASE("db/timestamp.h")
@@ -15,5 +21,122 @@ TEST_CASE("db/timestamp.h")
         TimeStamp ts;
         ts.now();
         REQUIRE(sizeof(ts.stamp_) == 8);
+        TimeStamp later;
+        later.now();
+        REQUIRE(ts <= later);
     }
-}
\ No newline at end of file
+    SECTION("string")
+    {
+        TimeStamp ts;
+        char buffer[TimeStamp::STRING_SIZE];
+        REQUIRE(ts.toString(buffer, sizeof(buffer)));
+        REQUIRE(strcmp(buffer, "1970_01_01-00:00:00.000000") == 0);
+        REQUIRE(!ts.toString(buffer, sizeof(buffer) - 1));
+
+        // 闰年、纪元之前
+        REQUIRE(ts.fromString("2024_02_29-23:59:59.999999"));
+        REQUIRE(ts.micros() == 1709251199999999LL);
+        REQUIRE(ts.toString(buffer, sizeof(buffer)));
+        REQUIRE(strcmp(buffer, "2024_02_29-23:59:59.999999") == 0);
+        ts.setMicros(-1);
+        REQUIRE(ts.toString(buffer, sizeof(buffer)));
+        REQUIRE(strcmp(buffer, "1969_12_31-23:59:59.999999") == 0);
+
+        REQUIRE(!ts.fromString("2024-02-29 23:59:59.999999"));
+        REQUIRE(!ts.fromString("2024_13_01-00:00:00.000000"));
+        REQUIRE(!ts.fromString("2024_01_01-00:00"));
+
+        // 往返一致，字符串顺序和整数顺序一致
+        TimeStamp prev, next;
+        char last[TimeStamp::STRING_SIZE] = "";
+        for (long long micros = -5000000000000000LL;
+             micros < 200000000000000000LL;
+             micros += 9876543219876LL) {
+            ts.setMicros(micros);
+            REQUIRE(ts.toString(buffer, sizeof(buffer)));
+            REQUIRE(next.fromString(buffer));
+            REQUIRE(next == ts);
+            REQUIRE(strcmp(last, buffer) < 0);
+            memcpy(last, buffer, sizeof(buffer));
+        }
+        prev.setMicros(1);
+        next.setMicros(2);
+        REQUIRE(prev < next);
+        REQUIRE(prev != next);
+        REQUIRE(next >= prev);
+    }
+    SECTION("benchmark")
+    {
+        // 旧实现：两边都用snprintf和localtime_s格式化后比较字符串
+        const int count = 100000;
+        std::vector<TimeStamp> stamps(count);
+        for (int i = 0; i < count; i++)
+            stamps[i].setMicros(
+                1700000000000000LL + i * 7919LL % count * 1000);
+
+        std::chrono::steady_clock::duration cost[2];
+        int less[2] = {0, 0};
+        for (int path = 0; path < 2; path++) {
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            for (int i = 1; i < count; i++) {
+                const TimeStamp &x = stamps[i - 1], &y = stamps[i];
+                if (path == 1) {
+                    less[path] += x < y;
+                    continue;
+                }
+                char bx[64], by[64];
+                const TimeStamp *ts[2] = {&x, &y};
+                char *bufs[2] = {bx, by};
+                for (int k = 0; k < 2; k++) {
+                    time_t t = (time_t) (ts[k]->micros() / 1000000);
+                    struct tm tm;
+                    localtime_s(&tm, &t);
+                    snprintf(
+                        bufs[k],
+                        64,
+                        "%4d_%02d_%02d-%02d:%02d:%02d.%06d",
+                        tm.tm_year + 1900,
+                        tm.tm_mon + 1,
+                        tm.tm_mday,
+                        tm.tm_hour,
+                        tm.tm_min,
+                        tm.tm_sec,
+                        (int) (ts[k]->micros() % 1000000));
+                }
+                less[path] += strcmp(bx, by) < 0;
+            }
+            cost[path] = std::chrono::steady_clock::now() - start;
+        }
+        REQUIRE(less[0] == less[1]);
+
+        // 格式化和解析
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        char buffer[TimeStamp::STRING_SIZE];
+        TimeStamp parsed;
+        int same = 0;
+        for (int i = 0; i < count; i++) {
+            stamps[i].toString(buffer, sizeof(buffer));
+            parsed.fromString(buffer);
+            same += parsed == stamps[i];
+        }
+        std::chrono::steady_clock::duration convert =
+            std::chrono::steady_clock::now() - start;
+        REQUIRE(same == count);
+
+        std::cout << "timestamp compare string: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(
+                         cost[0])
+                         .count()
+                  << "us, integer: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(
+                         cost[1])
+                         .count()
+                  << "us, toString+fromString: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(
+                         convert)
+                         .count()
+                  << "us" << std::endl;
+    }
+}